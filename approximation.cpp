@@ -0,0 +1,324 @@
+#include "approximation.hpp"
+#include "compiled.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+namespace {
+
+// Dyadic piece: index[v] counts pieces of width 2^-level along variable v.
+struct Piece {
+    unsigned level;
+    std::uint64_t index[2];
+};
+
+// Roots of T_m on [-1, 1].
+std::vector<double> chebyshev_nodes(unsigned m) {
+    std::vector<double> nodes(m);
+    for (unsigned k = 0; k < m; k++) {
+        nodes[k] = std::cos(std::acos(-1.0) * (k + 0.5) / m);
+    }
+    return nodes;
+}
+
+// Both ends and the midpoints between neighbouring nodes, where the
+// interpolation error of a smooth function peaks.
+std::vector<double> check_points(const std::vector<double> &nodes) {
+    std::vector<double> points = {1, -1};
+    for (std::size_t k = 0; k + 1 < nodes.size(); k++) {
+        points.push_back((nodes[k] + nodes[k + 1]) / 2);
+    }
+    return points;
+}
+
+// Coefficients of the interpolant through f at chebyshev_nodes(m).
+void chebyshev_coefficients(const double *f, std::size_t f_stride, unsigned m, double *c, std::size_t c_stride) {
+    for (unsigned j = 0; j < m; j++) {
+        double sum = 0;
+        for (unsigned k = 0; k < m; k++) {
+            sum += f[k * f_stride] * std::cos(std::acos(-1.0) * j * (k + 0.5) / m);
+        }
+        c[j * c_stride] = (j == 0 ? 1.0 : 2.0) * sum / m;
+    }
+}
+
+inline double clenshaw(const double *c, unsigned m, double t) {
+    double b1 = 0, b2 = 0;
+    for (unsigned j = m; j-- > 1;) {
+        double b = c[j] + 2 * t * b1 - b2;
+        b2 = b1;
+        b1 = b;
+    }
+    return c[0] + t * b1 - b2;
+}
+
+// Outer recurrence over x, with each x coefficient an inner recurrence over y.
+inline double clenshaw(const double *c, unsigned m, double tx, double ty) {
+    double b1 = 0, b2 = 0;
+    for (unsigned i = m; i-- > 1;) {
+        double b = clenshaw(c + i * m, m, ty) + 2 * tx * b1 - b2;
+        b2 = b1;
+        b1 = b;
+    }
+    return clenshaw(c, m, ty) + tx * b1 - b2;
+}
+
+// Truncation error estimate along one axis: the last two coefficients of
+// degree 2 or more. Degrees 0 and 1 are the piece's level and slope, which
+// say nothing about the dropped terms, so low-degree fits rely on the check
+// points alone.
+inline double tail(const double *c, unsigned m, std::size_t stride) {
+    double res = 0;
+    for (unsigned j = std::max(m, 4u) - 2; j < m; j++) {
+        res += std::abs(c[j * stride]);
+    }
+    return res;
+}
+
+// Table cell of `value`, clamped so outside points use the edge pieces.
+inline std::size_t cell(double value, double lower, double cells, std::size_t count) {
+    double position = (value - lower) * cells;
+    return position > 0 ? std::min((std::size_t) position, count - 1) : 0;
+}
+
+void check_options(double width, const ApproximationOptions &options) {
+    if (!(width > 0)) {
+        throw std::invalid_argument("approximation domain is empty");
+    }
+    if (options.degree == 0) {
+        throw std::invalid_argument("approximation degree must be at least 1");
+    }
+}
+
+}
+
+
+PiecewiseChebyshev::PiecewiseChebyshev(const Expression<rational> &expr, const std::string &var,
+                                       double lower, double upper, const std::map<std::string, rational> &parameters,
+                                       ApproximationOptions options) : _lower(lower), _degree(options.degree) {
+    double width = upper - lower;
+    check_options(width, options);
+    Program<rational> program(parameters.empty() ? expr : expr.sub(parameters), {var});
+    unsigned m = _degree + 1;
+    std::vector<double> nodes = chebyshev_nodes(m);
+    std::vector<double> checks = check_points(nodes);
+    std::size_t per = m + checks.size();
+
+    std::vector<Piece> pending = {{0, {0, 0}}};
+    std::vector<Piece> placed;
+    std::vector<double> points, values, coefficients(m);
+    for (unsigned level = 0; !pending.empty(); level++) {
+        double half = width / std::ldexp(2.0, level);
+        points.resize(pending.size() * per);
+        for (std::size_t i = 0; i < pending.size(); i++) {
+            double center = lower + (2 * pending[i].index[0] + 1) * half;
+            double *point = points.data() + i * per;
+            for (unsigned k = 0; k < m; k++) {
+                point[k] = center + half * nodes[k];
+            }
+            for (std::size_t k = 0; k < checks.size(); k++) {
+                point[m + k] = center + half * checks[k];
+            }
+        }
+        const rational *columns[] = {points.data()};
+        values.resize(points.size());
+        program.eval_batch(columns, points.size(), values.data());
+
+        bool last = level >= options.max_depth;
+        std::vector<Piece> next;
+        for (std::size_t i = 0; i < pending.size(); i++) {
+            const double *f = values.data() + i * per;
+            chebyshev_coefficients(f, 1, m, coefficients.data(), 1);
+            double error = tail(coefficients.data(), m, 1);
+            for (std::size_t k = 0; k < checks.size(); k++) {
+                error = std::max(error, std::abs(f[m + k] - clenshaw(coefficients.data(), m, checks[k])));
+            }
+            if (last || error <= options.tolerance) {
+                _converged = _converged && error <= options.tolerance;
+                _max_error = std::isnan(error) ? INFINITY : std::max(_max_error, error);
+                placed.push_back(pending[i]);
+                _centers.push_back(lower + (2 * pending[i].index[0] + 1) * half);
+                _scales.push_back(1 / half);
+                _coefficients.insert(_coefficients.end(), coefficients.begin(), coefficients.end());
+            } else {
+                next.push_back({level + 1, {2 * pending[i].index[0], 0}});
+                next.push_back({level + 1, {2 * pending[i].index[0] + 1, 0}});
+            }
+        }
+        pending = std::move(next);
+    }
+
+    unsigned deepest = 0;
+    for (const auto &piece : placed) {
+        deepest = std::max(deepest, piece.level);
+    }
+    _table.resize(std::size_t(1) << deepest);
+    _cells = _table.size() / width;
+    for (std::uint32_t p = 0; p < placed.size(); p++) {
+        std::size_t span = std::size_t(1) << (deepest - placed[p].level);
+        std::fill_n(_table.begin() + placed[p].index[0] * span, span, p);
+    }
+}
+
+std::size_t PiecewiseChebyshev::pieces() const {
+    return _centers.size();
+}
+
+unsigned PiecewiseChebyshev::degree() const {
+    return _degree;
+}
+
+double PiecewiseChebyshev::max_error() const {
+    return _max_error;
+}
+
+bool PiecewiseChebyshev::converged() const {
+    return _converged;
+}
+
+double PiecewiseChebyshev::eval(double x) const {
+    std::uint32_t p = _table[cell(x, _lower, _cells, _table.size())];
+    return clenshaw(_coefficients.data() + p * (_degree + 1), _degree + 1, (x - _centers[p]) * _scales[p]);
+}
+
+void PiecewiseChebyshev::eval_batch(const double *x, std::size_t n, double *out) const {
+    for (std::size_t i = 0; i < n; i++) {
+        out[i] = eval(x[i]);
+    }
+}
+
+
+PiecewiseChebyshev2D::PiecewiseChebyshev2D(const Expression<rational> &expr, const std::string &x,
+                                           const std::string &y, double x_lower, double x_upper,
+                                           double y_lower, double y_upper,
+                                           const std::map<std::string, rational> &parameters,
+                                           ApproximationOptions options)
+        : _lower{x_lower, y_lower}, _degree(options.degree) {
+    double width[2] = {x_upper - x_lower, y_upper - y_lower};
+    check_options(width[0], options);
+    check_options(width[1], options);
+    Program<rational> program(parameters.empty() ? expr : expr.sub(parameters), {x, y});
+    unsigned m = _degree + 1;
+    std::vector<double> nodes = chebyshev_nodes(m);
+    std::vector<double> checks = check_points(nodes);
+    std::size_t c = checks.size();
+    std::size_t per = m * m + c * c;
+
+    std::vector<Piece> pending = {{0, {0, 0}}};
+    std::vector<Piece> placed;
+    std::vector<double> points[2], values, rows(m * m), coefficients(m * m);
+    for (unsigned level = 0; !pending.empty(); level++) {
+        double half[2] = {width[0] / std::ldexp(2.0, level), width[1] / std::ldexp(2.0, level)};
+        for (int v = 0; v < 2; v++) {
+            points[v].resize(pending.size() * per);
+        }
+        for (std::size_t i = 0; i < pending.size(); i++) {
+            double center[2];
+            for (int v = 0; v < 2; v++) {
+                center[v] = _lower[v] + (2 * pending[i].index[v] + 1) * half[v];
+            }
+            double *px = points[0].data() + i * per, *py = points[1].data() + i * per;
+            for (unsigned kx = 0; kx < m; kx++) {
+                for (unsigned ky = 0; ky < m; ky++) {
+                    px[kx * m + ky] = center[0] + half[0] * nodes[kx];
+                    py[kx * m + ky] = center[1] + half[1] * nodes[ky];
+                }
+            }
+            for (std::size_t a = 0; a < c; a++) {
+                for (std::size_t b = 0; b < c; b++) {
+                    px[m * m + a * c + b] = center[0] + half[0] * checks[a];
+                    py[m * m + a * c + b] = center[1] + half[1] * checks[b];
+                }
+            }
+        }
+        const rational *columns[] = {points[0].data(), points[1].data()};
+        values.resize(points[0].size());
+        program.eval_batch(columns, values.size(), values.data());
+
+        bool last = level >= options.max_depth;
+        std::vector<Piece> next;
+        for (std::size_t i = 0; i < pending.size(); i++) {
+            const double *f = values.data() + i * per;
+            for (unsigned kx = 0; kx < m; kx++) {
+                chebyshev_coefficients(f + kx * m, 1, m, rows.data() + kx * m, 1);
+            }
+            for (unsigned j = 0; j < m; j++) {
+                chebyshev_coefficients(rows.data() + j, m, m, coefficients.data() + j, m);
+            }
+            double error = 0;
+            for (unsigned j = 0; j < m; j++) {
+                error += tail(coefficients.data() + j, m, m) + tail(coefficients.data() + j * m, m, 1);
+            }
+            for (std::size_t a = 0; a < c; a++) {
+                for (std::size_t b = 0; b < c; b++) {
+                    double p = clenshaw(coefficients.data(), m, checks[a], checks[b]);
+                    error = std::max(error, std::abs(f[m * m + a * c + b] - p));
+                }
+            }
+            if (last || error <= options.tolerance) {
+                _converged = _converged && error <= options.tolerance;
+                _max_error = std::isnan(error) ? INFINITY : std::max(_max_error, error);
+                placed.push_back(pending[i]);
+                for (int v = 0; v < 2; v++) {
+                    _centers.push_back(_lower[v] + (2 * pending[i].index[v] + 1) * half[v]);
+                    _scales.push_back(1 / half[v]);
+                }
+                _coefficients.insert(_coefficients.end(), coefficients.begin(), coefficients.end());
+            } else {
+                for (std::uint64_t dx = 0; dx < 2; dx++) {
+                    for (std::uint64_t dy = 0; dy < 2; dy++) {
+                        next.push_back({level + 1, {2 * pending[i].index[0] + dx, 2 * pending[i].index[1] + dy}});
+                    }
+                }
+            }
+        }
+        pending = std::move(next);
+    }
+
+    unsigned deepest = 0;
+    for (const auto &piece : placed) {
+        deepest = std::max(deepest, piece.level);
+    }
+    _side = std::size_t(1) << deepest;
+    _table.resize(_side * _side);
+    for (int v = 0; v < 2; v++) {
+        _cells[v] = _side / width[v];
+    }
+    for (std::uint32_t p = 0; p < placed.size(); p++) {
+        std::size_t span = std::size_t(1) << (deepest - placed[p].level);
+        for (std::size_t row = placed[p].index[1] * span; row < (placed[p].index[1] + 1) * span; row++) {
+            std::fill_n(_table.begin() + row * _side + placed[p].index[0] * span, span, p);
+        }
+    }
+}
+
+std::size_t PiecewiseChebyshev2D::pieces() const {
+    return _centers.size() / 2;
+}
+
+unsigned PiecewiseChebyshev2D::degree() const {
+    return _degree;
+}
+
+double PiecewiseChebyshev2D::max_error() const {
+    return _max_error;
+}
+
+bool PiecewiseChebyshev2D::converged() const {
+    return _converged;
+}
+
+double PiecewiseChebyshev2D::eval(double x, double y) const {
+    std::size_t row = cell(y, _lower[1], _cells[1], _side);
+    std::uint32_t p = _table[row * _side + cell(x, _lower[0], _cells[0], _side)];
+    unsigned m = _degree + 1;
+    return clenshaw(_coefficients.data() + p * m * m, m, (x - _centers[2 * p]) * _scales[2 * p],
+                    (y - _centers[2 * p + 1]) * _scales[2 * p + 1]);
+}
+
+void PiecewiseChebyshev2D::eval_batch(const double *x, const double *y, std::size_t n, double *out) const {
+    for (std::size_t i = 0; i < n; i++) {
+        out[i] = eval(x[i], y[i]);
+    }
+}
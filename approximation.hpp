@@ -0,0 +1,94 @@
+#ifndef APPROXIMATION_HPP
+#define APPROXIMATION_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "expression.hpp"
+
+
+struct ApproximationOptions {
+    // Target for the absolute error of every piece.
+    double tolerance = 1e-10;
+    // Chebyshev degree of every piece, per variable.
+    unsigned degree = 10;
+    // Pieces are halved (per variable) at most this many times; the lookup
+    // table has 2^depth entries per variable of the deepest level reached.
+    unsigned max_depth = 10;
+};
+
+// Both approximations build the same way: the expression is compiled once,
+// each level of the refinement samples all of its pieces in one batched call,
+// and a piece is split in half while its error estimate exceeds the tolerance.
+// The estimate of a piece is the larger of its trailing Chebyshev
+// coefficients and the error measured at the midpoints between the nodes and
+// at the piece's edges. Evaluation finds the piece through a uniform table
+// and runs a Clenshaw recurrence; points outside the domain are extrapolated
+// from the nearest piece.
+
+// Piecewise Chebyshev interpolant of a real expression of one variable.
+class PiecewiseChebyshev {
+public:
+    PiecewiseChebyshev(const Expression<rational> &expr, const std::string &var, double lower, double upper,
+                       const std::map<std::string, rational> &parameters = {}, ApproximationOptions options = {});
+
+    std::size_t pieces() const;
+
+    unsigned degree() const;
+
+    // Largest error estimate over the pieces.
+    double max_error() const;
+
+    // Whether every piece met the tolerance before max_depth.
+    bool converged() const;
+
+    double eval(double x) const;
+
+    void eval_batch(const double *x, std::size_t n, double *out) const;
+
+private:
+    double _lower;
+    double _cells;
+    unsigned _degree;
+    double _max_error = 0;
+    bool _converged = true;
+    std::vector<std::uint32_t> _table;
+    std::vector<double> _centers;
+    std::vector<double> _scales;
+    std::vector<double> _coefficients;
+};
+
+// Piecewise tensor-product Chebyshev interpolant over a rectangle.
+class PiecewiseChebyshev2D {
+public:
+    PiecewiseChebyshev2D(const Expression<rational> &expr, const std::string &x, const std::string &y,
+                         double x_lower, double x_upper, double y_lower, double y_upper,
+                         const std::map<std::string, rational> &parameters = {}, ApproximationOptions options = {});
+
+    std::size_t pieces() const;
+
+    unsigned degree() const;
+
+    double max_error() const;
+
+    bool converged() const;
+
+    double eval(double x, double y) const;
+
+    void eval_batch(const double *x, const double *y, std::size_t n, double *out) const;
+
+private:
+    double _lower[2];
+    double _cells[2];
+    std::size_t _side;
+    unsigned _degree;
+    double _max_error = 0;
+    bool _converged = true;
+    std::vector<std::uint32_t> _table;
+    std::vector<double> _centers;
+    std::vector<double> _scales;
+    std::vector<double> _coefficients;
+};
+
+#endif
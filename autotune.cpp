@@ -0,0 +1,254 @@
+#include "autotune.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+
+namespace {
+
+const char *strategy_name(Strategy strategy) {
+    switch (strategy) {
+        case Strategy::TreeWalk:
+            return "tree";
+        case Strategy::Interpreted:
+            return "interpreted";
+        case Strategy::Vectorized:
+            return "vectorized";
+        case Strategy::Threaded:
+            return "threaded";
+    }
+    return "";
+}
+
+bool parse_strategy(const std::string &name, Strategy &strategy) {
+    for (Strategy s : {Strategy::TreeWalk, Strategy::Interpreted, Strategy::Vectorized, Strategy::Threaded}) {
+        if (name == strategy_name(s)) {
+            strategy = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *type_name(rational) {
+    return "real";
+}
+
+const char *type_name(complex) {
+    return "complex";
+}
+
+std::size_t bucket(std::size_t rows) {
+    std::size_t res = 1;
+    while (res < rows) {
+        res <<= 1;
+    }
+    return res;
+}
+
+}
+
+
+CalibrationCache::CalibrationCache(std::string path) : _path(std::move(path)) {
+    if (_path.empty()) return;
+    std::ifstream in(_path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::istringstream parts(line);
+        for (std::string field; std::getline(parts, field, '\t');) {
+            fields.push_back(field);
+        }
+        TuneChoice choice;
+        if (fields.size() != 5 || fields[0] != cpu_model() || !parse_strategy(fields[2], choice.strategy)) continue;
+        try {
+            choice.chunk_rows = std::stoul(fields[3]);
+            choice.threads = std::stoul(fields[4]);
+        } catch (const std::exception &) {
+            continue;
+        }
+        if (choice.chunk_rows == 0 || choice.threads == 0) continue;
+        _choices[fields[1]] = choice;
+    }
+}
+
+bool CalibrationCache::find(const std::string &key, TuneChoice &choice) const {
+    auto it = _choices.find(key);
+    if (it == _choices.end()) return false;
+    choice = it->second;
+    return true;
+}
+
+// A cache that cannot be written only costs a recalibration next time.
+void CalibrationCache::store(const std::string &key, const TuneChoice &choice) {
+    _choices[key] = choice;
+    if (_path.empty()) return;
+    std::ofstream(_path, std::ios::app) << cpu_model() << '\t' << key << '\t' << strategy_name(choice.strategy)
+                                        << '\t' << choice.chunk_rows << '\t' << choice.threads << '\n';
+}
+
+const std::string &CalibrationCache::cpu_model() {
+    static const std::string model = [] {
+        std::ifstream in("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.compare(0, 10, "model name") != 0) continue;
+            std::size_t colon = line.find(':');
+            if (colon == std::string::npos) break;
+            std::size_t start = line.find_first_not_of(' ', colon + 1);
+            return start == std::string::npos ? std::string("unknown") : line.substr(start);
+        }
+        return std::string("unknown");
+    }();
+    return model;
+}
+
+
+template<typename Num>
+TunedEvaluator<Num>::TunedEvaluator(const Expression<Num> &expr, std::size_t rows, TuneOptions options)
+        : _expression(expr), _program(expr), _options(std::move(options)) {
+    if (_options.max_threads == 0) _options.max_threads = std::max(1u, std::thread::hardware_concurrency());
+    if (_options.repeats == 0) _options.repeats = 1;
+    std::ostringstream key;
+    key << type_name(Num()) << ':' << std::hex << expr.hash() << std::dec << ':' << bucket(rows);
+    CalibrationCache cache(_options.cache_path);
+    _from_cache = cache.find(key.str(), _choice);
+    if (!_from_cache) {
+        _choice = calibrate(bucket(rows));
+        cache.store(key.str(), _choice);
+    }
+}
+
+template<typename Num>
+const std::vector<std::string> &TunedEvaluator<Num>::inputs() const {
+    return _program.inputs();
+}
+
+template<typename Num>
+const TuneChoice &TunedEvaluator<Num>::choice() const {
+    return _choice;
+}
+
+template<typename Num>
+bool TunedEvaluator<Num>::from_cache() const {
+    return _from_cache;
+}
+
+template<typename Num>
+void TunedEvaluator<Num>::eval_batch(const Num *const *columns, std::size_t rows, Num *out) const {
+    run(_choice, columns, rows, out);
+}
+
+template<typename Num>
+void TunedEvaluator<Num>::run(const TuneChoice &choice, const Num *const *columns, std::size_t rows,
+                              Num *out) const {
+    const auto &names = _program.inputs();
+    switch (choice.strategy) {
+        case Strategy::TreeWalk: {
+            std::map<std::string, Num> substitution;
+            for (std::size_t r = 0; r < rows; r++) {
+                for (std::size_t i = 0; i < names.size(); i++) {
+                    substitution[names[i]] = columns[i][r];
+                }
+                out[r] = _expression.eval(substitution);
+            }
+            return;
+        }
+        case Strategy::Interpreted: {
+            std::vector<Num> point(names.size());
+            for (std::size_t r = 0; r < rows; r++) {
+                for (std::size_t i = 0; i < names.size(); i++) {
+                    point[i] = columns[i][r];
+                }
+                out[r] = _program.eval(point.data());
+            }
+            return;
+        }
+        default:
+            break;
+    }
+    std::size_t chunk = std::max<std::size_t>(1, choice.chunk_rows);
+    std::atomic<std::size_t> next{0};
+    auto worker = [&]() {
+        std::vector<const Num *> part(names.size());
+        for (;;) {
+            std::size_t first = next.fetch_add(chunk);
+            if (first >= rows) return;
+            for (std::size_t i = 0; i < names.size(); i++) {
+                part[i] = columns[i] + first;
+            }
+            _program.eval_batch(part.data(), std::min(chunk, rows - first), out + first);
+        }
+    };
+    unsigned threads = choice.strategy == Strategy::Threaded ? std::max(1u, choice.threads) : 1;
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : pool) {
+        thread.join();
+    }
+}
+
+// Candidates run on synthetic inputs in [0.5, 1.5), which keep ln and
+// fractional powers in their domain. Row-at-a-time strategies are timed on
+// a prefix, since their cost per row does not depend on the batch length.
+template<typename Num>
+TuneChoice TunedEvaluator<Num>::calibrate(std::size_t rows) const {
+    std::size_t sample = std::min(rows, std::max<std::size_t>(1, _options.sample_rows));
+    std::vector<std::vector<Num>> data(_program.inputs().size(), std::vector<Num>(sample));
+    std::uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (auto &column : data) {
+        for (auto &value : column) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            value = Num(0.5 + double(state >> 11) / double(1ull << 53));
+        }
+    }
+    std::vector<const Num *> columns;
+    for (const auto &column : data) {
+        columns.push_back(column.data());
+    }
+    std::vector<Num> out(sample);
+
+    std::vector<TuneChoice> candidates = {{Strategy::TreeWalk, 1, 1},
+                                          {Strategy::Interpreted, 1, 1}};
+    for (std::size_t chunk : {std::size_t(1) << 10, std::size_t(1) << 14, sample}) {
+        if (chunk <= sample) candidates.push_back({Strategy::Vectorized, chunk, 1});
+    }
+    for (unsigned threads = 2; threads <= _options.max_threads; threads *= 2) {
+        for (std::size_t chunk : {std::size_t(1) << 12, std::size_t(1) << 16}) {
+            if (chunk * threads <= sample) candidates.push_back({Strategy::Threaded, chunk, threads});
+        }
+    }
+
+    TuneChoice best;
+    double best_time = -1;
+    for (const auto &candidate : candidates) {
+        bool per_row = candidate.strategy == Strategy::TreeWalk || candidate.strategy == Strategy::Interpreted;
+        std::size_t n = per_row ? std::min<std::size_t>(sample, 1 << 10) : sample;
+        double time = -1;
+        for (unsigned k = 0; k < _options.repeats; k++) {
+            auto start = std::chrono::steady_clock::now();
+            run(candidate, columns.data(), n, out.data());
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (time < 0 || elapsed < time) time = elapsed;
+        }
+        time = time / n * rows;
+        if (best_time < 0 || time < best_time) {
+            best_time = time;
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+
+template
+class TunedEvaluator<double>;
+
+template
+class TunedEvaluator<std::complex<double>>;
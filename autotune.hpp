@@ -0,0 +1,92 @@
+#ifndef AUTOTUNE_HPP
+#define AUTOTUNE_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include "expression.hpp"
+#include "compiled.hpp"
+
+
+enum class Strategy {
+    // Expression::eval with a substitution map per row.
+    TreeWalk,
+    // Program::eval one row at a time.
+    Interpreted,
+    // Program::eval_batch over chunks of rows.
+    Vectorized,
+    // Vectorized chunks spread over worker threads.
+    Threaded
+};
+
+struct TuneChoice {
+    Strategy strategy = Strategy::Vectorized;
+    // Rows per eval_batch call; used by Vectorized and Threaded.
+    std::size_t chunk_rows = 1 << 14;
+    unsigned threads = 1;
+};
+
+struct TuneOptions {
+    // Calibration cache; empty disables persistence.
+    std::string cache_path;
+    // Trials run on at most this many rows and are scaled to the batch.
+    std::size_t sample_rows = 1 << 16;
+    // 0 means std::thread::hardware_concurrency().
+    unsigned max_threads = 0;
+    // Every candidate is timed this many times and its best run kept.
+    unsigned repeats = 3;
+};
+
+// Text file of tuning decisions, one per line:
+//   cpu model <tab> key <tab> strategy <tab> chunk rows <tab> threads
+// Lines for other CPU models are kept but ignored, and later lines override
+// earlier ones, so new decisions are simply appended.
+class CalibrationCache {
+public:
+    explicit CalibrationCache(std::string path);
+
+    bool find(const std::string &key, TuneChoice &choice) const;
+
+    void store(const std::string &key, const TuneChoice &choice);
+
+    // "model name" from /proc/cpuinfo, or "unknown".
+    static const std::string &cpu_model();
+
+private:
+    std::string _path;
+    std::map<std::string, TuneChoice> _choices;
+};
+
+// Evaluator of one expression over batches of a given length, using whichever
+// strategy measured fastest on this machine. Inputs are the expression's
+// variables in sorted order. Decisions are cached by structural hash, number
+// type and batch length rounded up to a power of two; the hash is stable for
+// a given build of the library.
+template<typename Num = rational>
+class TunedEvaluator {
+public:
+    TunedEvaluator(const Expression<Num> &expr, std::size_t rows, TuneOptions options = {});
+
+    const std::vector<std::string> &inputs() const;
+
+    const TuneChoice &choice() const;
+
+    // Whether the choice came from the calibration cache.
+    bool from_cache() const;
+
+    void eval_batch(const Num *const *columns, std::size_t rows, Num *out) const;
+
+    // Evaluates with the given choice instead of the tuned one.
+    void run(const TuneChoice &choice, const Num *const *columns, std::size_t rows, Num *out) const;
+
+private:
+    TuneChoice calibrate(std::size_t rows) const;
+
+    Expression<Num> _expression;
+    Program<Num> _program;
+    TuneOptions _options;
+    TuneChoice _choice;
+    bool _from_cache = false;
+};
+
+#endif
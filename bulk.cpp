@@ -0,0 +1,182 @@
+#include "bulk.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+// Runs the chain rule under every lazy derivative in `expr`; each DifExpr
+// keeps its expansion, so later evaluation finds the work already done.
+template<typename Num>
+void expand_derivatives(const Expression<Num> &expr) {
+    std::unordered_set<const ExpressionTempl<Num> *> seen = {&expr.node()};
+    std::vector<const ExpressionTempl<Num> *> stack = {&expr.node()};
+    while (!stack.empty()) {
+        const ExpressionTempl<Num> *node = stack.back();
+        stack.pop_back();
+        for (std::size_t i = 0; i < node->arity(); i++) {
+            const ExpressionTempl<Num> *operand = &node->operand(i).node();
+            if (seen.insert(operand).second) stack.push_back(operand);
+        }
+    }
+}
+
+}
+
+
+template<typename Num>
+std::size_t ExpressionStore<Num>::intern(const Expression<Num> &expr) {
+    Shard &shard = _shards[std::hash<Expression<Num>>()(expr) % shard_count];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(expr);
+    if (it != shard.index.end()) {
+        return it->second;
+    }
+    std::size_t index;
+    {
+        std::lock_guard<std::mutex> items(_mutex);
+        _items.push_back(expr);
+        index = _items.size() - 1;
+    }
+    shard.index.emplace(expr, index);
+    return index;
+}
+
+template<typename Num>
+Expression<Num> ExpressionStore<Num>::operator[](std::size_t index) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _items[index];
+}
+
+template<typename Num>
+std::size_t ExpressionStore<Num>::size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _items.size();
+}
+
+
+template<typename Num>
+std::vector<BulkItem> load_catalog(const char *data, std::size_t size, const std::vector<std::string> &vars,
+                                   ExpressionStore<Num> &store, BulkOptions options) {
+    std::vector<std::pair<std::size_t, std::size_t>> lines;
+    std::vector<BulkItem> items;
+    std::size_t begin = 0;
+    for (std::size_t number = 1; begin < size; number++) {
+        const char *newline = static_cast<const char *>(std::memchr(data + begin, '\n', size - begin));
+        std::size_t end = newline ? newline - data : size;
+        if (std::find_if(data + begin, data + end, [](char c) { return !std::isspace((unsigned char) c); }) !=
+            data + end) {
+            lines.emplace_back(begin, end - begin);
+            items.push_back({number, false, "", 0, {}});
+        }
+        begin = end + 1;
+    }
+
+    std::atomic<std::size_t> next{0};
+    auto worker = [&]() {
+        RefCountScope shared(RefCounting::Atomic);
+        const std::size_t chunk = 64;
+        for (;;) {
+            std::size_t first = next.fetch_add(chunk);
+            if (first >= lines.size()) return;
+            for (std::size_t i = first; i < std::min(first + chunk, lines.size()); i++) {
+                BulkItem &item = items[i];
+                try {
+                    Expression<Num> expr(std::string(data + lines[i].first, lines[i].second));
+                    if (options.simplify) expr = expr.simplify();
+                    item.expression = store.intern(expr);
+                    for (const auto &var : vars) {
+                        Expression<Num> derivative = expr.dif(var);
+                        if (options.simplify) {
+                            derivative = derivative.simplify();
+                        } else {
+                            expand_derivatives(derivative);
+                        }
+                        item.derivatives.push_back(store.intern(derivative));
+                    }
+                    item.ok = true;
+                } catch (const std::exception &e) {
+                    item.derivatives.clear();
+                    item.error = e.what();
+                }
+            }
+        }
+    };
+
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : pool) {
+        thread.join();
+    }
+    return items;
+}
+
+template<typename Num>
+std::vector<BulkItem> load_catalog_file(const std::string &path, const std::vector<std::string> &vars,
+                                        ExpressionStore<Num> &store, BulkOptions options) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    struct stat info{};
+    if (fstat(fd, &info) < 0) {
+        std::string error = std::strerror(errno);
+        close(fd);
+        throw std::runtime_error(path + ": " + error);
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        return {};
+    }
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+    try {
+        auto items = load_catalog(static_cast<const char *>(data), info.st_size, vars, store, options);
+        munmap(data, info.st_size);
+        return items;
+    } catch (...) {
+        munmap(data, info.st_size);
+        throw;
+    }
+}
+
+
+template
+class ExpressionStore<double>;
+
+template
+class ExpressionStore<std::complex<double>>;
+
+template
+std::vector<BulkItem> load_catalog(const char *data, std::size_t size, const std::vector<std::string> &vars,
+                                   ExpressionStore<double> &store, BulkOptions options);
+
+template
+std::vector<BulkItem> load_catalog(const char *data, std::size_t size, const std::vector<std::string> &vars,
+                                   ExpressionStore<complex> &store, BulkOptions options);
+
+template
+std::vector<BulkItem> load_catalog_file(const std::string &path, const std::vector<std::string> &vars,
+                                        ExpressionStore<double> &store, BulkOptions options);
+
+template
+std::vector<BulkItem> load_catalog_file(const std::string &path, const std::vector<std::string> &vars,
+                                        ExpressionStore<complex> &store, BulkOptions options);
@@ -0,0 +1,66 @@
+#ifndef BULK_HPP
+#define BULK_HPP
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "expression.hpp"
+
+
+// Thread-safe store that keeps one copy of every structurally distinct
+// expression. The index is split by hash over independently locked shards,
+// so concurrent interning only contends on equal-hash expressions and on
+// the brief append to the item list.
+template<typename Num = rational>
+class ExpressionStore {
+public:
+    std::size_t intern(const Expression<Num> &expr);
+
+    Expression<Num> operator[](std::size_t index) const;
+
+    std::size_t size() const;
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<Expression<Num>, std::size_t> index;
+    };
+
+    static const std::size_t shard_count = 16;
+
+    Shard _shards[shard_count];
+    // Guards _items only.
+    mutable std::mutex _mutex;
+    std::vector<Expression<Num>> _items;
+};
+
+struct BulkOptions {
+    unsigned threads = 0;
+    bool simplify = false;
+};
+
+// One per non-blank input line; `expression` and `derivatives` index the store
+// and are only meaningful when `ok` is set.
+struct BulkItem {
+    std::size_t line;
+    bool ok;
+    std::string error;
+    std::size_t expression;
+    std::vector<std::size_t> derivatives;
+};
+
+// Parses newline-separated formulas and differentiates each by every
+// variable in `vars`, spreading the lines over `options.threads` workers.
+// Derivatives are expanded in full by the workers, not left lazy for the
+// caller's thread to build on first use.
+template<typename Num = rational>
+std::vector<BulkItem> load_catalog(const char *data, std::size_t size, const std::vector<std::string> &vars,
+                                   ExpressionStore<Num> &store, BulkOptions options = {});
+
+// Same as load_catalog over a memory-mapped file.
+template<typename Num = rational>
+std::vector<BulkItem> load_catalog_file(const std::string &path, const std::vector<std::string> &vars,
+                                        ExpressionStore<Num> &store, BulkOptions options = {});
+
+#endif
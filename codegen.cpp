@@ -0,0 +1,239 @@
+#include "codegen.hpp"
+#include "compiled.hpp"
+#include "polynomial.hpp"
+#include <cctype>
+#include <cmath>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+
+namespace {
+
+const std::set<std::string> keywords = {
+    "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch",
+    "char", "char8_t", "char16_t", "char32_t", "class", "compl", "concept", "const", "consteval", "constexpr",
+    "constinit", "const_cast", "continue", "co_await", "co_return", "co_yield", "decltype", "default", "delete",
+    "do", "double", "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float", "for",
+    "friend", "goto", "if", "inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq",
+    "nullptr", "operator", "or", "or_eq", "private", "protected", "public", "register", "reinterpret_cast",
+    "requires", "return", "short", "signed", "sizeof", "static", "static_assert", "static_cast", "struct",
+    "switch", "template", "this", "thread_local", "throw", "true", "try", "typedef", "typeid", "typename",
+    "union", "unsigned", "using", "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq"};
+
+bool identifier(const std::string &name) {
+    if (name.empty() || std::isdigit((unsigned char) name[0]) || keywords.count(name)) return false;
+    for (char c : name) {
+        if (!std::isalnum((unsigned char) c) && c != '_') return false;
+    }
+    return true;
+}
+
+// Variables are emitted with this prefix, which no generated name has, so a
+// variable named t2, n or out cannot shadow a local.
+std::string input_name(const std::string &var) {
+    return "v_" + var;
+}
+
+// Polynomial nodes become plain arithmetic, which Program can compile.
+template<typename Num>
+Expression<Num> without_polys(const Expression<Num> &root) {
+    std::unordered_map<const ExpressionTempl<Num> *, Expression<Num>> done;
+    std::vector<std::pair<Expression<Num>, bool>> stack = {{root, false}};
+    while (!stack.empty()) {
+        auto [expr, visited] = stack.back();
+        stack.pop_back();
+        const ExpressionTempl<Num> *node = &expr.node();
+        if (done.count(node)) continue;
+        if (expr.kind() == NodeKind::Poly) {
+            done.emplace(node, static_cast<const PolyExpr<Num> *>(node)->lowered());
+            continue;
+        }
+        if (node->arity() == 0) {
+            done.emplace(node, expr);
+            continue;
+        }
+        if (!visited) {
+            stack.emplace_back(expr, true);
+            for (std::size_t i = 0; i < node->arity(); i++) {
+                stack.emplace_back(node->operand(i), false);
+            }
+            continue;
+        }
+        std::vector<Expression<Num>> operands;
+        bool same = expr.kind() != NodeKind::Dif;
+        for (std::size_t i = 0; i < node->arity(); i++) {
+            operands.push_back(done.at(&node->operand(i).node()));
+            same = same && &operands[i].node() == &node->operand(i).node();
+        }
+        done.emplace(node, same ? expr : expr.rebuild(operands));
+    }
+    return done.at(&root.node());
+}
+
+// Double expression for `value`; NaN and infinities have no literal form.
+std::string number(double value) {
+    if (std::isnan(value)) return "std::numeric_limits<double>::quiet_NaN()";
+    if (std::isinf(value)) return std::string(value < 0 ? "-" : "") + "std::numeric_limits<double>::infinity()";
+    std::ostringstream out;
+    out << std::setprecision(17) << value;
+    return out.str();
+}
+
+std::string literal(rational value) {
+    return "T(" + number(value) + ")";
+}
+
+std::string literal(complex value) {
+    if (value.imag() == 0) return literal(value.real());
+    return "T(std::complex<double>(" + number(value.real()) + ", " + number(value.imag()) + "))";
+}
+
+template<typename Num>
+class Writer {
+public:
+    // Inputs are read as their name followed by `row`, e.g. "[i]" for columns.
+    Writer(const Program<Num> &program, std::string row = "") : _program(program), _row(std::move(row)) {}
+
+    // Operand text of instruction i: constants and inputs are used in place.
+    std::string ref(std::uint32_t i) const {
+        const Instruction &ins = _program.code()[i];
+        if (ins.op == OpCode::Const) return literal(_program.constants()[ins.lhs]);
+        if (ins.op == OpCode::Input) return input_name(_program.inputs()[ins.lhs]) + _row;
+        return "t" + std::to_string(i);
+    }
+
+    std::string value(std::uint32_t i) const {
+        const Instruction &ins = _program.code()[i];
+        std::string a = ref(ins.lhs), b = ref(ins.rhs);
+        switch (ins.op) {
+            case OpCode::Add:
+                return a + " + " + b;
+            case OpCode::Sub:
+                return a + " - " + b;
+            case OpCode::Mul:
+                return a + " * " + b;
+            case OpCode::Div:
+                return a + " / " + b;
+            case OpCode::Pow: {
+                const Instruction &exponent = _program.code()[ins.rhs];
+                if (exponent.op == OpCode::Const && _program.constants()[exponent.lhs] == Num(2)) {
+                    return a + " * " + a;
+                }
+                return "std::pow(" + a + ", " + b + ")";
+            }
+            case OpCode::Ln:
+                return "std::log(" + a + ")";
+            case OpCode::Sin:
+                return "std::sin(" + a + ")";
+            case OpCode::Cos:
+                return "std::cos(" + a + ")";
+            case OpCode::Exp:
+                return "std::exp(" + a + ")";
+            default:
+                throw std::logic_error("unexpected instruction in code generation");
+        }
+    }
+
+    // Locals for every instruction the given outputs need, in program order.
+    void body(std::ostream &out, const std::vector<std::uint32_t> &outputs, const std::string &indent = "    ") const {
+        const auto &code = _program.code();
+        std::vector<bool> needed(code.size());
+        for (std::uint32_t output : outputs) {
+            needed[output] = true;
+        }
+        for (std::size_t i = code.size(); i-- > 0;) {
+            if (!needed[i] || code[i].op == OpCode::Const || code[i].op == OpCode::Input) continue;
+            needed[code[i].lhs] = true;
+            bool unary = code[i].op == OpCode::Ln || code[i].op == OpCode::Sin || code[i].op == OpCode::Cos ||
+                         code[i].op == OpCode::Exp;
+            if (!unary) needed[code[i].rhs] = true;
+        }
+        for (std::uint32_t i = 0; i < code.size(); i++) {
+            if (!needed[i] || code[i].op == OpCode::Const || code[i].op == OpCode::Input) continue;
+            out << indent << "const T t" << i << " = " << value(i) << ";\n";
+        }
+    }
+
+private:
+    const Program<Num> &_program;
+    std::string _row;
+};
+
+}
+
+
+template<typename Num>
+std::string emit_cpp(const Expression<Num> &expr, const std::vector<std::string> &by, const CodegenOptions &options) {
+    if (!identifier(options.name)) {
+        throw std::invalid_argument("function name " + options.name + " is not an identifier");
+    }
+    std::vector<Expression<Num>> outputs = {without_polys(expr).simplify()};
+    std::vector<std::string> names = {options.name};
+    std::set<std::string> seen;
+    for (const auto &var : by) {
+        if (!identifier(var)) {
+            throw std::invalid_argument("variable " + var + " is not an identifier");
+        }
+        if (!seen.insert(var).second) {
+            throw std::invalid_argument("variable " + var + " is given twice");
+        }
+        outputs.push_back(without_polys(expr.dif(var)).simplify());
+        names.push_back(options.name + "_d_" + var);
+    }
+    auto vars = expr.variables();
+    std::vector<std::string> inputs(vars.begin(), vars.end());
+    for (const auto &var : inputs) {
+        if (!identifier(var)) {
+            throw std::invalid_argument("variable " + var + " is not an identifier");
+        }
+    }
+    Program<Num> program(outputs, inputs);
+    Writer<Num> writer(program), batch_writer(program, "[i]");
+
+    std::string params, pointers;
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+        params += (i ? ", const T &" : "const T &") + input_name(inputs[i]);
+        pointers += "const T *" + input_name(inputs[i]) + ", ";
+    }
+    std::string results, rows;
+    for (std::size_t k = 0; k < names.size(); k++) {
+        std::string column = k ? "d_" + by[k - 1] : "value";
+        results += ", T *" + column;
+        rows += "        " + column + "[i] = " + batch_writer.ref(program.outputs()[k]) + ";\n";
+    }
+
+    std::ostringstream out;
+    out << "// Generated from: " << expr.to_string() << "\n";
+    out << "#pragma once\n\n#include <cmath>\n#include <complex>\n#include <cstddef>\n#include <limits>\n\n";
+    for (std::size_t k = 0; k < names.size(); k++) {
+        std::uint32_t output = program.outputs()[k];
+        out << "template<typename T>\ninline T " << names[k] << "(" << params << ") {\n";
+        writer.body(out, {output});
+        out << "    return " << writer.ref(output) << ";\n}\n\n";
+    }
+    out << "template<typename T>\ninline void " << options.name << "_all(" << params << (params.empty() ? "" : ", ")
+        << "T *out) {\n";
+    writer.body(out, program.outputs());
+    for (std::size_t k = 0; k < names.size(); k++) {
+        out << "    out[" << k << "] = " << writer.ref(program.outputs()[k]) << ";\n";
+    }
+    out << "}\n\n";
+    out << "template<typename T>\ninline void " << options.name << "_batch(" << pointers << "std::size_t n" << results
+        << ") {\n";
+    out << "    for (std::size_t i = 0; i < n; i++) {\n";
+    batch_writer.body(out, program.outputs(), "        ");
+    out << rows << "    }\n}\n";
+    return out.str();
+}
+
+
+template
+std::string emit_cpp(const Expression<double> &expr, const std::vector<std::string> &by,
+                     const CodegenOptions &options);
+
+template
+std::string emit_cpp(const Expression<std::complex<double>> &expr, const std::vector<std::string> &by,
+                     const CodegenOptions &options);
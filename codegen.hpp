@@ -0,0 +1,30 @@
+#ifndef CODEGEN_HPP
+#define CODEGEN_HPP
+
+#include <string>
+#include <vector>
+#include "expression.hpp"
+
+
+struct CodegenOptions {
+    // Prefix of every generated function; must be a C++ identifier and not a
+    // keyword.
+    std::string name = "expression";
+};
+
+// Self-contained C++ header evaluating `expr` and its derivatives by each
+// variable in `by`, for variables x, y, ... in sorted order:
+//   T name(x, y, ...)                      value
+//   T name_d_x(x, y, ...)                  derivative by x
+//   void name_all(x, y, ..., T *out)       value, then derivatives in `by` order
+//   void name_batch(const T *x, ..., std::size_t n, T *value, T *d_x, ...)
+// Every function is an inline template over T (double or std::complex<double>)
+// with common subexpressions held in locals, so no evaluator is linked in.
+// Variables must be identifiers other than C++ keywords; their parameters are
+// named v_x, v_y, ..., apart from every generated local. Each variable may
+// appear in `by` only once.
+template<typename Num = rational>
+std::string emit_cpp(const Expression<Num> &expr, const std::vector<std::string> &by,
+                     const CodegenOptions &options = {});
+
+#endif
@@ -0,0 +1,193 @@
+#include "columns.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+// Device and inode of `path`; false if it does not exist.
+bool identify(const std::string &path, std::pair<dev_t, ino_t> &id) {
+    struct stat info{};
+    if (stat(path.c_str(), &info) < 0) return false;
+    id = {info.st_dev, info.st_ino};
+    return true;
+}
+
+// Names the file `path` refers to: its own device and inode when it exists,
+// otherwise its directory's together with the last component, so that two
+// spellings of a file not yet created still compare equal.
+bool locate(const std::string &path, std::pair<std::pair<dev_t, ino_t>, std::string> &key) {
+    if (identify(path, key.first)) {
+        key.second.clear();
+        return true;
+    }
+    std::size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    key.second = slash == std::string::npos ? path : path.substr(slash + 1);
+    return identify(dir, key.first);
+}
+
+}
+
+
+MappedFile::MappedFile(const std::string &path) : _path(path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    struct stat info{};
+    if (fstat(fd, &info) < 0) {
+        std::string error = std::strerror(errno);
+        close(fd);
+        throw std::runtime_error(path + ": " + error);
+    }
+    _size = info.st_size;
+    if (_size) {
+        _data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (_data == MAP_FAILED) {
+        _data = nullptr;
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    if (_data) madvise(_data, _size, MADV_SEQUENTIAL);
+}
+
+MappedFile::MappedFile(const std::string &path, std::size_t size) : _path(path), _size(size), _writable(true) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    if (ftruncate(fd, size) < 0) {
+        std::string error = std::strerror(errno);
+        close(fd);
+        throw std::runtime_error(path + ": " + error);
+    }
+    if (_size) {
+        _data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (_data == MAP_FAILED) {
+        _data = nullptr;
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    if (_data) madvise(_data, _size, MADV_SEQUENTIAL);
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+        : _path(std::move(other._path)), _data(other._data), _size(other._size), _writable(other._writable) {
+    other._data = nullptr;
+    other._size = 0;
+}
+
+MappedFile::~MappedFile() {
+    if (_data) munmap(_data, _size);
+}
+
+const void *MappedFile::data() const {
+    return _data;
+}
+
+void *MappedFile::data() {
+    return _data;
+}
+
+std::size_t MappedFile::size() const {
+    return _size;
+}
+
+void MappedFile::release(std::size_t offset, std::size_t length) {
+    static const std::size_t page = sysconf(_SC_PAGESIZE);
+    std::size_t begin = offset / page * page;
+    std::size_t end = std::min(_size, offset + length) / page * page;
+    if (!_data || end <= begin) return;
+    char *start = static_cast<char *>(_data) + begin;
+    if (_writable) msync(start, end - begin, MS_ASYNC);
+    madvise(start, end - begin, MADV_DONTNEED);
+}
+
+
+template<typename Num>
+std::size_t eval_columns(const Program<Num> &program, const std::map<std::string, std::string> &inputs,
+                         const std::vector<std::string> &outputs, ColumnOptions options) {
+    if (outputs.size() != program.outputs().size()) {
+        throw std::invalid_argument("expected " + std::to_string(program.outputs().size()) + " output files");
+    }
+    std::vector<MappedFile> columns;
+    std::size_t rows = 0;
+    for (const auto &name : program.inputs()) {
+        auto it = inputs.find(name);
+        if (it == inputs.end()) {
+            throw std::invalid_argument("no column for variable " + name);
+        }
+        columns.emplace_back(it->second);
+        if (columns.back().size() % sizeof(Num)) {
+            throw std::invalid_argument(it->second + ": size is not a multiple of " + std::to_string(sizeof(Num)));
+        }
+        std::size_t count = columns.back().size() / sizeof(Num);
+        if (columns.size() > 1 && count != rows) {
+            throw std::invalid_argument(it->second + ": column length differs from the others");
+        }
+        rows = count;
+    }
+
+    // Truncating a mapped input would fault the next read of it, and two
+    // outputs in one file would overwrite each other; names are compared by
+    // device and inode, so links and other spellings are caught as well.
+    // Everything is checked before the first output is created.
+    std::set<std::pair<std::pair<dev_t, ino_t>, std::string>> files;
+    std::pair<std::pair<dev_t, ino_t>, std::string> key;
+    for (const auto &entry : inputs) {
+        if (locate(entry.second, key)) files.insert(key);
+    }
+    std::set<std::pair<std::pair<dev_t, ino_t>, std::string>> written;
+    for (const auto &path : outputs) {
+        if (!locate(path, key)) continue;
+        if (files.count(key)) {
+            throw std::invalid_argument(path + ": output file is also an input");
+        }
+        if (!written.insert(key).second) {
+            throw std::invalid_argument(path + ": output file is given twice");
+        }
+    }
+    std::vector<MappedFile> results;
+    for (const auto &path : outputs) {
+        results.emplace_back(path, rows * sizeof(Num));
+    }
+    std::vector<const Num *> in(columns.size());
+    std::vector<Num *> out(results.size());
+    std::size_t chunk = std::max<std::size_t>(options.chunk_rows, 1);
+    for (std::size_t start = 0; start < rows; start += chunk) {
+        std::size_t n = std::min(chunk, rows - start);
+        for (std::size_t i = 0; i < columns.size(); i++) {
+            in[i] = static_cast<const Num *>(columns[i].data()) + start;
+        }
+        for (std::size_t k = 0; k < results.size(); k++) {
+            out[k] = static_cast<Num *>(results[k].data()) + start;
+        }
+        program.eval_batch(in.data(), n, out.data());
+        for (auto &file : columns) {
+            file.release(start * sizeof(Num), n * sizeof(Num));
+        }
+        for (auto &file : results) {
+            file.release(start * sizeof(Num), n * sizeof(Num));
+        }
+    }
+    return rows;
+}
+
+
+template
+std::size_t eval_columns(const Program<double> &program, const std::map<std::string, std::string> &inputs,
+                         const std::vector<std::string> &outputs, ColumnOptions options);
+
+template
+std::size_t eval_columns(const Program<complex> &program, const std::map<std::string, std::string> &inputs,
+                         const std::vector<std::string> &outputs, ColumnOptions options);
@@ -0,0 +1,60 @@
+#ifndef COLUMNS_HPP
+#define COLUMNS_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include "expression.hpp"
+#include "compiled.hpp"
+
+
+// Read-only or read-write shared mapping of a whole file.
+class MappedFile {
+public:
+    // Maps an existing file read-only.
+    explicit MappedFile(const std::string &path);
+
+    // Creates or truncates `path` to `size` bytes and maps it writable.
+    MappedFile(const std::string &path, std::size_t size);
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept;
+
+    ~MappedFile();
+
+    const void *data() const;
+
+    void *data();
+
+    std::size_t size() const;
+
+    // Lets the kernel drop [offset, offset + length) from memory; written
+    // pages are scheduled for writeback first.
+    void release(std::size_t offset, std::size_t length);
+
+private:
+    std::string _path;
+    void *_data = nullptr;
+    std::size_t _size = 0;
+    bool _writable = false;
+};
+
+struct ColumnOptions {
+    std::size_t chunk_rows = 1 << 16;
+};
+
+// Evaluates `program` over raw column files: one file per input, holding
+// native (little-endian on every supported target) doubles, or interleaved
+// re/im pairs for complex. Output k of the program is written to
+// outputs[k]. Columns are mapped, not read, and released chunk by chunk, so
+// datasets larger than memory stream through. Returns the number of rows.
+// Outputs that are also inputs, or that appear twice, are refused with
+// std::invalid_argument; an input file is never truncated.
+template<typename Num = rational>
+std::size_t eval_columns(const Program<Num> &program, const std::map<std::string, std::string> &inputs,
+                         const std::vector<std::string> &outputs, ColumnOptions options = {});
+
+#endif
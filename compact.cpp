@@ -0,0 +1,421 @@
+#include "compact.hpp"
+#include "polynomial.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+
+namespace {
+
+const std::uint32_t none = 0xffffffffu;
+
+inline std::uint64_t node_key(NodeKind op, std::uint32_t lhs, std::uint32_t rhs) {
+    return hash_combine((std::uint64_t) op, ((std::uint64_t) lhs << 32) | rhs);
+}
+
+template<typename Num>
+std::uint64_t value_key(Num value) {
+    return hash_combine((std::uint64_t) NodeKind::Value, number_hash(value));
+}
+
+template<typename Num>
+Expression<Num> combine(NodeKind op, const Expression<Num> &lhs, const Expression<Num> &rhs) {
+    switch (op) {
+        case NodeKind::Add:
+            return lhs + rhs;
+        case NodeKind::Sub:
+            return lhs - rhs;
+        case NodeKind::Mul:
+            return lhs * rhs;
+        case NodeKind::Div:
+            return lhs / rhs;
+        case NodeKind::Pow:
+            return lhs ^ rhs;
+        case NodeKind::Ln:
+            return lhs.ln();
+        case NodeKind::Sin:
+            return lhs.sin();
+        case NodeKind::Cos:
+            return lhs.cos();
+        case NodeKind::Exp:
+            return lhs.exp();
+        default:
+            throw std::logic_error("unexpected node in compact store");
+    }
+}
+
+template<typename Num>
+std::size_t node_size(const ExpressionTempl<Num> &node) {
+    switch (node.kind()) {
+        case NodeKind::Value:
+            return sizeof(Value<Num>);
+        case NodeKind::Variable: {
+            const std::string &name = static_cast<const Variable<Num> &>(node).name();
+            return sizeof(Variable<Num>) + (name.capacity() > 15 ? name.capacity() + 1 : 0);
+        }
+        case NodeKind::Add:
+            return sizeof(AddExpr<Num>);
+        case NodeKind::Sub:
+            return sizeof(SubExpr<Num>);
+        case NodeKind::Mul:
+            return sizeof(MulExpr<Num>);
+        case NodeKind::Div:
+            return sizeof(DivExpr<Num>);
+        case NodeKind::Pow:
+            return sizeof(PowExpr<Num>);
+        case NodeKind::Ln:
+            return sizeof(LnExpr<Num>);
+        case NodeKind::Sin:
+            return sizeof(SinExpr<Num>);
+        case NodeKind::Cos:
+            return sizeof(CosExpr<Num>);
+        case NodeKind::Exp:
+            return sizeof(ExpExpr<Num>);
+        case NodeKind::Dif:
+            return sizeof(DifExpr<Num>);
+        case NodeKind::Poly: {
+            const auto &poly = static_cast<const PolyExpr<Num> &>(node);
+            std::size_t terms = poly.numerator().terms() + poly.denominator().terms();
+            std::size_t vars = poly.numerator().variables().size() + poly.denominator().variables().size();
+            return sizeof(PolyExpr<Num>) + terms * (sizeof(Num) + vars * sizeof(unsigned)) +
+                   vars * sizeof(std::string);
+        }
+        case NodeKind::Sum:
+            return sizeof(SumExpr<Num>) + node.arity() * sizeof(Expression<Num>) + (node.arity() + 7) / 8;
+        case NodeKind::Product:
+            return sizeof(ProductExpr<Num>) + node.arity() * sizeof(Expression<Num>) + (node.arity() + 7) / 8;
+    }
+    return 0;
+}
+
+}
+
+
+template<typename Num>
+MemoryUsage memory_usage(const Expression<Num> &expr) {
+    MemoryUsage usage;
+    std::unordered_set<const ExpressionTempl<Num> *> seen;
+    std::vector<const ExpressionTempl<Num> *> stack = {&expr.node()};
+    while (!stack.empty()) {
+        const ExpressionTempl<Num> *node = stack.back();
+        stack.pop_back();
+        if (!seen.insert(node).second) continue;
+        usage.nodes++;
+        std::size_t bytes = node_size(*node);
+        if (node->kind() == NodeKind::Variable) {
+            usage.node_bytes += sizeof(Variable<Num>);
+            usage.name_bytes += bytes - sizeof(Variable<Num>);
+        } else {
+            usage.node_bytes += bytes;
+        }
+        // A derivative is measured as stored, on the expression it
+        // differentiates, rather than expanded just to be counted.
+        if (node->kind() == NodeKind::Dif) {
+            stack.push_back(&static_cast<const DifExpr<Num> *>(node)->content().node());
+            continue;
+        }
+        for (std::size_t i = 0; i < node->arity(); i++) {
+            stack.push_back(&node->operand(i).node());
+        }
+    }
+    return usage;
+}
+
+
+template<typename Num>
+CompactStore<Num>::CompactStore(bool share) : _share(share) {
+    if (_share) _table.assign(16, none);
+}
+
+template<typename Num>
+typename CompactStore<Num>::Index CompactStore<Num>::append(NodeKind op, Index lhs, Index rhs) {
+    if (_ops.size() == none) {
+        throw std::length_error("compact store is full");
+    }
+    _ops.push_back(op);
+    _operands.push_back({lhs, rhs});
+    return _ops.size() - 1;
+}
+
+template<typename Num>
+std::uint64_t CompactStore<Num>::key(Index index) const {
+    const auto &operands = _operands[index];
+    if (_ops[index] == NodeKind::Value) return value_key(_constants[operands[0]]);
+    return node_key(_ops[index], operands[0], operands[1]);
+}
+
+template<typename Num>
+template<typename Same>
+std::size_t CompactStore<Num>::find(std::uint64_t key, Same same) const {
+    std::size_t mask = _table.size() - 1;
+    for (std::size_t slot = key & mask;; slot = (slot + 1) & mask) {
+        if (_table[slot] == none || same(_table[slot])) return slot;
+    }
+}
+
+// Keeps the table at most half full, rehashing from the stored nodes.
+template<typename Num>
+void CompactStore<Num>::claim(std::size_t slot, Index index) {
+    _table[slot] = index;
+    if (++_used * 2 <= _table.size()) return;
+    std::vector<Index> old(_table.size() * 2, none);
+    old.swap(_table);
+    for (Index entry : old) {
+        if (entry != none) _table[find(key(entry), [](Index) { return false; })] = entry;
+    }
+}
+
+template<typename Num>
+typename CompactStore<Num>::Index CompactStore<Num>::push(NodeKind op, Index lhs, Index rhs) {
+    if (!_share) return append(op, lhs, rhs);
+    std::size_t slot = find(node_key(op, lhs, rhs), [&](Index candidate) {
+        return _ops[candidate] == op && _operands[candidate][0] == lhs && _operands[candidate][1] == rhs;
+    });
+    if (_table[slot] != none) return _table[slot];
+    Index index = append(op, lhs, rhs);
+    claim(slot, index);
+    return index;
+}
+
+// Constants are matched by bit pattern, so NaN and -0 keep their own nodes.
+template<typename Num>
+typename CompactStore<Num>::Index CompactStore<Num>::constant(Num value) {
+    std::size_t slot = 0;
+    if (_share) {
+        slot = find(value_key(value), [&](Index candidate) {
+            return _ops[candidate] == NodeKind::Value && same_number(_constants[_operands[candidate][0]], value);
+        });
+        if (_table[slot] != none) return _table[slot];
+    }
+    _constants.push_back(value);
+    Index index = append(NodeKind::Value, _constants.size() - 1, none);
+    if (_share) claim(slot, index);
+    return index;
+}
+
+template<typename Num>
+typename CompactStore<Num>::Index CompactStore<Num>::variable(const std::string &name) {
+    auto it = _ids.find(name);
+    if (it == _ids.end()) {
+        _names.push_back(name);
+        it = _ids.emplace(name, _names.size() - 1).first;
+    }
+    return push(NodeKind::Variable, it->second, none);
+}
+
+template<typename Num>
+typename CompactStore<Num>::Index CompactStore<Num>::add(const Expression<Num> &expr) {
+    std::unordered_map<const ExpressionTempl<Num> *, Index> imported;
+    // Explicit post-order walk: a node is emitted once both operands are.
+    std::vector<std::pair<Expression<Num>, bool>> stack = {{expr, false}};
+    while (!stack.empty()) {
+        auto [current, expanded] = stack.back();
+        stack.pop_back();
+        const ExpressionTempl<Num> *node = &current.node();
+        if (imported.count(node)) continue;
+        NodeKind kind = current.kind();
+        if (kind == NodeKind::Poly || kind == NodeKind::Sum || kind == NodeKind::Product) {
+            Expression<Num> lowered = kind == NodeKind::Poly ? static_cast<const PolyExpr<Num> *>(node)->lowered()
+                                    : kind == NodeKind::Sum ? static_cast<const SumExpr<Num> *>(node)->lowered()
+                                    : static_cast<const ProductExpr<Num> *>(node)->lowered();
+            if (!expanded) {
+                stack.push_back({current, true});
+                stack.push_back({lowered, false});
+            } else {
+                imported[node] = imported.at(&lowered.node());
+            }
+            continue;
+        }
+        if (kind == NodeKind::Value) {
+            imported[node] = constant(static_cast<const Value<Num> *>(node)->value());
+            continue;
+        }
+        if (kind == NodeKind::Variable) {
+            imported[node] = variable(static_cast<const Variable<Num> *>(node)->name());
+            continue;
+        }
+        if (!expanded) {
+            stack.push_back({current, true});
+            for (std::size_t i = node->arity(); i-- > 0;) {
+                stack.push_back({node->operand(i), false});
+            }
+            continue;
+        }
+        if (kind == NodeKind::Dif) {
+            imported[node] = imported.at(&node->operand(0).node());
+            continue;
+        }
+        Index lhs = imported.at(&node->operand(0).node());
+        Index rhs = node->arity() > 1 ? imported.at(&node->operand(1).node()) : none;
+        imported[node] = push(kind, lhs, rhs);
+    }
+    return imported.at(&expr.node());
+}
+
+template<typename Num>
+Expression<Num> CompactStore<Num>::to_expression(Index root) const {
+    std::unordered_map<Index, Expression<Num>> built;
+    std::vector<std::pair<Index, bool>> stack = {{root, false}};
+    while (!stack.empty()) {
+        auto [index, expanded] = stack.back();
+        stack.pop_back();
+        if (built.count(index)) continue;
+        NodeKind op = _ops[index];
+        const auto &operands = _operands[index];
+        if (op == NodeKind::Value) {
+            built.emplace(index, Expression<Num>(_constants[operands[0]]));
+        } else if (op == NodeKind::Variable) {
+            built.emplace(index, Expression<Num>(make_node<Variable<Num>>(_names[operands[0]])));
+        } else if (!expanded) {
+            stack.push_back({index, true});
+            stack.push_back({operands[0], false});
+            if (operands[1] != none) stack.push_back({operands[1], false});
+        } else {
+            const Expression<Num> &lhs = built.at(operands[0]);
+            built.emplace(index, combine(op, lhs, operands[1] != none ? built.at(operands[1]) : lhs));
+        }
+    }
+    return built.at(root);
+}
+
+template<typename Num>
+std::string CompactStore<Num>::to_string(Index root) const {
+    return to_expression(root).to_string();
+}
+
+template<typename Num>
+Num CompactStore<Num>::eval(Index root, const std::map<std::string, Num> &substitution) const {
+    std::vector<Num> values(_names.size());
+    for (Index index : reachable(root)) {
+        if (_ops[index] != NodeKind::Variable) continue;
+        const std::string &name = _names[_operands[index][0]];
+        auto it = substitution.find(name);
+        if (it == substitution.end()) {
+            throw std::out_of_range("no value for variable " + name);
+        }
+        values[_operands[index][0]] = it->second;
+    }
+    return eval(root, values.data());
+}
+
+// Operands always have smaller indices, so the reachable nodes sorted
+// ascending are already in evaluation order.
+template<typename Num>
+std::vector<typename CompactStore<Num>::Index> CompactStore<Num>::reachable(Index root) const {
+    std::vector<Index> res;
+    std::unordered_set<Index> seen = {root};
+    std::vector<Index> stack = {root};
+    while (!stack.empty()) {
+        Index index = stack.back();
+        stack.pop_back();
+        res.push_back(index);
+        NodeKind op = _ops[index];
+        if (op == NodeKind::Value || op == NodeKind::Variable) continue;
+        for (Index operand : _operands[index]) {
+            if (operand != none && seen.insert(operand).second) stack.push_back(operand);
+        }
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+template<typename Num>
+Num CompactStore<Num>::eval(Index root, const Num *values) const {
+    // Results are dense over the reachable nodes only, found by position in
+    // their sorted list, so the cost does not grow with the rest of the store.
+    std::vector<Index> nodes = reachable(root);
+    std::vector<Num> result(nodes.size());
+    auto at = [&](Index index) -> const Num & {
+        return result[std::lower_bound(nodes.begin(), nodes.end(), index) - nodes.begin()];
+    };
+    for (std::size_t position = 0; position < nodes.size(); position++) {
+        Index index = nodes[position];
+        const auto &operands = _operands[index];
+        Num value;
+        switch (_ops[index]) {
+            case NodeKind::Value:
+                value = _constants[operands[0]];
+                break;
+            case NodeKind::Variable:
+                value = values[operands[0]];
+                break;
+            case NodeKind::Add:
+                value = at(operands[0]) + at(operands[1]);
+                break;
+            case NodeKind::Sub:
+                value = at(operands[0]) - at(operands[1]);
+                break;
+            case NodeKind::Mul:
+                value = at(operands[0]) * at(operands[1]);
+                break;
+            case NodeKind::Div:
+                value = at(operands[0]) / at(operands[1]);
+                break;
+            case NodeKind::Pow:
+                value = std::pow(at(operands[0]), at(operands[1]));
+                break;
+            case NodeKind::Ln:
+                value = std::log(at(operands[0]));
+                break;
+            case NodeKind::Sin:
+                value = std::sin(at(operands[0]));
+                break;
+            case NodeKind::Cos:
+                value = std::cos(at(operands[0]));
+                break;
+            case NodeKind::Exp:
+                value = std::exp(at(operands[0]));
+                break;
+            default:
+                throw std::logic_error("unexpected node in compact store");
+        }
+        result[position] = value;
+    }
+    return result.back();
+}
+
+template<typename Num>
+const std::vector<std::string> &CompactStore<Num>::variables() const {
+    return _names;
+}
+
+template<typename Num>
+std::size_t CompactStore<Num>::size() const {
+    return _ops.size();
+}
+
+template<typename Num>
+MemoryUsage CompactStore<Num>::memory_usage() const {
+    MemoryUsage usage;
+    usage.nodes = _ops.size();
+    usage.node_bytes = _ops.capacity() * sizeof(NodeKind) + _operands.capacity() * sizeof(std::array<Index, 2>);
+    usage.constant_bytes = _constants.capacity() * sizeof(Num);
+    for (const auto &name : _names) {
+        usage.name_bytes += sizeof(std::string) + (name.capacity() > 15 ? name.capacity() + 1 : 0);
+    }
+    usage.index_bytes = _ids.size() * (sizeof(std::string) + sizeof(Index) + 2 * sizeof(void *)) +
+                        _ids.bucket_count() * sizeof(void *);
+    usage.index_bytes += _table.capacity() * sizeof(Index);
+    return usage;
+}
+
+template<typename Num>
+void CompactStore<Num>::shrink_to_fit() {
+    _ops.shrink_to_fit();
+    _operands.shrink_to_fit();
+    _constants.shrink_to_fit();
+    _names.shrink_to_fit();
+}
+
+
+template
+MemoryUsage memory_usage(const Expression<double> &expr);
+
+template
+MemoryUsage memory_usage(const Expression<complex> &expr);
+
+template
+class CompactStore<double>;
+
+template
+class CompactStore<std::complex<double>>;
@@ -0,0 +1,90 @@
+#ifndef COMPACT_HPP
+#define COMPACT_HPP
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "expression.hpp"
+
+
+struct MemoryUsage {
+    std::size_t nodes = 0;
+    std::size_t node_bytes = 0;
+    std::size_t constant_bytes = 0;
+    std::size_t name_bytes = 0;
+    std::size_t index_bytes = 0;
+
+    std::size_t total() const { return node_bytes + constant_bytes + name_bytes + index_bytes; }
+};
+
+// Bytes held by the distinct nodes reachable from `expr` in tree form.
+template<typename Num = rational>
+MemoryUsage memory_usage(const Expression<Num> &expr);
+
+
+// Structure-of-arrays node table: a one-byte opcode and two 32-bit operand
+// slots per node. Value nodes keep an index into the constant pool and
+// Variable nodes an interned variable id in their first slot. Operands always
+// precede the node that uses them. With sharing enabled, identical nodes are
+// stored once across every expression added to the store; the index is an
+// open-addressing table of node indices, whose keys are recomputed from the
+// nodes themselves, so it costs 8 bytes or less per node.
+template<typename Num = rational>
+class CompactStore {
+public:
+    using Index = std::uint32_t;
+
+    explicit CompactStore(bool share = true);
+
+    Index add(const Expression<Num> &expr);
+
+    Expression<Num> to_expression(Index root) const;
+
+    std::string to_string(Index root) const;
+
+    Num eval(Index root, const std::map<std::string, Num> &substitution) const;
+
+    // `values` is indexed by variable id, see variables().
+    Num eval(Index root, const Num *values) const;
+
+    const std::vector<std::string> &variables() const;
+
+    std::size_t size() const;
+
+    MemoryUsage memory_usage() const;
+
+    void shrink_to_fit();
+
+private:
+    Index push(NodeKind op, Index lhs, Index rhs);
+
+    Index append(NodeKind op, Index lhs, Index rhs);
+
+    std::uint64_t key(Index index) const;
+
+    // Slot of the node matching `same`, or the empty slot where it belongs.
+    template<typename Same>
+    std::size_t find(std::uint64_t key, Same same) const;
+
+    void claim(std::size_t slot, Index index);
+
+    Index constant(Num value);
+
+    Index variable(const std::string &name);
+
+    std::vector<Index> reachable(Index root) const;
+
+    std::vector<NodeKind> _ops;
+    std::vector<std::array<Index, 2>> _operands;
+    std::vector<Num> _constants;
+    std::vector<std::string> _names;
+    std::unordered_map<std::string, Index> _ids;
+    bool _share;
+    std::vector<Index> _table;
+    std::size_t _used = 0;
+};
+
+#endif
@@ -0,0 +1,661 @@
+#include "compiled.hpp"
+#include "polynomial.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+
+namespace {
+
+// Constants are pooled by bit pattern: NaN never compares equal to itself,
+// which would break the pool's ordering and merge it with another constant.
+inline std::pair<std::uint64_t, std::uint64_t> number_key(rational value) {
+    return {number_hash(value), 0};
+}
+
+inline std::pair<std::uint64_t, std::uint64_t> number_key(complex value) {
+    return {number_hash(value.real()), number_hash(value.imag())};
+}
+
+inline bool is_finite(rational value) {
+    return std::isfinite(value);
+}
+
+inline bool is_finite(complex value) {
+    return std::isfinite(value.real()) && std::isfinite(value.imag());
+}
+
+inline bool is_nan(rational value) {
+    return std::isnan(value);
+}
+
+inline bool is_nan(complex value) {
+    return std::isnan(value.real()) || std::isnan(value.imag());
+}
+
+// Flags the rows whose value is infinite or NaN. x - x is 0 exactly for
+// finite x, so a clean block costs one subtract and add per value, spread
+// over four sums so the adds do not wait on each other.
+template<typename Num>
+bool mark_non_finite(const Num *values, std::size_t n, char *suspect) {
+    Num a = Num(0), b = Num(0), c = Num(0), d = Num(0);
+    std::size_t r = 0;
+    for (; r + 4 <= n; r += 4) {
+        a += values[r] - values[r];
+        b += values[r + 1] - values[r + 1];
+        c += values[r + 2] - values[r + 2];
+        d += values[r + 3] - values[r + 3];
+    }
+    for (; r < n; r++) {
+        a += values[r] - values[r];
+    }
+    if (a + b + c + d == Num(0)) return false;
+    for (r = 0; r < n; r++) {
+        suspect[r] |= !is_finite(values[r]);
+    }
+    return true;
+}
+
+inline bool unary(OpCode op) {
+    return op == OpCode::Ln || op == OpCode::Sin || op == OpCode::Cos || op == OpCode::Exp;
+}
+
+OpCode opcode(NodeKind kind) {
+    switch (kind) {
+        case NodeKind::Add:
+            return OpCode::Add;
+        case NodeKind::Sub:
+            return OpCode::Sub;
+        case NodeKind::Mul:
+            return OpCode::Mul;
+        case NodeKind::Div:
+            return OpCode::Div;
+        case NodeKind::Pow:
+            return OpCode::Pow;
+        case NodeKind::Ln:
+            return OpCode::Ln;
+        case NodeKind::Sin:
+            return OpCode::Sin;
+        case NodeKind::Cos:
+            return OpCode::Cos;
+        case NodeKind::Exp:
+            return OpCode::Exp;
+        default:
+            throw std::invalid_argument("expression node cannot be compiled");
+    }
+}
+
+}
+
+
+template<typename Num>
+std::vector<std::string> unbound_variables(const std::vector<Expression<Num>> &exprs,
+                                           const std::vector<std::string> &inputs) {
+    std::set<std::string> vars;
+    for (const auto &expr : exprs) {
+        auto more = expr.variables();
+        vars.insert(more.begin(), more.end());
+    }
+    std::vector<std::string> res;
+    for (const auto &var : vars) {
+        if (std::find(inputs.begin(), inputs.end(), var) == inputs.end()) res.push_back(var);
+    }
+    return res;
+}
+
+namespace {
+
+// Reports every unbound variable at once, before any code is emitted.
+template<typename Num>
+void check_inputs(const std::vector<Expression<Num>> &exprs, const std::vector<std::string> &inputs) {
+    std::vector<std::string> unbound = unbound_variables(exprs, inputs);
+    if (unbound.empty()) return;
+    std::string names;
+    for (const auto &var : unbound) {
+        names += (names.empty() ? "" : ", ") + var;
+    }
+    throw std::invalid_argument(unbound.size() == 1 ? "variable " + names + " is not a program input"
+                                                    : "variables " + names + " are not program inputs");
+}
+
+}
+
+
+template<typename Num>
+Program<Num>::Program(const Expression<Num> &expr) : Program(expr, {}) {}
+
+template<typename Num>
+Program<Num>::Program(const Expression<Num> &expr, std::vector<std::string> inputs) : _inputs(std::move(inputs)) {
+    if (_inputs.empty()) {
+        auto vars = expr.variables();
+        _inputs.assign(vars.begin(), vars.end());
+    }
+    check_inputs(std::vector<Expression<Num>>{expr}, _inputs);
+    _outputs.push_back(emit(expr));
+    _emitted.clear();
+}
+
+template<typename Num>
+Program<Num>::Program(const std::vector<Expression<Num>> &exprs, std::vector<std::string> inputs)
+        : _inputs(std::move(inputs)) {
+    if (_inputs.empty()) {
+        std::set<std::string> vars;
+        for (const auto &expr : exprs) {
+            auto more = expr.variables();
+            vars.insert(more.begin(), more.end());
+        }
+        _inputs.assign(vars.begin(), vars.end());
+    }
+    check_inputs(exprs, _inputs);
+    for (const auto &expr : exprs) {
+        _outputs.push_back(emit(expr));
+    }
+    _emitted.clear();
+}
+
+template<typename Num>
+std::uint32_t Program<Num>::push(Instruction instruction) {
+    auto key = std::make_tuple(instruction.op, instruction.lhs, instruction.rhs);
+    auto it = _slots.find(key);
+    if (it != _slots.end()) return it->second;
+    _code.push_back(instruction);
+    std::uint32_t slot = _code.size() - 1;
+    _slots.emplace(key, slot);
+    return slot;
+}
+
+template<typename Num>
+std::uint32_t Program<Num>::constant(Num value) {
+    auto key = number_key(value);
+    auto it = _constant_slots.find(key);
+    if (it == _constant_slots.end()) {
+        _constants.push_back(value);
+        it = _constant_slots.emplace(key, _constants.size() - 1).first;
+    }
+    return push({OpCode::Const, it->second, 0});
+}
+
+// Post-order over an explicit stack: a node is emitted once its operands are.
+template<typename Num>
+std::uint32_t Program<Num>::emit(const Expression<Num> &root) {
+    std::vector<std::pair<Expression<Num>, bool>> stack = {{root, false}};
+    while (!stack.empty()) {
+        Expression<Num> expr = std::move(stack.back().first);
+        bool visited = stack.back().second;
+        stack.pop_back();
+        const ExpressionTempl<Num> *node = &expr.node();
+        if (_emitted.count(node)) continue;
+        // N-ary nodes run as their balanced binary form.
+        if (expr.kind() == NodeKind::Sum || expr.kind() == NodeKind::Product) {
+            const Expression<Num> &lowered = expr.kind() == NodeKind::Sum
+                                             ? static_cast<const SumExpr<Num> *>(node)->lowered()
+                                             : static_cast<const ProductExpr<Num> *>(node)->lowered();
+            if (!visited) {
+                stack.emplace_back(expr, true);
+                stack.emplace_back(lowered, false);
+            } else {
+                _emitted.emplace(node, _emitted.at(&lowered.node()));
+            }
+            continue;
+        }
+        if (!visited && node->arity() > 0) {
+            stack.emplace_back(expr, true);
+            for (std::size_t i = node->arity(); i-- > 0;) {
+                stack.emplace_back(node->operand(i), false);
+            }
+            continue;
+        }
+
+        std::uint32_t slot;
+        switch (expr.kind()) {
+            case NodeKind::Value:
+                slot = constant(static_cast<const Value<Num> *>(node)->value());
+                break;
+            case NodeKind::Variable: {
+                const std::string &name = static_cast<const Variable<Num> *>(node)->name();
+                auto input = std::find(_inputs.begin(), _inputs.end(), name);
+                if (input == _inputs.end()) {
+                    throw std::invalid_argument("variable " + name + " is not a program input");
+                }
+                slot = push({OpCode::Input, (std::uint32_t) (input - _inputs.begin()), 0});
+                break;
+            }
+            case NodeKind::Dif:
+                slot = _emitted.at(&node->operand(0).node());
+                break;
+            case NodeKind::Poly: {
+                const auto *poly = static_cast<const PolyExpr<Num> *>(node);
+                std::vector<std::uint32_t> slots;
+                for (const auto *part : {&poly->numerator(), &poly->denominator()}) {
+                    for (const auto &name : part->variables()) {
+                        auto input = std::find(_inputs.begin(), _inputs.end(), name);
+                        if (input == _inputs.end()) {
+                            throw std::invalid_argument("variable " + name + " is not a program input");
+                        }
+                        slots.push_back(input - _inputs.begin());
+                    }
+                }
+                _polys.push_back(expr);
+                _poly_width = std::max(_poly_width, slots.size());
+                _poly_inputs.push_back(std::move(slots));
+                _code.push_back({OpCode::Poly, (std::uint32_t) (_polys.size() - 1), 0});
+                slot = _code.size() - 1;
+                break;
+            }
+            default: {
+                std::uint32_t lhs = _emitted.at(&node->operand(0).node());
+                std::uint32_t rhs = node->arity() > 1 ? _emitted.at(&node->operand(1).node()) : 0;
+                slot = push({opcode(expr.kind()), lhs, rhs});
+            }
+        }
+        _emitted.emplace(node, slot);
+    }
+    return _emitted.at(&root.node());
+}
+
+template<typename Num>
+const std::vector<std::string> &Program<Num>::inputs() const {
+    return _inputs;
+}
+
+template<typename Num>
+const std::vector<Instruction> &Program<Num>::code() const {
+    return _code;
+}
+
+template<typename Num>
+const std::vector<Num> &Program<Num>::constants() const {
+    return _constants;
+}
+
+template<typename Num>
+std::uint32_t Program<Num>::output() const {
+    return _outputs[0];
+}
+
+template<typename Num>
+const std::vector<std::uint32_t> &Program<Num>::outputs() const {
+    return _outputs;
+}
+
+template<typename Num>
+std::size_t Program<Num>::size() const {
+    return _code.size();
+}
+
+template<typename Num>
+template<typename Fetch>
+Num Program<Num>::poly(std::uint32_t index, Fetch fetch, Num *point) const {
+    const auto &node = static_cast<const PolyExpr<Num> &>(_polys[index].node());
+    const auto &slots = _poly_inputs[index];
+    for (std::size_t i = 0; i < slots.size(); i++) {
+        point[i] = fetch(slots[i]);
+    }
+    Num numerator = node.numerator().eval(point);
+    if (node.denominator().is_constant()) {
+        return numerator / node.denominator().constant();
+    }
+    return numerator / node.denominator().eval(point + node.numerator().variables().size());
+}
+
+template<typename Num>
+std::vector<Num> Program<Num>::run(const Num *point) const {
+    std::vector<Num> registers(_code.size()), poly_point(_poly_width);
+    for (std::size_t i = 0; i < _code.size(); i++) {
+        const Instruction &ins = _code[i];
+        switch (ins.op) {
+            case OpCode::Const:
+                registers[i] = _constants[ins.lhs];
+                break;
+            case OpCode::Input:
+                registers[i] = point[ins.lhs];
+                break;
+            case OpCode::Poly:
+                registers[i] = poly(ins.lhs, [&](std::uint32_t input) { return point[input]; }, poly_point.data());
+                break;
+            default:
+                registers[i] = apply_op(ins.op, registers[ins.lhs], registers[ins.rhs]);
+        }
+    }
+    return registers;
+}
+
+template<typename Num>
+Num Program<Num>::eval(const Num *point) const {
+    return run(point)[_outputs[0]];
+}
+
+template<typename Num>
+void Program<Num>::eval(const Num *point, Num *out) const {
+    std::vector<Num> registers = run(point);
+    for (std::size_t k = 0; k < _outputs.size(); k++) {
+        out[k] = registers[_outputs[k]];
+    }
+}
+
+template<typename Num>
+Num Program<Num>::eval(const std::map<std::string, Num> &substitution) const {
+    std::vector<Num> point(_inputs.size());
+    for (std::size_t i = 0; i < _inputs.size(); i++) {
+        auto it = substitution.find(_inputs[i]);
+        if (it == substitution.end()) {
+            throw std::out_of_range("no value for variable " + _inputs[i]);
+        }
+        point[i] = it->second;
+    }
+    return eval(point.data());
+}
+
+// Runs the program one instruction at a time over blocks of rows, so every
+// inner loop is a flat elementwise loop the compiler can vectorize.
+template<typename Num>
+void Program<Num>::eval_batch(const Num *const *columns, std::size_t rows, Num *out) const {
+    std::vector<Num *> outs(_outputs.size(), nullptr);
+    outs[0] = out;
+    eval_batch(columns, rows, outs.data());
+}
+
+template<typename Num>
+void Program<Num>::eval_batch(const Num *const *columns, std::size_t rows, Num *const *out) const {
+    eval_batch(columns, rows, out, nullptr);
+}
+
+template<typename Num>
+void Program<Num>::eval_batch(const Num *const *columns, std::size_t rows, Num *const *out,
+                              std::uint8_t *status) const {
+    // With status requested, null input columns read as NaN.
+    std::vector<const Num *> present;
+    std::vector<Num> absent;
+    if (status && std::find(columns, columns + _inputs.size(), nullptr) != columns + _inputs.size()) {
+        absent.assign(rows, Num(std::numeric_limits<double>::quiet_NaN()));
+        for (std::size_t i = 0; i < _inputs.size(); i++) {
+            present.push_back(columns[i] ? columns[i] : absent.data());
+        }
+        columns = present.data();
+    }
+    // A row is suspect when one of its outputs is infinite or NaN, or an
+    // operand that can hide it is: 1 / x, exp(x) and pow turn some
+    // non-finite x into finite results, every other operation passes them on.
+    std::vector<char> suspect(status ? block : 0);
+    std::vector<char> watched(status ? _code.size() : 0);
+    for (std::size_t i = 0; i < watched.size(); i++) {
+        const Instruction &ins = _code[i];
+        if (ins.op == OpCode::Div || ins.op == OpCode::Pow) watched[ins.rhs] = true;
+        if (ins.op == OpCode::Exp || ins.op == OpCode::Pow) watched[ins.lhs] = true;
+    }
+    for (std::size_t i = 0; i < watched.size(); i++) {
+        watched[i] = watched[i] && _code[i].op != OpCode::Const && _code[i].op != OpCode::Input;
+    }
+    std::vector<Num> scratch(_code.size() * block), poly_point(_poly_width);
+    std::vector<const Num *> registers(_code.size());
+    for (std::size_t i = 0; i < _code.size(); i++) {
+        if (_code[i].op == OpCode::Const) {
+            std::fill_n(scratch.begin() + i * block, block, _constants[_code[i].lhs]);
+        }
+    }
+    for (std::size_t start = 0; start < rows; start += block) {
+        std::size_t n = std::min(block, rows - start);
+        bool any = false;
+        for (std::size_t i = 0; i < _code.size(); i++) {
+            const Instruction &ins = _code[i];
+            Num *dst = scratch.data() + i * block;
+            if (ins.op == OpCode::Input) {
+                registers[i] = columns[ins.lhs] + start;
+                continue;
+            }
+            const Num *a = ins.op == OpCode::Const || ins.op == OpCode::Poly ? nullptr : registers[ins.lhs];
+            const Num *b = a ? registers[ins.rhs] : nullptr;
+            switch (ins.op) {
+                case OpCode::Const:
+                case OpCode::Input:
+                    break;
+                case OpCode::Add:
+                    for (std::size_t r = 0; r < n; r++) dst[r] = a[r] + b[r];
+                    break;
+                case OpCode::Sub:
+                    for (std::size_t r = 0; r < n; r++) dst[r] = a[r] - b[r];
+                    break;
+                case OpCode::Mul:
+                    for (std::size_t r = 0; r < n; r++) dst[r] = a[r] * b[r];
+                    break;
+                case OpCode::Div:
+                    for (std::size_t r = 0; r < n; r++) dst[r] = a[r] / b[r];
+                    break;
+                case OpCode::Pow:
+                    for (std::size_t r = 0; r < n; r++) dst[r] = std::pow(a[r], b[r]);
+                    break;
+                case OpCode::Ln:
+                    for (std::size_t r = 0; r < n; r++) dst[r] = std::log(a[r]);
+                    break;
+                case OpCode::Sin:
+                    for (std::size_t r = 0; r < n; r++) dst[r] = std::sin(a[r]);
+                    break;
+                case OpCode::Cos:
+                    for (std::size_t r = 0; r < n; r++) dst[r] = std::cos(a[r]);
+                    break;
+                case OpCode::Exp:
+                    for (std::size_t r = 0; r < n; r++) dst[r] = std::exp(a[r]);
+                    break;
+                case OpCode::Poly:
+                    for (std::size_t r = 0; r < n; r++) {
+                        dst[r] = poly(ins.lhs, [&](std::uint32_t input) { return columns[input][start + r]; },
+                                      poly_point.data());
+                    }
+                    break;
+            }
+            registers[i] = dst;
+            if (status && watched[i]) {
+                any |= mark_non_finite(dst, n, suspect.data());
+            }
+        }
+        for (std::size_t k = 0; k < _outputs.size(); k++) {
+            if (out[k]) std::copy_n(registers[_outputs[k]], n, out[k] + start);
+            if (status) any |= mark_non_finite(registers[_outputs[k]], n, suspect.data());
+        }
+        if (status && !any) {
+            std::fill_n(status + start, n, 0);
+        } else if (status) {
+            for (std::size_t r = 0; r < n; r++) {
+                status[start + r] = suspect[r] ? diagnose(columns, start + r) : 0;
+            }
+            std::fill_n(suspect.begin(), n, 0);
+        }
+    }
+}
+
+// Scalar re-run of one row, blaming each non-finite value on the instruction
+// that produced it from finite operands.
+template<typename Num>
+std::uint8_t Program<Num>::diagnose(const Num *const *columns, std::size_t row) const {
+    std::uint8_t res = 0;
+    std::vector<Num> registers(_code.size()), poly_point(_poly_width);
+    for (std::size_t i = 0; i < _code.size(); i++) {
+        const Instruction &ins = _code[i];
+        Num &value = registers[i];
+        switch (ins.op) {
+            case OpCode::Const:
+                value = _constants[ins.lhs];
+                break;
+            case OpCode::Input:
+                value = columns[ins.lhs][row];
+                if (is_nan(value)) res |= EvalStatus::Missing;
+                break;
+            case OpCode::Poly: {
+                bool clean = true;
+                for (std::uint32_t input : _poly_inputs[ins.lhs]) {
+                    clean = clean && is_finite(columns[input][row]);
+                }
+                value = poly(ins.lhs, [&](std::uint32_t input) { return columns[input][row]; }, poly_point.data());
+                if (clean && !is_finite(value)) {
+                    const auto &node = static_cast<const PolyExpr<Num> &>(_polys[ins.lhs].node());
+                    bool pole = is_nan(value) || !node.denominator().is_constant();
+                    res |= pole ? EvalStatus::Domain : EvalStatus::Overflow;
+                }
+                break;
+            }
+            default: {
+                Num a = registers[ins.lhs], b = unary(ins.op) ? a : registers[ins.rhs];
+                value = apply_op(ins.op, a, b);
+                if (is_finite(a) && is_finite(b) && !is_finite(value)) {
+                    bool pole = (ins.op == OpCode::Div && b == Num(0)) ||
+                                ((ins.op == OpCode::Ln || ins.op == OpCode::Pow) && a == Num(0));
+                    res |= is_nan(value) || pole ? EvalStatus::Domain : EvalStatus::Overflow;
+                }
+            }
+        }
+    }
+    for (std::uint32_t output : _outputs) {
+        if (is_nan(registers[output])) res |= EvalStatus::NaN;
+    }
+    return res;
+}
+
+template<typename Num>
+Program<Num> Program<Num>::bind(const std::map<std::string, Num> &parameters) const {
+    Program<Num> res;
+    std::vector<std::uint32_t> remap(_inputs.size());
+    std::vector<bool> bound(_inputs.size());
+    std::vector<Num> point(_inputs.size());
+    for (std::size_t i = 0; i < _inputs.size(); i++) {
+        auto it = parameters.find(_inputs[i]);
+        if (it != parameters.end()) {
+            bound[i] = true;
+            point[i] = it->second;
+        } else {
+            remap[i] = res._inputs.size();
+            res._inputs.push_back(_inputs[i]);
+        }
+    }
+
+    // slot[i] is the instruction in `res` computing instruction i, unless
+    // known[i] is set, in which case value[i] holds its result.
+    std::vector<std::uint32_t> slot(_code.size());
+    std::vector<bool> known(_code.size());
+    std::vector<Num> value(_code.size()), poly_point(_poly_width);
+    auto materialize = [&](std::uint32_t i) {
+        return known[i] ? res.constant(value[i]) : slot[i];
+    };
+    for (std::size_t i = 0; i < _code.size(); i++) {
+        const Instruction &ins = _code[i];
+        switch (ins.op) {
+            case OpCode::Const:
+                known[i] = true;
+                value[i] = _constants[ins.lhs];
+                break;
+            case OpCode::Input:
+                if (bound[ins.lhs]) {
+                    known[i] = true;
+                    value[i] = point[ins.lhs];
+                } else {
+                    slot[i] = res.push({OpCode::Input, remap[ins.lhs], 0});
+                }
+                break;
+            case OpCode::Poly: {
+                const auto &inputs = _poly_inputs[ins.lhs];
+                if (std::all_of(inputs.begin(), inputs.end(), [&](std::uint32_t input) { return bound[input]; })) {
+                    known[i] = true;
+                    value[i] = poly(ins.lhs, [&](std::uint32_t input) { return point[input]; }, poly_point.data());
+                } else {
+                    slot[i] = res.emit(_polys[ins.lhs].sub(parameters));
+                    res._emitted.clear();
+                }
+                break;
+            }
+            default: {
+                bool unary = ins.op == OpCode::Ln || ins.op == OpCode::Sin || ins.op == OpCode::Cos ||
+                             ins.op == OpCode::Exp;
+                if (known[ins.lhs] && (unary || known[ins.rhs])) {
+                    known[i] = true;
+                    value[i] = apply_op(ins.op, value[ins.lhs], unary ? value[ins.lhs] : value[ins.rhs]);
+                } else {
+                    std::uint32_t lhs = materialize(ins.lhs);
+                    std::uint32_t rhs = unary ? 0 : materialize(ins.rhs);
+                    slot[i] = res.push({ins.op, lhs, rhs});
+                }
+            }
+        }
+    }
+    for (std::uint32_t output : _outputs) {
+        res._outputs.push_back(materialize(output));
+    }
+    return res;
+}
+
+
+template<typename Num>
+ExpressionSet<Num>::ExpressionSet(std::vector<Expression<Num>> exprs, std::vector<std::string> inputs)
+        : _expressions(std::move(exprs)), _program(_expressions, std::move(inputs)) {}
+
+template<typename Num>
+std::size_t ExpressionSet<Num>::size() const {
+    return _expressions.size();
+}
+
+template<typename Num>
+const Expression<Num> &ExpressionSet<Num>::operator[](std::size_t index) const {
+    return _expressions[index];
+}
+
+template<typename Num>
+const std::vector<std::string> &ExpressionSet<Num>::inputs() const {
+    return _program.inputs();
+}
+
+template<typename Num>
+const Program<Num> &ExpressionSet<Num>::program() const {
+    return _program;
+}
+
+template<typename Num>
+std::vector<Num> ExpressionSet<Num>::eval(const std::map<std::string, Num> &substitution) const {
+    const auto &names = _program.inputs();
+    std::vector<Num> point(names.size());
+    for (std::size_t i = 0; i < names.size(); i++) {
+        auto it = substitution.find(names[i]);
+        if (it == substitution.end()) {
+            throw std::out_of_range("no value for variable " + names[i]);
+        }
+        point[i] = it->second;
+    }
+    std::vector<Num> res(_expressions.size());
+    _program.eval(point.data(), res.data());
+    return res;
+}
+
+template<typename Num>
+void ExpressionSet<Num>::eval(const Num *point, Num *out) const {
+    _program.eval(point, out);
+}
+
+template<typename Num>
+void ExpressionSet<Num>::eval_batch(const Num *const *columns, std::size_t rows, Num *const *out) const {
+    _program.eval_batch(columns, rows, out);
+}
+
+template<typename Num>
+void ExpressionSet<Num>::eval_batch(const Num *const *columns, std::size_t rows, Num *const *out,
+                                    std::uint8_t *status) const {
+    _program.eval_batch(columns, rows, out, status);
+}
+
+
+template
+class Program<double>;
+
+template
+class Program<std::complex<double>>;
+
+template
+class ExpressionSet<double>;
+
+template
+class ExpressionSet<std::complex<double>>;
+
+template
+std::vector<std::string> unbound_variables(const std::vector<Expression<double>> &exprs,
+                                           const std::vector<std::string> &inputs);
+
+template
+std::vector<std::string> unbound_variables(const std::vector<Expression<std::complex<double>>> &exprs,
+                                           const std::vector<std::string> &inputs);
@@ -0,0 +1,194 @@
+#ifndef COMPILED_HPP
+#define COMPILED_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include "expression.hpp"
+
+
+enum class OpCode : unsigned char {
+    Const,
+    Input,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Pow,
+    Ln,
+    Sin,
+    Cos,
+    Exp,
+    Poly
+};
+
+// Operands refer to earlier instructions; Const, Input and Poly use lhs as an
+// index into the constant pool, the input list and the polynomial table.
+struct Instruction {
+    OpCode op;
+    std::uint32_t lhs;
+    std::uint32_t rhs;
+};
+
+template<typename Num>
+inline Num apply_op(OpCode op, Num lhs, Num rhs) {
+    switch (op) {
+        case OpCode::Add:
+            return lhs + rhs;
+        case OpCode::Sub:
+            return lhs - rhs;
+        case OpCode::Mul:
+            return lhs * rhs;
+        case OpCode::Div:
+            return lhs / rhs;
+        case OpCode::Pow:
+            return std::pow(lhs, rhs);
+        case OpCode::Ln:
+            return std::log(lhs);
+        case OpCode::Sin:
+            return std::sin(lhs);
+        case OpCode::Cos:
+            return std::cos(lhs);
+        case OpCode::Exp:
+            return std::exp(lhs);
+        default:
+            return lhs;
+    }
+}
+
+// Bits of the per-row status written by the checked eval_batch.
+struct EvalStatus {
+    // An input column is null, or holds NaN in the row.
+    static constexpr std::uint8_t Missing = 1;
+    // An operation on finite operands left its domain: ln or a fractional
+    // power of a negative real, 0 / 0, or a pole such as x / 0 or ln(0).
+    static constexpr std::uint8_t Domain = 2;
+    // An operation on finite operands overflowed to infinity.
+    static constexpr std::uint8_t Overflow = 4;
+    // Some output is NaN.
+    static constexpr std::uint8_t NaN = 8;
+};
+
+// Free variables of `exprs` missing from `inputs`, in sorted order; a program
+// over `inputs` compiles exactly when this is empty.
+template<typename Num = rational>
+std::vector<std::string> unbound_variables(const std::vector<Expression<Num>> &exprs,
+                                           const std::vector<std::string> &inputs);
+
+
+// Expression flattened into a post-order instruction list with common
+// subexpressions merged. Inputs are bound to positions once at compile time,
+// so evaluation takes plain arrays instead of a map per call.
+template<typename Num = rational>
+class Program {
+public:
+    Program(const Expression<Num> &expr);
+
+    // Inputs default to the expression's variables in sorted order.
+    Program(const Expression<Num> &expr, std::vector<std::string> inputs);
+
+    // One program computing every expression, with subexpressions shared
+    // across them; inputs default to the union of their variables.
+    Program(const std::vector<Expression<Num>> &exprs, std::vector<std::string> inputs = {});
+
+    const std::vector<std::string> &inputs() const;
+
+    const std::vector<Instruction> &code() const;
+
+    const std::vector<Num> &constants() const;
+
+    std::uint32_t output() const;
+
+    const std::vector<std::uint32_t> &outputs() const;
+
+    std::size_t size() const;
+
+    Num eval(const Num *point) const;
+
+    Num eval(const std::map<std::string, Num> &substitution) const;
+
+    // Writes output k to out[k].
+    void eval(const Num *point, Num *out) const;
+
+    void eval_batch(const Num *const *columns, std::size_t rows, Num *out) const;
+
+    // Writes output k of row r to out[k][r]; null columns are skipped.
+    void eval_batch(const Num *const *columns, std::size_t rows, Num *const *out) const;
+
+    // Same as above, never throwing, and also writing an EvalStatus mask to
+    // status[r] (0 for a clean row). Only rows with a non-finite output, or
+    // a non-finite operand of /, ^ or exp (which can hide it), are re-run to
+    // classify their errors, so clean batches cost a few percent more. A NaN
+    // input hidden by pow(x, 0) goes unreported.
+    void eval_batch(const Num *const *columns, std::size_t rows, Num *const *out, std::uint8_t *status) const;
+
+    // Program over the remaining inputs, with every instruction that depends
+    // only on `parameters` evaluated once and replaced by a constant. Bind
+    // once per batch, then run the result over the rows.
+    Program<Num> bind(const std::map<std::string, Num> &parameters) const;
+
+    static constexpr std::size_t block = 256;
+
+private:
+    Program() = default;
+
+    std::uint32_t emit(const Expression<Num> &expr);
+
+    std::uint32_t constant(Num value);
+
+    std::vector<Num> run(const Num *point) const;
+
+    std::uint8_t diagnose(const Num *const *columns, std::size_t row) const;
+
+    std::uint32_t push(Instruction instruction);
+
+    // `point` is scratch space for at least _poly_width values.
+    template<typename Fetch>
+    Num poly(std::uint32_t index, Fetch fetch, Num *point) const;
+
+    std::vector<std::string> _inputs;
+    std::vector<Instruction> _code;
+    std::vector<Num> _constants;
+    std::vector<Expression<Num>> _polys;
+    std::vector<std::vector<std::uint32_t>> _poly_inputs;
+    std::size_t _poly_width = 0;
+    std::vector<std::uint32_t> _outputs;
+
+    std::map<const ExpressionTempl<Num> *, std::uint32_t> _emitted;
+    std::map<std::pair<std::uint64_t, std::uint64_t>, std::uint32_t> _constant_slots;
+    std::map<std::tuple<OpCode, std::uint32_t, std::uint32_t>, std::uint32_t> _slots;
+};
+
+
+// Related expressions (a model, its derivatives, diagnostics) evaluated
+// together: one fused program reads each input once per row and computes
+// shared subexpressions once for all outputs.
+template<typename Num = rational>
+class ExpressionSet {
+public:
+    ExpressionSet(std::vector<Expression<Num>> exprs, std::vector<std::string> inputs = {});
+
+    std::size_t size() const;
+
+    const Expression<Num> &operator[](std::size_t index) const;
+
+    const std::vector<std::string> &inputs() const;
+
+    const Program<Num> &program() const;
+
+    std::vector<Num> eval(const std::map<std::string, Num> &substitution) const;
+
+    void eval(const Num *point, Num *out) const;
+
+    void eval_batch(const Num *const *columns, std::size_t rows, Num *const *out) const;
+
+    void eval_batch(const Num *const *columns, std::size_t rows, Num *const *out, std::uint8_t *status) const;
+
+private:
+    std::vector<Expression<Num>> _expressions;
+    Program<Num> _program;
+};
+
+#endif
@@ -1,19 +1,145 @@
+#include <fstream>
 #include <iostream>
 #include <string>
 #include "expression.hpp"
+#include "server.hpp"
+#include "columns.hpp"
+#include "codegen.hpp"
 
 
 void help() {
     std::cout << "Commands:\n";
     std::cout << "  differentiator --eval 'expression' x=a, y=b, ...\n";
     std::cout << "  differentiator --diff 'expression' --by var\n";
+    std::cout << "  differentiator --serve [--socket path] [--cache entries]\n";
+    std::cout << "  differentiator --eval-columns 'expression' x=x.bin, y=y.bin, ... --output out.bin [--complex]\n";
+    std::cout << "  differentiator --emit-cpp 'expression' [--by x,y,...] [--name f] [--output f.hpp] [--complex]\n";
+}
+
+template<typename Num>
+int eval_columns(const std::string &expr, const std::map<std::string, std::string> &inputs, const std::string &output) {
+    std::size_t rows = eval_columns(Program<Num>(Expression<Num>(expr)), inputs, {output});
+    std::cout << rows << " rows" << std::endl;
+    return 0;
+}
+
+int eval_columns(int argc, char *argv[]) {
+    std::map<std::string, std::string> inputs;
+    std::string output;
+    bool is_complex = false;
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (arg == "--complex") {
+            is_complex = true;
+        } else if (arg.find('=') != std::string::npos) {
+            if (arg.back() == ',') arg.pop_back();
+            inputs[arg.substr(0, arg.find('='))] = arg.substr(arg.find('=') + 1);
+        } else {
+            help();
+            return 1;
+        }
+    }
+    if (output.empty()) {
+        help();
+        return 1;
+    }
+    if (is_complex) {
+        return eval_columns<complex>(argv[2], inputs, output);
+    }
+    return eval_columns<rational>(argv[2], inputs, output);
+}
+
+int emit_cpp(int argc, char *argv[]) {
+    std::vector<std::string> by;
+    CodegenOptions options;
+    std::string output;
+    bool is_complex = false;
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--by" && i + 1 < argc) {
+            std::string list = argv[++i];
+            for (std::size_t start = 0; start <= list.size();) {
+                std::size_t end = std::min(list.find(',', start), list.size());
+                if (end > start) by.push_back(list.substr(start, end - start));
+                start = end + 1;
+            }
+        } else if (arg == "--name" && i + 1 < argc) {
+            options.name = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (arg == "--complex") {
+            is_complex = true;
+        } else {
+            help();
+            return 1;
+        }
+    }
+    std::string code = is_complex ? emit_cpp(Expression<complex>(argv[2]), by, options)
+                                  : emit_cpp(Expression<rational>(argv[2]), by, options);
+    if (output.empty()) {
+        std::cout << code;
+    } else {
+        std::ofstream(output) << code;
+    }
+    return 0;
+}
+
+int serve(int argc, char *argv[]) {
+    std::string socket;
+    std::size_t capacity = 1024;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string opt = argv[i];
+        if (opt == "--socket") {
+            socket = argv[i + 1];
+        } else if (opt == "--cache") {
+            std::string value = argv[i + 1];
+            std::size_t end = 0;
+            try {
+                if (value.find_first_not_of("0123456789") == std::string::npos) capacity = std::stoul(value, &end);
+            } catch (const std::exception &) {
+            }
+            if (value.empty() || end != value.size()) {
+                help();
+                return 1;
+            }
+        } else {
+            help();
+            return 1;
+        }
+    }
+    try {
+        Server server(capacity);
+        if (socket.empty()) {
+            std::ios::sync_with_stdio(false);
+            server.serve(std::cin, std::cout);
+        } else {
+            server.serve_socket(socket);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
+    if (argc >= 2 && std::string(argv[1]) == "--serve") {
+        return serve(argc, argv);
+    }
     if (argc <= 2) {
         help();
         return 1;
     }
+    if (std::string(argv[1]) == "--eval-columns" || std::string(argv[1]) == "--emit-cpp") {
+        try {
+            return std::string(argv[1]) == "--emit-cpp" ? emit_cpp(argc, argv) : eval_columns(argc, argv);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
 
     std::string cmd = argv[1];
     std::string expr = argv[2];
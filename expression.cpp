@@ -1,9 +1,15 @@
 #include "expression.hpp"
 #include <string>
+#include <algorithm>
 #include <complex>
+#include <cstdlib>
 #include <map>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
 
 using rational = double;
 using complex = std::complex<double>;
@@ -25,8 +31,474 @@ inline std::string make_string<complex>(complex val) {
 }
 
 
+// The traversals below keep their work on explicit stacks, so their depth is
+// bounded by heap memory rather than by the call stack.
+namespace {
+
+// Derivative nodes by (content node, variable), shared by every thread. An
+// entry does not own its DifExpr: the node erases itself when destroyed, and
+// a lookup only reuses it while it can still be retained. Sharded by content
+// node so that unrelated dif() calls rarely contend.
+template<typename Num>
+class DerivativeMemo {
+public:
+    // Never destroyed, since nodes may be released during static teardown.
+    static DerivativeMemo<Num> &instance() {
+        static auto *memo = new DerivativeMemo<Num>();
+        return *memo;
+    }
+
+    NodePtr<Num> find(const ExpressionTempl<Num> *content, const std::string &var) {
+        Shard &shard = at(content);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find({content, var});
+        return it == shard.entries.end() ? NodePtr<Num>() : adopt(it->second);
+    }
+
+    // Records `derivative` unless a live node is already recorded, in which
+    // case that one is returned instead.
+    NodePtr<Num> insert(const ExpressionTempl<Num> *content, const std::string &var,
+                        const NodePtr<Num> &derivative) {
+        Shard &shard = at(content);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const ExpressionTempl<Num> *&entry = shard.entries[{content, var}];
+        if (entry) {
+            NodePtr<Num> live = adopt(entry);
+            if (live) return live;
+        }
+        entry = derivative.get();
+        return derivative;
+    }
+
+    void erase(const ExpressionTempl<Num> *content, const std::string &var, const ExpressionTempl<Num> *derivative) {
+        Shard &shard = at(content);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find({content, var});
+        if (it != shard.entries.end() && it->second == derivative) {
+            shard.entries.erase(it);
+        }
+    }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::map<std::pair<const ExpressionTempl<Num> *, std::string>, const ExpressionTempl<Num> *> entries;
+    };
+
+    // Null when the node's last reference is already gone and its
+    // destructor is about to erase it.
+    static NodePtr<Num> adopt(const ExpressionTempl<Num> *node) {
+        if (!node->try_retain()) return NodePtr<Num>();
+        NodePtr<Num> res(node);
+        node->release();
+        return res;
+    }
+
+    Shard &at(const ExpressionTempl<Num> *content) {
+        return _shards[(reinterpret_cast<std::uintptr_t>(content) >> 4) % 64];
+    }
+
+    Shard _shards[64];
+};
+
+// Operands as stored, without expanding lazy derivatives: a DifExpr stands on
+// the expression it differentiates.
+std::uint64_t flags_hash(const std::vector<bool> &flags, bool extra) {
+    std::uint64_t res = extra;
+    for (bool flag : flags) {
+        res = hash_combine(res, flag);
+    }
+    return res;
+}
+
+template<typename Num>
+std::size_t stored_arity(const ExpressionTempl<Num> &node) {
+    return node.kind() == NodeKind::Dif ? 1 : node.arity();
+}
+
 template<typename Num>
-Value<Num>::Value(Num val) : _value(val) {}
+const Expression<Num> &stored_operand(const ExpressionTempl<Num> &node, std::size_t index) {
+    if (node.kind() == NodeKind::Dif) {
+        return static_cast<const DifExpr<Num> &>(node).content();
+    }
+    return node.operand(index);
+}
+
+// Four independent partial sums, so consecutive additions do not wait on
+// each other; Neumaier's compensated sum when the node asks for it.
+template<typename Num>
+std::pair<Num, Num> sum_terms(const SumExpr<Num> &node, const std::pair<Num, Num> *terms) {
+    std::size_t n = node.arity();
+    if (node.compensated()) {
+        Num sum[2] = {Num(0), Num(0)}, error[2] = {Num(0), Num(0)};
+        for (std::size_t i = 0; i < n; i++) {
+            Num term[2] = {terms[i].first, terms[i].second};
+            for (int k = 0; k < 2; k++) {
+                Num x = node.negated(i) ? -term[k] : term[k];
+                Num t = sum[k] + x;
+                error[k] += std::abs(sum[k]) >= std::abs(x) ? (sum[k] - t) + x : (x - t) + sum[k];
+                sum[k] = t;
+            }
+        }
+        return {sum[0] + error[0], sum[1] + error[1]};
+    }
+    Num value[4] = {Num(0), Num(0), Num(0), Num(0)}, slope[4] = {Num(0), Num(0), Num(0), Num(0)};
+    for (std::size_t i = 0; i < n; i++) {
+        if (node.negated(i)) {
+            value[i & 3] -= terms[i].first;
+            slope[i & 3] -= terms[i].second;
+        } else {
+            value[i & 3] += terms[i].first;
+            slope[i & 3] += terms[i].second;
+        }
+    }
+    return {(value[0] + value[1]) + (value[2] + value[3]), (slope[0] + slope[1]) + (slope[2] + slope[3])};
+}
+
+template<typename Num>
+std::pair<Num, Num> multiply_factors(const ProductExpr<Num> &node, const std::pair<Num, Num> *factors, bool slope) {
+    std::size_t n = node.arity();
+    if (!slope) {
+        Num value[4] = {Num(1), Num(1), Num(1), Num(1)};
+        for (std::size_t i = 0; i < n; i++) {
+            if (node.inverted(i)) {
+                value[i & 3] /= factors[i].first;
+            } else {
+                value[i & 3] *= factors[i].first;
+            }
+        }
+        return {(value[0] * value[1]) * (value[2] * value[3]), Num(0)};
+    }
+    Num value = Num(1), derivative = Num(0);
+    for (std::size_t i = 0; i < n; i++) {
+        const auto &[a, da] = factors[i];
+        if (node.inverted(i)) {
+            derivative = (derivative * a - value * da) / (a * a);
+            value /= a;
+        } else {
+            derivative = derivative * a + value * da;
+            value *= a;
+        }
+    }
+    return {value, derivative};
+}
+
+// Post-order evaluation; with `var` set, the derivative by `var` is carried
+// along in forward mode. A DifExpr is evaluated by differentiating its
+// content, or through its expansion when itself differentiated.
+template<typename Num>
+std::pair<Num, Num> evaluate(const ExpressionTempl<Num> &root, const std::map<std::string, Num> &substitution,
+                             const std::string *var) {
+    std::vector<std::pair<const ExpressionTempl<Num> *, std::size_t>> stack = {{&root, 0}};
+    std::vector<std::pair<Num, Num>> values;
+    while (!stack.empty()) {
+        const ExpressionTempl<Num> *node = stack.back().first;
+        NodeKind kind = node->kind();
+        switch (kind) {
+            case NodeKind::Value:
+                values.emplace_back(static_cast<const Value<Num> *>(node)->value(), Num(0));
+                stack.pop_back();
+                continue;
+            case NodeKind::Variable: {
+                const std::string &name = static_cast<const Variable<Num> *>(node)->name();
+                auto it = substitution.find(name);
+                if (it == substitution.end()) {
+                    throw std::out_of_range("no value for variable " + name);
+                }
+                values.emplace_back(it->second, Num(var && *var == name ? 1 : 0));
+                stack.pop_back();
+                continue;
+            }
+            case NodeKind::Poly:
+                values.push_back(var ? node->eval_dif(substitution, *var)
+                                     : std::make_pair(node->eval(substitution), Num(0)));
+                stack.pop_back();
+                continue;
+            case NodeKind::Dif:
+                if (!var) {
+                    // Forward mode needs every variable of the content, while
+                    // the derivative itself may not depend on all of them.
+                    const auto *dif = static_cast<const DifExpr<Num> *>(node);
+                    const auto &needed = dif->content_variables();
+                    bool complete = std::all_of(needed.begin(), needed.end(), [&](const std::string &name) {
+                        return substitution.count(name) != 0;
+                    });
+                    Num value = complete ? evaluate(dif->content().node(), substitution, &dif->var()).second
+                                         : evaluate(dif->simplified().node(), substitution, nullptr).first;
+                    values.emplace_back(value, Num(0));
+                    stack.pop_back();
+                    continue;
+                }
+                break;
+            default:
+                break;
+        }
+        std::size_t next = stack.back().second++;
+        if (next < node->arity()) {
+            stack.emplace_back(&node->operand(next).node(), 0);
+            continue;
+        }
+        stack.pop_back();
+        if (kind == NodeKind::Dif) {
+            continue;
+        }
+        if (kind == NodeKind::Sum || kind == NodeKind::Product) {
+            std::size_t base = values.size() - node->arity();
+            std::pair<Num, Num> res = kind == NodeKind::Sum
+                                      ? sum_terms(static_cast<const SumExpr<Num> &>(*node), values.data() + base)
+                                      : multiply_factors(static_cast<const ProductExpr<Num> &>(*node),
+                                                         values.data() + base, var != nullptr);
+            values.resize(base);
+            values.push_back(res);
+            continue;
+        }
+        std::pair<Num, Num> rhs = node->arity() > 1 ? values.back() : std::pair<Num, Num>();
+        if (node->arity() > 1) values.pop_back();
+        std::pair<Num, Num> &lhs = values.back();
+        Num a = lhs.first, da = lhs.second, b = rhs.first, db = rhs.second;
+        switch (kind) {
+            case NodeKind::Add:
+                lhs = {a + b, da + db};
+                break;
+            case NodeKind::Sub:
+                lhs = {a - b, da - db};
+                break;
+            case NodeKind::Mul:
+                lhs = {a * b, a * db + da * b};
+                break;
+            case NodeKind::Div:
+                lhs = {a / b, var ? (da * b - a * db) / (b * b) : Num(0)};
+                break;
+            case NodeKind::Pow: {
+                Num value = std::pow(a, b);
+                Num derivative = Num(0);
+                if (var) {
+                    derivative = b * std::pow(a, b - Num(1)) * da;
+                    if (db != Num(0)) {
+                        derivative += value * std::log(a) * db;
+                    }
+                }
+                lhs = {value, derivative};
+                break;
+            }
+            case NodeKind::Ln:
+                lhs = {std::log(a), var ? Num(1) / a * da : Num(0)};
+                break;
+            case NodeKind::Sin:
+                lhs = {std::sin(a), var ? std::cos(a) * da : Num(0)};
+                break;
+            case NodeKind::Cos:
+                lhs = {std::cos(a), var ? -std::sin(a) * da : Num(0)};
+                break;
+            case NodeKind::Exp: {
+                Num value = std::exp(a);
+                lhs = {value, value * da};
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return values.back();
+}
+
+template<typename Num>
+std::string render(const ExpressionTempl<Num> &root) {
+    std::string res;
+    std::vector<std::pair<const ExpressionTempl<Num> *, std::size_t>> stack = {{&root, 0}};
+    while (!stack.empty()) {
+        const ExpressionTempl<Num> *node = stack.back().first;
+        std::size_t step = stack.back().second++;
+        const char *infix = nullptr;
+        const char *prefix = nullptr;
+        switch (node->kind()) {
+            case NodeKind::Value:
+            case NodeKind::Variable:
+            case NodeKind::Poly:
+                res += node->to_string();
+                stack.pop_back();
+                continue;
+            case NodeKind::Dif:
+                if (step == 0) {
+                    stack.emplace_back(&node->operand(0).node(), 0);
+                } else {
+                    stack.pop_back();
+                }
+                continue;
+            case NodeKind::Add:
+                infix = " + ";
+                break;
+            case NodeKind::Sub:
+                infix = " - ";
+                break;
+            case NodeKind::Mul:
+                infix = " * ";
+                break;
+            case NodeKind::Div:
+                infix = " / ";
+                break;
+            case NodeKind::Pow:
+                infix = " ^ ";
+                break;
+            case NodeKind::Ln:
+                prefix = "ln(";
+                break;
+            case NodeKind::Sin:
+                prefix = "sin(";
+                break;
+            case NodeKind::Cos:
+                prefix = "cos(";
+                break;
+            case NodeKind::Exp:
+                prefix = "exp(";
+                break;
+            case NodeKind::Sum:
+            case NodeKind::Product: {
+                if (step == node->arity()) {
+                    res += ")";
+                    stack.pop_back();
+                    continue;
+                }
+                bool sum = node->kind() == NodeKind::Sum;
+                bool flip = sum ? static_cast<const SumExpr<Num> *>(node)->negated(step)
+                                : static_cast<const ProductExpr<Num> *>(node)->inverted(step);
+                if (step == 0) {
+                    res += flip ? (sum ? "(0 - " : "(1 / ") : "(";
+                } else {
+                    res += sum ? (flip ? " - " : " + ") : (flip ? " / " : " * ");
+                }
+                stack.emplace_back(&node->operand(step).node(), 0);
+                continue;
+            }
+        }
+        if (step == 0) {
+            res += prefix ? prefix : "(";
+            stack.emplace_back(&node->operand(0).node(), 0);
+        } else if (step == 1 && infix) {
+            res += infix;
+            stack.emplace_back(&node->operand(1).node(), 0);
+        } else {
+            res += ")";
+            stack.pop_back();
+        }
+    }
+    return res;
+}
+
+// Post-order rebuild shared by sub() and simplify(). `leaf` returns true and
+// sets its result for nodes whose operands need no visit; `combine` builds a
+// node's result from the results of its operands. Shared subtrees are
+// rewritten once.
+template<typename Num, typename Leaf, typename Combine>
+Expression<Num> rewrite(const Expression<Num> &root, Leaf leaf, Combine combine) {
+    std::unordered_map<const ExpressionTempl<Num> *, Expression<Num>> done;
+    std::vector<std::pair<Expression<Num>, bool>> stack = {{root, false}};
+    while (!stack.empty()) {
+        Expression<Num> expr = std::move(stack.back().first);
+        bool visited = stack.back().second;
+        stack.pop_back();
+        const ExpressionTempl<Num> *node = &expr.node();
+        if (done.count(node)) continue;
+        if (!visited) {
+            Expression<Num> res = expr;
+            if (leaf(expr, res)) {
+                done.emplace(node, std::move(res));
+                continue;
+            }
+            stack.emplace_back(expr, true);
+            for (std::size_t i = node->arity(); i-- > 0;) {
+                stack.emplace_back(node->operand(i), false);
+            }
+            continue;
+        }
+        std::vector<Expression<Num>> operands;
+        for (std::size_t i = 0; i < node->arity(); i++) {
+            operands.push_back(done.at(&node->operand(i).node()));
+        }
+        done.emplace(node, combine(expr, operands));
+    }
+    return done.at(&root.node());
+}
+
+}
+
+
+template<typename Num>
+std::size_t ExpressionTempl<Num>::arity() const {
+    return 0;
+}
+
+template<typename Num>
+const Expression<Num> &ExpressionTempl<Num>::operand(std::size_t index) const {
+    throw std::out_of_range("leaf expression has no operands");
+}
+
+template<typename Num>
+void ExpressionTempl<Num>::collect_variables(std::set<std::string> &variables) const {
+    for (std::size_t i = 0; i < arity(); i++) {
+        operand(i).node().collect_variables(variables);
+    }
+}
+
+template<typename Num>
+std::uint64_t ExpressionTempl<Num>::signature() const {
+    const std::uint64_t computed = std::uint64_t(1) << 63;
+    std::uint64_t res = _signature.load(std::memory_order_relaxed);
+    if (res & computed) {
+        return res & ~computed;
+    }
+    // Operands first, so compute_signature() only reads cached values.
+    std::vector<const ExpressionTempl<Num> *> stack = {this};
+    while (!stack.empty()) {
+        const ExpressionTempl<Num> *node = stack.back();
+        bool ready = true;
+        for (std::size_t i = 0; i < stored_arity(*node); i++) {
+            const ExpressionTempl<Num> &child = stored_operand(*node, i).node();
+            if (!(child._signature.load(std::memory_order_relaxed) & computed)) {
+                stack.push_back(&child);
+                ready = false;
+            }
+        }
+        if (!ready) continue;
+        stack.pop_back();
+        node->_signature.store(node->compute_signature() | computed, std::memory_order_relaxed);
+    }
+    return _signature.load(std::memory_order_relaxed) & ~computed;
+}
+
+template<typename Num>
+std::uint64_t ExpressionTempl<Num>::compute_signature() const {
+    std::uint64_t res = 0;
+    for (std::size_t i = 0; i < arity(); i++) {
+        res |= operand(i).node().signature();
+    }
+    return res;
+}
+
+template<typename Num>
+std::uint64_t ExpressionTempl<Num>::hash() const {
+    return _hash;
+}
+
+template<typename Num>
+void ExpressionTempl<Num>::seal(std::uint64_t data) {
+    std::uint64_t res = hash_combine(static_cast<std::uint64_t>(kind()), data);
+    for (std::size_t i = 0; i < stored_arity(*this); i++) {
+        res = hash_combine(res, stored_operand(*this, i).node()._hash);
+    }
+    _hash = res;
+}
+
+template<typename Num>
+bool ExpressionTempl<Num>::same_data(const ExpressionTempl<Num> &other) const {
+    return true;
+}
+
+
+template<typename Num>
+Value<Num>::Value(Num val) : _value(val) {
+    this->seal(number_hash(_value));
+}
 
 template<typename Num>
 Num Value<Num>::eval(std::map<std::string, Num> substitution) const {
@@ -40,7 +512,7 @@ std::string Value<Num>::to_string() const {
 
 template<typename Num>
 Expression<Num> Value<Num>::sub(std::map<std::string, Num> substitution) const {
-    return Expression<Num>(_value);
+    return Expression<Num>(NodePtr<Num>(this));
 }
 
 template<typename Num>
@@ -48,15 +520,38 @@ Expression<Num> Value<Num>::dif(std::string substitution) const {
     return Expression<Num>(0);
 }
 
+template<typename Num>
+std::pair<Num, Num> Value<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                         const std::string &var) const {
+    return {_value, Num(0)};
+}
+
+template<typename Num>
+NodeKind Value<Num>::kind() const {
+    return NodeKind::Value;
+}
+
+template<typename Num>
+const Num &Value<Num>::value() const {
+    return _value;
+}
+
+template<typename Num>
+bool Value<Num>::same_data(const ExpressionTempl<Num> &other) const {
+    return same_number(_value, static_cast<const Value<Num> &>(other)._value);
+}
+
 
 template<typename Num>
-Variable<Num>::Variable(std::string name) : _name(name) {}
+Variable<Num>::Variable(std::string name) : _name(std::move(name)) {
+    this->seal(std::hash<std::string>()(_name));
+}
 
 template<typename Num>
 Num Variable<Num>::eval(std::map<std::string, Num> substitution) const {
     auto it = substitution.find(_name);
     if (it == substitution.end()) {
-        std::cout << "mistake";
+        throw std::out_of_range("no value for variable " + _name);
     }
     return it->second;
 }
@@ -68,7 +563,7 @@ template<typename Num>
 Expression<Num> Variable<Num>::sub(std::map<std::string, Num> substitution) const {
     auto it = substitution.find(_name);
     if (it == substitution.end()) {
-        return Expression<Num>(_name);
+        return Expression<Num>(NodePtr<Num>(this));
     }
     return Expression<Num>(it->second);
 }
@@ -81,28 +576,61 @@ Expression<Num> Variable<Num>::dif(std::string substitution) const {
     return Expression<Num>(0);
 }
 
+template<typename Num>
+std::pair<Num, Num> Variable<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                            const std::string &var) const {
+    auto it = substitution.find(_name);
+    if (it == substitution.end()) {
+        throw std::out_of_range("no value for variable " + _name);
+    }
+    return {it->second, Num(var == _name ? 1 : 0)};
+}
 
 template<typename Num>
+NodeKind Variable<Num>::kind() const {
+    return NodeKind::Variable;
+}
 
-AddExpr<Num>::AddExpr(Expression<Num> lhs, Expression<Num> rhs) : _lhs(lhs), _rhs(rhs) {}
+template<typename Num>
+const std::string &Variable<Num>::name() const {
+    return _name;
+}
+
+template<typename Num>
+bool Variable<Num>::same_data(const ExpressionTempl<Num> &other) const {
+    return _name == static_cast<const Variable<Num> &>(other)._name;
+}
+
+template<typename Num>
+void Variable<Num>::collect_variables(std::set<std::string> &variables) const {
+    variables.insert(_name);
+}
+
+template<typename Num>
+std::uint64_t Variable<Num>::compute_signature() const {
+    return variable_bit(_name);
+}
+
+
+template<typename Num>
+
+AddExpr<Num>::AddExpr(Expression<Num> lhs, Expression<Num> rhs) : _lhs(std::move(lhs)), _rhs(std::move(rhs)) {
+    this->seal();
+}
 
 template<typename Num>
 Num AddExpr<Num>::eval(std::map<std::string, Num> substitution) const {
-    Num left = _lhs.eval(substitution);
-    Num right = _rhs.eval(substitution);
-    return left + right;
+    return evaluate<Num>(*this, substitution, nullptr).first;
 }
 
 template<typename Num>
 std::string AddExpr<Num>::to_string() const {
-    return std::string("(") + _lhs.to_string() +
-           std::string(" + ") + _rhs.to_string() +
-           std::string(")");
+    return render<Num>(*this);
 }
 
 template<typename Num>
 Expression<Num> AddExpr<Num>::sub(std::map<std::string, Num> substitution) const {
-    return _lhs.sub(substitution) + _rhs.sub(substitution);
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
 }
 
 template<typename Num>
@@ -110,28 +638,50 @@ Expression<Num> AddExpr<Num>::dif(std::string substitution) const {
     return _lhs.dif(substitution) + _rhs.dif(substitution);
 }
 
+template<typename Num>
+std::pair<Num, Num> AddExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                           const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
+}
+
+template<typename Num>
+NodeKind AddExpr<Num>::kind() const {
+    return NodeKind::Add;
+}
+
+template<typename Num>
+std::size_t AddExpr<Num>::arity() const {
+    return 2;
+}
+
+template<typename Num>
+const Expression<Num> &AddExpr<Num>::operand(std::size_t index) const {
+    if (index > 1) {
+        throw std::out_of_range("AddExpr has two operands");
+    }
+    return index == 0 ? _lhs : _rhs;
+}
+
 
 template<typename Num>
-MulExpr<Num>::MulExpr(Expression<Num> lhs, Expression<Num> rhs) : _lhs(lhs), _rhs(rhs) {}
+MulExpr<Num>::MulExpr(Expression<Num> lhs, Expression<Num> rhs) : _lhs(std::move(lhs)), _rhs(std::move(rhs)) {
+    this->seal();
+}
 
 
 template<typename Num>
 Num MulExpr<Num>::eval(std::map<std::string, Num> substitution) const {
-    Num left = _lhs.eval(substitution);
-    Num right = _rhs.eval(substitution);
-    return left * right;
+    return evaluate<Num>(*this, substitution, nullptr).first;
 }
 
 template<typename Num>
 std::string MulExpr<Num>::to_string() const {
-    return std::string("(") + _lhs.to_string() +
-           std::string(" * ") + _rhs.to_string() +
-           std::string(")");
+    return render<Num>(*this);
 }
 
 template<typename Num>
 Expression<Num> MulExpr<Num>::sub(std::map<std::string, Num> substitution) const {
-    return _lhs.sub(substitution) * _rhs.sub(substitution);
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
 }
 
 template<typename Num>
@@ -139,27 +689,49 @@ Expression<Num> MulExpr<Num>::dif(std::string substitution) const {
     return _lhs * _rhs.dif(substitution) + _lhs.dif(substitution) * _rhs;
 }
 
+template<typename Num>
+std::pair<Num, Num> MulExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                           const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
+}
+
+template<typename Num>
+NodeKind MulExpr<Num>::kind() const {
+    return NodeKind::Mul;
+}
 
 template<typename Num>
-SubExpr<Num>::SubExpr(Expression<Num> lhs, Expression<Num> rhs) : _lhs(lhs), _rhs(rhs) {}
+std::size_t MulExpr<Num>::arity() const {
+    return 2;
+}
+
+template<typename Num>
+const Expression<Num> &MulExpr<Num>::operand(std::size_t index) const {
+    if (index > 1) {
+        throw std::out_of_range("MulExpr has two operands");
+    }
+    return index == 0 ? _lhs : _rhs;
+}
+
+
+template<typename Num>
+SubExpr<Num>::SubExpr(Expression<Num> lhs, Expression<Num> rhs) : _lhs(std::move(lhs)), _rhs(std::move(rhs)) {
+    this->seal();
+}
 
 template<typename Num>
 Num SubExpr<Num>::eval(std::map<std::string, Num> substitution) const {
-    Num left = _lhs.eval(substitution);
-    Num right = _rhs.eval(substitution);
-    return left - right;
+    return evaluate<Num>(*this, substitution, nullptr).first;
 }
 
 template<typename Num>
 std::string SubExpr<Num>::to_string() const {
-    return std::string("(") + _lhs.to_string() +
-           std::string(" - ") + _rhs.to_string() +
-           std::string(")");
+    return render<Num>(*this);
 }
 
 template<typename Num>
 Expression<Num> SubExpr<Num>::sub(std::map<std::string, Num> substitution) const {
-    return _lhs.sub(substitution) - _rhs.sub(substitution);
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
 }
 
 template<typename Num>
@@ -168,23 +740,48 @@ Expression<Num> SubExpr<Num>::dif(std::string substitution) const {
 }
 
 template<typename Num>
-LnExpr<Num>::LnExpr(Expression<Num> content) : _content(content) {}
+std::pair<Num, Num> SubExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                           const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
+}
+
+template<typename Num>
+NodeKind SubExpr<Num>::kind() const {
+    return NodeKind::Sub;
+}
+
+template<typename Num>
+std::size_t SubExpr<Num>::arity() const {
+    return 2;
+}
+
+template<typename Num>
+const Expression<Num> &SubExpr<Num>::operand(std::size_t index) const {
+    if (index > 1) {
+        throw std::out_of_range("SubExpr has two operands");
+    }
+    return index == 0 ? _lhs : _rhs;
+}
+
+template<typename Num>
+LnExpr<Num>::LnExpr(Expression<Num> content) : _content(std::move(content)) {
+    this->seal();
+}
 
 
 template<typename Num>
 Num LnExpr<Num>::eval(std::map<std::string, Num> substitution) const {
-    return std::log(_content.eval(substitution));
+    return evaluate<Num>(*this, substitution, nullptr).first;
 }
 
 template<typename Num>
 std::string LnExpr<Num>::to_string() const {
-    return std::string("ln(") + _content.to_string() +
-           std::string(")");
+    return render<Num>(*this);
 }
 
 template<typename Num>
 Expression<Num> LnExpr<Num>::sub(std::map<std::string, Num> substitution) const {
-    return _content.sub(substitution).ln();
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
 }
 
 template<typename Num>
@@ -193,79 +790,151 @@ Expression<Num> LnExpr<Num>::dif(std::string substitution) const {
 }
 
 template<typename Num>
-PowExpr<Num>::PowExpr(Expression<Num> base, Expression<Num> exp) : _base(base), _exp(exp) {}
+std::pair<Num, Num> LnExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                          const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
+}
+
+template<typename Num>
+NodeKind LnExpr<Num>::kind() const {
+    return NodeKind::Ln;
+}
+
+template<typename Num>
+std::size_t LnExpr<Num>::arity() const {
+    return 1;
+}
+
+template<typename Num>
+const Expression<Num> &LnExpr<Num>::operand(std::size_t index) const {
+    if (index != 0) {
+        throw std::out_of_range("LnExpr has one operand");
+    }
+    return _content;
+}
+
+template<typename Num>
+PowExpr<Num>::PowExpr(Expression<Num> base, Expression<Num> exp) : _base(std::move(base)), _exp(std::move(exp)) {
+    this->seal();
+}
 
 template<typename Num>
 Num PowExpr<Num>::eval(std::map<std::string, Num> substitution) const {
-    Num left = _base.eval(substitution);
-    Num right = _exp.eval(substitution);
-    return std::pow(left, right);
+    return evaluate<Num>(*this, substitution, nullptr).first;
 }
 
 template<typename Num>
 std::string PowExpr<Num>::to_string() const {
-    return std::string("(") + _base.to_string() +
-           std::string(" ^ ") + _exp.to_string() +
-           std::string(")");
+    return render<Num>(*this);
 }
 
 template<typename Num>
 Expression<Num> PowExpr<Num>::sub(std::map<std::string, Num> substitution) const {
-    return _base.sub(substitution) ^ _exp.sub(substitution);
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
 }
 
 template<typename Num>
 Expression<Num> PowExpr<Num>::dif(std::string substitution) const {
-    return _exp * (_base ^ (_exp - Expression<Num>(1))) * _base.dif(substitution) +
-           (_base ^ _exp) * _base.ln() * _exp.dif(substitution);
+    Expression<Num> power_rule = _exp * (_base ^ (_exp - Expression<Num>(1))) * _base.dif(substitution);
+    if (!_exp.variables().count(substitution)) {
+        return power_rule;
+    }
+    return power_rule + (_base ^ _exp) * _base.ln() * _exp.dif(substitution);
+}
+
+template<typename Num>
+std::pair<Num, Num> PowExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                           const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
+}
+
+template<typename Num>
+NodeKind PowExpr<Num>::kind() const {
+    return NodeKind::Pow;
+}
+
+template<typename Num>
+std::size_t PowExpr<Num>::arity() const {
+    return 2;
+}
+
+template<typename Num>
+const Expression<Num> &PowExpr<Num>::operand(std::size_t index) const {
+    if (index > 1) {
+        throw std::out_of_range("PowExpr has two operands");
+    }
+    return index == 0 ? _base : _exp;
 }
 
 
 template<typename Num>
-DivExpr<Num>::DivExpr(Expression<Num> lhs, Expression<Num> rhs) : _lhs(lhs), _rhs(rhs) {}
+DivExpr<Num>::DivExpr(Expression<Num> lhs, Expression<Num> rhs) : _lhs(std::move(lhs)), _rhs(std::move(rhs)) {
+    this->seal();
+}
 
 template<typename Num>
 Num DivExpr<Num>::eval(std::map<std::string, Num> substitution) const {
-    Num left = _lhs.eval(substitution);
-    Num right = _rhs.eval(substitution);
-    return left / right;
+    return evaluate<Num>(*this, substitution, nullptr).first;
 }
 
 template<typename Num>
 std::string DivExpr<Num>::to_string() const {
-    return std::string("(") + _lhs.to_string() +
-           std::string(" / ") + _rhs.to_string() +
-           std::string(")");
+    return render<Num>(*this);
 }
 
 template<typename Num>
 Expression<Num> DivExpr<Num>::sub(std::map<std::string, Num> substitution) const {
-    return _lhs.sub(substitution) / _rhs.sub(substitution);
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
 }
 
 template<typename Num>
 Expression<Num> DivExpr<Num>::dif(std::string substitution) const {
-    return _lhs.dif(substitution) * _rhs - _lhs * _rhs.dif(substitution) / (_rhs ^ Expression<Num>(2));
+    return (_lhs.dif(substitution) * _rhs - _lhs * _rhs.dif(substitution)) / (_rhs ^ Expression<Num>(2));
+}
+
+template<typename Num>
+std::pair<Num, Num> DivExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                           const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
 }
 
+template<typename Num>
+NodeKind DivExpr<Num>::kind() const {
+    return NodeKind::Div;
+}
 
 template<typename Num>
-SinExpr<Num>::SinExpr(Expression<Num> content) : _content(content) {}
+std::size_t DivExpr<Num>::arity() const {
+    return 2;
+}
+
+template<typename Num>
+const Expression<Num> &DivExpr<Num>::operand(std::size_t index) const {
+    if (index > 1) {
+        throw std::out_of_range("DivExpr has two operands");
+    }
+    return index == 0 ? _lhs : _rhs;
+}
+
+
+template<typename Num>
+SinExpr<Num>::SinExpr(Expression<Num> content) : _content(std::move(content)) {
+    this->seal();
+}
 
 template<typename Num>
 Num SinExpr<Num>::eval(std::map<std::string, Num> substitution) const {
-    return std::sin(_content.eval(substitution));
+    return evaluate<Num>(*this, substitution, nullptr).first;
 }
 
 template<typename Num>
 std::string SinExpr<Num>::to_string() const {
-    return std::string("sin(") + _content.to_string() +
-           std::string(")");
+    return render<Num>(*this);
 }
 
 template<typename Num>
 Expression<Num> SinExpr<Num>::sub(std::map<std::string, Num> substitution) const {
-    return _content.sub(substitution).sin();
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
 }
 
 template<typename Num>
@@ -273,49 +942,99 @@ Expression<Num> SinExpr<Num>::dif(std::string substitution) const {
     return _content.cos() * _content.dif(substitution);
 }
 
+template<typename Num>
+std::pair<Num, Num> SinExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                           const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
+}
+
+template<typename Num>
+NodeKind SinExpr<Num>::kind() const {
+    return NodeKind::Sin;
+}
+
+template<typename Num>
+std::size_t SinExpr<Num>::arity() const {
+    return 1;
+}
+
+template<typename Num>
+const Expression<Num> &SinExpr<Num>::operand(std::size_t index) const {
+    if (index != 0) {
+        throw std::out_of_range("SinExpr has one operand");
+    }
+    return _content;
+}
+
 
 template<typename Num>
-CosExpr<Num>::CosExpr(Expression<Num> content) : _content(content) {}
+CosExpr<Num>::CosExpr(Expression<Num> content) : _content(std::move(content)) {
+    this->seal();
+}
 
 template<typename Num>
 Num CosExpr<Num>::eval(std::map<std::string, Num> substitution) const {
-    return std::cos(_content.eval(substitution));
+    return evaluate<Num>(*this, substitution, nullptr).first;
 }
 
 template<typename Num>
 std::string CosExpr<Num>::to_string() const {
-    return std::string("cos(") + _content.to_string() +
-           std::string(")");
+    return render<Num>(*this);
 }
 
 template<typename Num>
 Expression<Num> CosExpr<Num>::sub(std::map<std::string, Num> substitution) const {
-    return _content.sub(substitution).cos();
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
 }
 
 template<typename Num>
 Expression<Num> CosExpr<Num>::dif(std::string substitution) const {
-    return _content.sin() * _content.dif(substitution);
+    return Expression<Num>(-1) * _content.sin() * _content.dif(substitution);
+}
+
+template<typename Num>
+std::pair<Num, Num> CosExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                           const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
 }
 
+template<typename Num>
+NodeKind CosExpr<Num>::kind() const {
+    return NodeKind::Cos;
+}
 
 template<typename Num>
-ExpExpr<Num>::ExpExpr(Expression<Num> content) : _content(content) {}
+std::size_t CosExpr<Num>::arity() const {
+    return 1;
+}
+
+template<typename Num>
+const Expression<Num> &CosExpr<Num>::operand(std::size_t index) const {
+    if (index != 0) {
+        throw std::out_of_range("CosExpr has one operand");
+    }
+    return _content;
+}
+
+
+template<typename Num>
+ExpExpr<Num>::ExpExpr(Expression<Num> content) : _content(std::move(content)) {
+    this->seal();
+}
 
 template<typename Num>
 Num ExpExpr<Num>::eval(std::map<std::string, Num> substitution) const {
-    return std::exp(_content.eval(substitution));
+    return evaluate<Num>(*this, substitution, nullptr).first;
 }
 
 template<typename Num>
 std::string ExpExpr<Num>::to_string() const {
-    return std::string("exp(") + _content.to_string() +
-           std::string(")");
+    return render<Num>(*this);
 }
 
 template<typename Num>
 Expression<Num> ExpExpr<Num>::sub(std::map<std::string, Num> substitution) const {
-    return _content.sub(substitution).exp();
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
 }
 
 template<typename Num>
@@ -323,6 +1042,331 @@ Expression<Num> ExpExpr<Num>::dif(std::string substitution) const {
     return _content.exp() * _content.dif(substitution);
 }
 
+template<typename Num>
+std::pair<Num, Num> ExpExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                           const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
+}
+
+template<typename Num>
+NodeKind ExpExpr<Num>::kind() const {
+    return NodeKind::Exp;
+}
+
+template<typename Num>
+std::size_t ExpExpr<Num>::arity() const {
+    return 1;
+}
+
+template<typename Num>
+const Expression<Num> &ExpExpr<Num>::operand(std::size_t index) const {
+    if (index != 0) {
+        throw std::out_of_range("ExpExpr has one operand");
+    }
+    return _content;
+}
+
+
+template<typename Num>
+DifExpr<Num>::DifExpr(Expression<Num> content, std::string var) : _content(std::move(content)), _var(std::move(var)) {
+    this->seal(std::hash<std::string>()(_var));
+}
+
+template<typename Num>
+DifExpr<Num>::~DifExpr() {
+    DerivativeMemo<Num>::instance().erase(&_content.node(), _var, this);
+}
+
+template<typename Num>
+Num DifExpr<Num>::eval(std::map<std::string, Num> substitution) const {
+    return _content.eval_dif(substitution, _var).second;
+}
+
+template<typename Num>
+std::string DifExpr<Num>::to_string() const {
+    return render<Num>(*this);
+}
+
+template<typename Num>
+Expression<Num> DifExpr<Num>::sub(std::map<std::string, Num> substitution) const {
+    return expand().sub(substitution);
+}
+
+template<typename Num>
+Expression<Num> DifExpr<Num>::dif(std::string substitution) const {
+    return expand().dif(substitution);
+}
+
+template<typename Num>
+std::pair<Num, Num> DifExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                           const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
+}
+
+template<typename Num>
+NodeKind DifExpr<Num>::kind() const {
+    return NodeKind::Dif;
+}
+
+template<typename Num>
+std::size_t DifExpr<Num>::arity() const {
+    return 1;
+}
+
+template<typename Num>
+const Expression<Num> &DifExpr<Num>::operand(std::size_t index) const {
+    if (index != 0) {
+        throw std::out_of_range("DifExpr has one operand");
+    }
+    return expand();
+}
+
+template<typename Num>
+void DifExpr<Num>::collect_variables(std::set<std::string> &variables) const {
+    _content.node().collect_variables(variables);
+}
+
+template<typename Num>
+std::uint64_t DifExpr<Num>::compute_signature() const {
+    return _content.node().signature();
+}
+
+template<typename Num>
+const std::set<std::string> &DifExpr<Num>::content_variables() const {
+    return _content_variables.get([this] { return _content.variables(); });
+}
+
+// simplify() replaces every DifExpr by its expansion, so the cached result
+// never refers back to this node.
+template<typename Num>
+const Expression<Num> &DifExpr<Num>::simplified() const {
+    return _simplified.get([this] { return Expression<Num>(NodePtr<Num>(this)).simplify(); });
+}
+
+template<typename Num>
+const Expression<Num> &DifExpr<Num>::content() const {
+    return _content;
+}
+
+template<typename Num>
+const std::string &DifExpr<Num>::var() const {
+    return _var;
+}
+
+template<typename Num>
+bool DifExpr<Num>::same_data(const ExpressionTempl<Num> &other) const {
+    return _var == static_cast<const DifExpr<Num> &>(other)._var;
+}
+
+// One level of the chain rule; the operands' derivatives inside stay lazy.
+template<typename Num>
+const Expression<Num> &DifExpr<Num>::expand() const {
+    return _expanded.get([this] { return _content.expand_dif(_var); });
+}
+
+
+template<typename Num>
+SumExpr<Num>::SumExpr(std::vector<Expression<Num>> terms, std::vector<bool> negated, bool compensated)
+        : _terms(std::move(terms)), _negated(std::move(negated)), _compensated(compensated) {
+    if (_terms.empty() || _terms.size() != _negated.size()) {
+        throw std::invalid_argument("SumExpr needs one sign per term");
+    }
+    this->seal(flags_hash(_negated, _compensated));
+}
+
+template<typename Num>
+Num SumExpr<Num>::eval(std::map<std::string, Num> substitution) const {
+    return evaluate<Num>(*this, substitution, nullptr).first;
+}
+
+template<typename Num>
+std::string SumExpr<Num>::to_string() const {
+    return render<Num>(*this);
+}
+
+template<typename Num>
+Expression<Num> SumExpr<Num>::sub(std::map<std::string, Num> substitution) const {
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
+}
+
+template<typename Num>
+Expression<Num> SumExpr<Num>::dif(std::string substitution) const {
+    std::vector<Expression<Num>> terms;
+    for (const auto &term : _terms) {
+        terms.push_back(term.dif(substitution));
+    }
+    return Expression<Num>(make_node<SumExpr<Num>>(std::move(terms), _negated, _compensated));
+}
+
+template<typename Num>
+std::pair<Num, Num> SumExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                           const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
+}
+
+template<typename Num>
+NodeKind SumExpr<Num>::kind() const {
+    return NodeKind::Sum;
+}
+
+template<typename Num>
+std::size_t SumExpr<Num>::arity() const {
+    return _terms.size();
+}
+
+template<typename Num>
+const Expression<Num> &SumExpr<Num>::operand(std::size_t index) const {
+    return _terms.at(index);
+}
+
+template<typename Num>
+bool SumExpr<Num>::negated(std::size_t index) const {
+    return _negated[index];
+}
+
+template<typename Num>
+bool SumExpr<Num>::compensated() const {
+    return _compensated;
+}
+
+template<typename Num>
+bool SumExpr<Num>::same_data(const ExpressionTempl<Num> &other) const {
+    const auto &sum = static_cast<const SumExpr<Num> &>(other);
+    return _negated == sum._negated && _compensated == sum._compensated;
+}
+
+namespace {
+
+// Pairwise reduction, so the tree is log2(n) deep.
+template<typename Num>
+Expression<Num> balanced(const std::vector<Expression<Num>> &items, std::size_t begin, std::size_t end, bool add) {
+    if (end - begin == 1) {
+        return items[begin];
+    }
+    std::size_t middle = begin + (end - begin) / 2;
+    Expression<Num> lhs = balanced(items, begin, middle, add);
+    Expression<Num> rhs = balanced(items, middle, end, add);
+    return add ? lhs + rhs : lhs * rhs;
+}
+
+template<typename Num>
+Expression<Num> lower(const std::vector<Expression<Num>> &items, const std::vector<bool> &flipped, bool add) {
+    std::vector<Expression<Num>> kept, removed;
+    for (std::size_t i = 0; i < items.size(); i++) {
+        (flipped[i] ? removed : kept).push_back(items[i]);
+    }
+    Expression<Num> res = kept.empty() ? Expression<Num>(add ? 0 : 1) : balanced(kept, 0, kept.size(), add);
+    if (removed.empty()) {
+        return res;
+    }
+    Expression<Num> rest = balanced(removed, 0, removed.size(), add);
+    return add ? res - rest : res / rest;
+}
+
+}
+
+template<typename Num>
+const Expression<Num> &SumExpr<Num>::lowered() const {
+    return _lowered.get([this] { return lower(_terms, _negated, true); });
+}
+
+
+template<typename Num>
+ProductExpr<Num>::ProductExpr(std::vector<Expression<Num>> factors, std::vector<bool> inverted)
+        : _factors(std::move(factors)), _inverted(std::move(inverted)) {
+    if (_factors.empty() || _factors.size() != _inverted.size()) {
+        throw std::invalid_argument("ProductExpr needs one flag per factor");
+    }
+    this->seal(flags_hash(_inverted, false));
+}
+
+template<typename Num>
+Num ProductExpr<Num>::eval(std::map<std::string, Num> substitution) const {
+    return evaluate<Num>(*this, substitution, nullptr).first;
+}
+
+template<typename Num>
+std::string ProductExpr<Num>::to_string() const {
+    return render<Num>(*this);
+}
+
+template<typename Num>
+Expression<Num> ProductExpr<Num>::sub(std::map<std::string, Num> substitution) const {
+    return Expression<Num>(NodePtr<Num>(this)).sub(substitution);
+}
+
+// Product rule over prefix and suffix products, which are shared between the
+// terms, so the derivative stays linear in the number of factors.
+template<typename Num>
+Expression<Num> ProductExpr<Num>::dif(std::string substitution) const {
+    std::size_t n = _factors.size();
+    std::vector<Expression<Num>> factors, slopes;
+    for (std::size_t i = 0; i < n; i++) {
+        const Expression<Num> &factor = _factors[i];
+        if (_inverted[i]) {
+            factors.push_back(Expression<Num>(1) / factor);
+            slopes.push_back(Expression<Num>(0) - factor.dif(substitution) / (factor ^ Expression<Num>(2)));
+        } else {
+            factors.push_back(factor);
+            slopes.push_back(factor.dif(substitution));
+        }
+    }
+    std::vector<Expression<Num>> suffix(n, Expression<Num>(1));
+    for (std::size_t i = n - 1; i-- > 0;) {
+        suffix[i] = i + 2 == n ? factors[i + 1] : factors[i + 1] * suffix[i + 1];
+    }
+    std::vector<Expression<Num>> terms;
+    Expression<Num> prefix = factors[0];
+    for (std::size_t i = 0; i < n; i++) {
+        Expression<Num> term = slopes[i];
+        if (i > 0) {
+            term = prefix * term;
+            prefix = prefix * factors[i];
+        }
+        if (i + 1 < n) {
+            term = term * suffix[i];
+        }
+        terms.push_back(term);
+    }
+    return Expression<Num>(make_node<SumExpr<Num>>(std::move(terms), std::vector<bool>(n)));
+}
+
+template<typename Num>
+std::pair<Num, Num> ProductExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                               const std::string &var) const {
+    return evaluate<Num>(*this, substitution, &var);
+}
+
+template<typename Num>
+NodeKind ProductExpr<Num>::kind() const {
+    return NodeKind::Product;
+}
+
+template<typename Num>
+std::size_t ProductExpr<Num>::arity() const {
+    return _factors.size();
+}
+
+template<typename Num>
+const Expression<Num> &ProductExpr<Num>::operand(std::size_t index) const {
+    return _factors.at(index);
+}
+
+template<typename Num>
+bool ProductExpr<Num>::inverted(std::size_t index) const {
+    return _inverted[index];
+}
+
+template<typename Num>
+bool ProductExpr<Num>::same_data(const ExpressionTempl<Num> &other) const {
+    return _inverted == static_cast<const ProductExpr<Num> &>(other)._inverted;
+}
+
+template<typename Num>
+const Expression<Num> &ProductExpr<Num>::lowered() const {
+    return _lowered.get([this] { return lower(_factors, _inverted, false); });
+}
+
 
 inline std::string space_deleter(std::string var) {
     std::string res = std::string("");
@@ -332,9 +1376,14 @@ inline std::string space_deleter(std::string var) {
     return res;
 }
 
+// Literals are digit strings, so strtod cannot fail; unlike stod it rounds
+// an out-of-range literal to infinity instead of throwing.
 template<typename Num>
 inline Num parse_number(const std::string var, bool with_i) {
-    return std::stod(var);;
+    if (with_i) {
+        throw std::invalid_argument("imaginary literal " + var + "i in a real expression");
+    }
+    return std::strtod(var.c_str(), nullptr);
 }
 
 template<>
@@ -343,76 +1392,156 @@ inline complex parse_number<complex>(const std::string var, bool with_i) {
         return complex(0, 1);
     }
     if (with_i)
-        return complex(0, std::stod(var));
+        return complex(0, std::strtod(var.c_str(), nullptr));
     else
-        return complex(std::stod(var), 0);
+        return complex(std::strtod(var.c_str(), nullptr), 0);
 }
 
 
+namespace {
+
 template<typename Num>
-std::shared_ptr<ExpressionTempl<Num>> parce(std::string var) {
-    int scobe = 0;
-    for (int i = var.size() - 1; i >= 0; i -= 1) {
-        if (var[i] == ')')
-            scobe += 1;
-        if (var[i] == '(')
-            scobe -= 1;
-        if (var[i] == '+' and scobe == 0) {
-            return std::make_shared<AddExpr<Num>>(Expression<Num>(var.substr(0, i)),
-                                                  Expression<Num>(var.substr(i + 1, var.size())));
-        }
-        if (var[i] == '-' and scobe == 0)
-            return std::make_shared<SubExpr<Num>>(Expression<Num>(var.substr(0, i)),
-                                                  Expression<Num>(var.substr(i + 1, var.size())));
+NodePtr<Num> parse_atom(const std::string &var) {
+    // An imaginary literal is digits followed by i; other names ending in i
+    // (pi, xi) are variables.
+    if (var[var.size() - 1] == 'i' && var.find_first_not_of("0123456789") == var.size() - 1) {
+        return make_node<Value<Num>>(parse_number<Num>(var.substr(0, var.size() - 1), true));
     }
-
-    for (int i = var.size() - 1; i >= 0; i -= 1) {
-        if (var[i] == ')')
-            scobe += 1;
-        if (var[i] == '(')
-            scobe -= 1;
-        if (var[i] == '*' and scobe == 0)
-            return std::make_shared<MulExpr<Num>>(Expression<Num>(var.substr(0, i)),
-                                                  Expression<Num>(var.substr(i + 1, var.size())));
-        if (var[i] == '/' and scobe == 0)
-            return std::make_shared<DivExpr<Num>>(Expression<Num>(var.substr(0, i)),
-                                                  Expression<Num>(var.substr(i + 1, var.size())));
+    if (var.find_first_not_of("0123456789") == var.npos) {
+        return make_node<Value<Num>>(parse_number<Num>(var, false));
     }
-    for (int i = var.size() - 1; i >= 0; i -= 1) {
-        if (var[i] == ')')
-            scobe += 1;
-        if (var[i] == '(')
-            scobe -= 1;
-        if (var[i] == '^' and scobe == 0)
-            return std::make_shared<PowExpr<Num>>(Expression<Num>(var.substr(0, i)),
-                                                  Expression<Num>(var.substr(i + 1, var.size())));
+    return make_node<Variable<Num>>(var);
+}
+
+int precedence(char op) {
+    switch (op) {
+        case '+':
+        case '-':
+            return 1;
+        case '*':
+        case '/':
+            return 2;
+        case '^':
+            return 3;
+        default:
+            return 0;
     }
-    if (var[0] == '(')
-
-        return parce<Num>(var.substr(1, var.size() - 2));
-    if (var.substr(0, 3) == "sin")
-        return std::make_shared<SinExpr<Num>>(Expression<Num>(var.substr(4, var.size() - 5)));
-    if (var.substr(0, 3) == "cos")
-        return std::make_shared<CosExpr<Num>>(Expression<Num>(var.substr(4, var.size() - 5)));
-    if (var.substr(0, 3) == "exp")
-        return std::make_shared<ExpExpr<Num>>(Expression<Num>(var.substr(4, var.size() - 5)));
-    if (var.substr(0, 2) == "ln")
-        return std::make_shared<LnExpr<Num>>(Expression<Num>(var.substr(3, var.size() - 4)));
-
-
-    if (var[var.size() - 1] == 'i') {
+}
 
-        return std::make_shared<Value<Num>>(parse_number<Num>(var.substr(0, var.size() - 1), true));
+}
 
+// Operator precedence parse over explicit operand and operator stacks, in
+// one pass. Binary operators are left-associative; sin, cos, exp and ln are
+// kept on the operator stack until their closing parenthesis.
+template<typename Num>
+NodePtr<Num> parce(std::string var) {
+    if (var.empty()) {
+        throw std::invalid_argument("empty expression");
     }
-
-
-    if (!var.empty() && (var.find_first_not_of("0123456789") == var.npos)) {
-        return std::make_shared<Value<Num>>(parse_number<Num>(var.substr(0, var.size()), false));;
+    std::vector<NodePtr<Num>> operands;
+    std::vector<char> operators;
+    auto reduce = [&]() {
+        char op = operators.back();
+        operators.pop_back();
+        Expression<Num> rhs(std::move(operands.back()));
+        operands.pop_back();
+        Expression<Num> lhs(std::move(operands.back()));
+        operands.pop_back();
+        switch (op) {
+            case '+':
+                operands.push_back(make_node<AddExpr<Num>>(std::move(lhs), std::move(rhs)));
+                break;
+            case '-':
+                operands.push_back(make_node<SubExpr<Num>>(std::move(lhs), std::move(rhs)));
+                break;
+            case '*':
+                operands.push_back(make_node<MulExpr<Num>>(std::move(lhs), std::move(rhs)));
+                break;
+            case '/':
+                operands.push_back(make_node<DivExpr<Num>>(std::move(lhs), std::move(rhs)));
+                break;
+            default:
+                operands.push_back(make_node<PowExpr<Num>>(std::move(lhs), std::move(rhs)));
+        }
+    };
+    const char *functions[] = {"sin", "cos", "exp", "ln"};
+    bool expect_operand = true;
+    std::size_t i = 0;
+    while (i < var.size()) {
+        char c = var[i];
+        if (expect_operand) {
+            if (c == '(') {
+                operators.push_back('(');
+                i++;
+                continue;
+            }
+            bool function = false;
+            for (const char *name : functions) {
+                std::size_t length = std::char_traits<char>::length(name);
+                if (var.compare(i, length, name) == 0 && i + length < var.size() && var[i + length] == '(') {
+                    operators.push_back(name[0]);
+                    operators.push_back('(');
+                    i += length + 1;
+                    function = true;
+                    break;
+                }
+            }
+            if (function) continue;
+            std::size_t end = std::min(var.find_first_of("+-*/^()", i), var.size());
+            if (end == i) {
+                throw std::invalid_argument("missing operand in " + var);
+            }
+            operands.push_back(parse_atom<Num>(var.substr(i, end - i)));
+            expect_operand = false;
+            i = end;
+        } else if (c == ')') {
+            while (!operators.empty() && operators.back() != '(') {
+                reduce();
+            }
+            if (operators.empty()) {
+                throw std::invalid_argument("unbalanced parentheses in " + var);
+            }
+            operators.pop_back();
+            if (!operators.empty() && precedence(operators.back()) == 0 && operators.back() != '(') {
+                Expression<Num> content(std::move(operands.back()));
+                operands.pop_back();
+                switch (operators.back()) {
+                    case 's':
+                        operands.push_back(make_node<SinExpr<Num>>(std::move(content)));
+                        break;
+                    case 'c':
+                        operands.push_back(make_node<CosExpr<Num>>(std::move(content)));
+                        break;
+                    case 'e':
+                        operands.push_back(make_node<ExpExpr<Num>>(std::move(content)));
+                        break;
+                    default:
+                        operands.push_back(make_node<LnExpr<Num>>(std::move(content)));
+                }
+                operators.pop_back();
+            }
+            i++;
+        } else if (precedence(c)) {
+            while (!operators.empty() && precedence(operators.back()) >= precedence(c)) {
+                reduce();
+            }
+            operators.push_back(c);
+            expect_operand = true;
+            i++;
+        } else {
+            throw std::invalid_argument(std::string("unexpected '") + c + "' in " + var);
+        }
     }
-
-    return std::make_shared<Variable<Num>>(var);
-
+    if (expect_operand) {
+        throw std::invalid_argument("missing operand in " + var);
+    }
+    while (!operators.empty()) {
+        if (precedence(operators.back()) == 0) {
+            throw std::invalid_argument("unbalanced parentheses in " + var);
+        }
+        reduce();
+    }
+    return std::move(operands.back());
 }
 
 
@@ -424,22 +1553,22 @@ Expression<Num>::Expression(const std::string &var) {
 
 template<typename Num>
 Expression<Num>::Expression(Num var) {
-    _content = std::make_shared<Value<Num>>(var);
+    _content = make_node<Value<Num>>(var);
 }
 
 template<typename Num>
 Expression<Num>::Expression(int var) {
-    _content = std::make_shared<Value<Num>>((Num) var);
+    _content = make_node<Value<Num>>((Num) var);
 }
 
 template<typename Num>
 Expression<Num>::Expression(const Expression<Num> &expr): _content(expr._content) {}
 
 template<typename Num>
-Expression<Num>::Expression(Expression<Num> &&expr): _content(std::move(expr._content)) {}
+Expression<Num>::Expression(Expression<Num> &&expr) noexcept: _content(std::move(expr._content)) {}
 
 template<typename Num>
-Expression<Num>::Expression(std::shared_ptr<ExpressionTempl<Num>> content) : _content(content) {}
+Expression<Num>::Expression(NodePtr<Num> content) : _content(std::move(content)) {}
 
 template<typename Num>
 Expression<Num> &Expression<Num>::operator=(const Expression<Num> &rhs) {
@@ -448,76 +1577,377 @@ Expression<Num> &Expression<Num>::operator=(const Expression<Num> &rhs) {
 }
 
 template<typename Num>
-Expression<Num> &Expression<Num>::operator=(Expression<Num> &&rhs) {
+Expression<Num> &Expression<Num>::operator=(Expression<Num> &&rhs) noexcept {
     _content = std::move(rhs._content);
     return *this;
 }
 
 template<typename Num>
 Expression<Num> Expression<Num>::operator+(const Expression<Num> &rhs) const {
-    return Expression<Num>(std::make_shared<AddExpr<Num>>(*this, rhs));
+    return Expression<Num>(make_node<AddExpr<Num>>(*this, rhs));
 }
 
 template<typename Num>
 Expression<Num> Expression<Num>::operator-(const Expression<Num> &rhs) const {
-    return Expression<Num>(std::make_shared<SubExpr<Num>>(*this, rhs));
+    return Expression<Num>(make_node<SubExpr<Num>>(*this, rhs));
 }
 
 template<typename Num>
 Expression<Num> Expression<Num>::operator*(const Expression<Num> &rhs) const {
-    return Expression<Num>(std::make_shared<MulExpr<Num>>(*this, rhs));
+    return Expression<Num>(make_node<MulExpr<Num>>(*this, rhs));
 }
 
 template<typename Num>
 Expression<Num> Expression<Num>::operator/(const Expression<Num> &rhs) const {
-    return Expression<Num>(std::make_shared<DivExpr<Num>>(*this, rhs));
+    return Expression<Num>(make_node<DivExpr<Num>>(*this, rhs));
 }
 
 template<typename Num>
 Expression<Num> Expression<Num>::operator^(const Expression<Num> &rhs) const {
-    return Expression<Num>(std::make_shared<PowExpr<Num>>(*this, rhs));
+    return Expression<Num>(make_node<PowExpr<Num>>(*this, rhs));
 }
 
 template<typename Num>
 Expression<Num> Expression<Num>::sin() const {
-    return Expression<Num>(std::make_shared<SinExpr<Num>>(_content));
+    return Expression<Num>(make_node<SinExpr<Num>>(*this));
 }
 
 template<typename Num>
 Expression<Num> Expression<Num>::cos() const {
-    return Expression<Num>(std::make_shared<CosExpr<Num>>(_content));
+    return Expression<Num>(make_node<CosExpr<Num>>(*this));
 }
 
 template<typename Num>
 Expression<Num> Expression<Num>::ln() const {
-    return Expression<Num>(std::make_shared<LnExpr<Num>>(_content));
+    return Expression<Num>(make_node<LnExpr<Num>>(*this));
 }
 
 template<typename Num>
 Expression<Num> Expression<Num>::exp() const {
-    return Expression<Num>(std::make_shared<ExpExpr<Num>>(_content));
+    return Expression<Num>(make_node<ExpExpr<Num>>(*this));
 }
 
 template<typename Num>
 Num Expression<Num>::eval(std::map<std::string, Num> substitution) const {
-    return _content->eval(substitution);
+    return evaluate<Num>(*_content, substitution, nullptr).first;
+}
+
+template<typename Num>
+NodeKind Expression<Num>::kind() const {
+    return _content->kind();
+}
+
+template<typename Num>
+const ExpressionTempl<Num> &Expression<Num>::node() const {
+    return *_content;
+}
+
+template<typename Num>
+Expression<Num> Expression<Num>::rebuild(std::vector<Expression<Num>> operands) const {
+    switch (kind()) {
+        case NodeKind::Add:
+            return operands[0] + operands[1];
+        case NodeKind::Sub:
+            return operands[0] - operands[1];
+        case NodeKind::Mul:
+            return operands[0] * operands[1];
+        case NodeKind::Div:
+            return operands[0] / operands[1];
+        case NodeKind::Pow:
+            return operands[0] ^ operands[1];
+        case NodeKind::Ln:
+            return operands[0].ln();
+        case NodeKind::Sin:
+            return operands[0].sin();
+        case NodeKind::Cos:
+            return operands[0].cos();
+        case NodeKind::Exp:
+            return operands[0].exp();
+        case NodeKind::Dif:
+            return operands[0];
+        case NodeKind::Sum: {
+            const auto &sum = static_cast<const SumExpr<Num> &>(*_content);
+            std::vector<bool> negated;
+            for (std::size_t i = 0; i < operands.size(); i++) {
+                negated.push_back(sum.negated(i));
+            }
+            return Expression<Num>(make_node<SumExpr<Num>>(std::move(operands), std::move(negated), sum.compensated()));
+        }
+        case NodeKind::Product: {
+            const auto &product = static_cast<const ProductExpr<Num> &>(*_content);
+            std::vector<bool> inverted;
+            for (std::size_t i = 0; i < operands.size(); i++) {
+                inverted.push_back(product.inverted(i));
+            }
+            return Expression<Num>(make_node<ProductExpr<Num>>(std::move(operands), std::move(inverted)));
+        }
+        default:
+            return *this;
+    }
+}
+
+template<typename Num>
+std::uint64_t Expression<Num>::hash() const {
+    return _content->hash();
+}
+
+template<typename Num>
+bool Expression<Num>::operator==(const Expression<Num> &rhs) const {
+    using Pair = std::pair<const ExpressionTempl<Num> *, const ExpressionTempl<Num> *>;
+    struct PairHash {
+        std::size_t operator()(const Pair &pair) const {
+            return hash_combine(reinterpret_cast<std::uintptr_t>(pair.first),
+                                reinterpret_cast<std::uintptr_t>(pair.second));
+        }
+    };
+    // Pairs already compared are skipped, so shared subtrees are walked once.
+    std::unordered_set<Pair, PairHash> seen;
+    std::vector<Pair> stack = {{_content.get(), rhs._content.get()}};
+    while (!stack.empty()) {
+        auto [lhs, other] = stack.back();
+        stack.pop_back();
+        if (lhs == other) continue;
+        if (lhs->hash() != other->hash() || lhs->kind() != other->kind() ||
+            stored_arity(*lhs) != stored_arity(*other) || !lhs->same_data(*other)) {
+            return false;
+        }
+        if (!seen.insert({lhs, other}).second) continue;
+        for (std::size_t i = 0; i < stored_arity(*lhs); i++) {
+            stack.emplace_back(&stored_operand(*lhs, i).node(), &stored_operand(*other, i).node());
+        }
+    }
+    return true;
+}
+
+template<typename Num>
+bool Expression<Num>::operator!=(const Expression<Num> &rhs) const {
+    return !(*this == rhs);
+}
+
+template<typename Num>
+std::set<std::string> Expression<Num>::variables() const {
+    std::set<std::string> res;
+    std::unordered_set<const ExpressionTempl<Num> *> seen;
+    std::vector<const ExpressionTempl<Num> *> stack = {_content.get()};
+    while (!stack.empty()) {
+        const ExpressionTempl<Num> *node = stack.back();
+        stack.pop_back();
+        if (!seen.insert(node).second) continue;
+        if (node->kind() == NodeKind::Variable || node->kind() == NodeKind::Poly) {
+            node->collect_variables(res);
+            continue;
+        }
+        for (std::size_t i = 0; i < stored_arity(*node); i++) {
+            stack.push_back(&stored_operand(*node, i).node());
+        }
+    }
+    return res;
+}
+
+namespace {
+
+template<typename Num>
+bool is_value(const Expression<Num> &expr, Num value) {
+    return expr.kind() == NodeKind::Value && static_cast<const Value<Num> &>(expr.node()).value() == value;
+}
+
+}
+
+template<typename Num>
+Expression<Num> Expression<Num>::simplify() const {
+    auto leaf = [](const Expression<Num> &expr, Expression<Num> &res) {
+        return expr._content->arity() == 0;
+    };
+    auto combine = [](const Expression<Num> &expr, const std::vector<Expression<Num>> &operands) {
+        NodeKind k = expr.kind();
+        if (k == NodeKind::Dif) {
+            return operands[0];
+        }
+        bool constant = true;
+        bool same = true;
+        for (std::size_t i = 0; i < operands.size(); i++) {
+            constant = constant && operands[i].kind() == NodeKind::Value;
+            same = same && operands[i]._content == expr._content->operand(i)._content;
+        }
+        Expression<Num> res = same ? expr : expr.rebuild(operands);
+        if (constant) {
+            return Expression<Num>(res.eval({}));
+        }
+        const Expression<Num> &lhs = operands[0];
+        switch (k) {
+            case NodeKind::Add:
+                if (is_value(lhs, Num(0))) return operands[1];
+                if (is_value(operands[1], Num(0))) return lhs;
+                break;
+            case NodeKind::Sub:
+                if (is_value(operands[1], Num(0))) return lhs;
+                break;
+            case NodeKind::Mul:
+                if (is_value(lhs, Num(0)) || is_value(operands[1], Num(0))) return Expression<Num>(0);
+                if (is_value(lhs, Num(1))) return operands[1];
+                if (is_value(operands[1], Num(1))) return lhs;
+                break;
+            case NodeKind::Div:
+                if (is_value(operands[1], Num(1))) return lhs;
+                break;
+            case NodeKind::Pow:
+                if (is_value(operands[1], Num(1))) return lhs;
+                if (is_value(operands[1], Num(0))) return Expression<Num>(1);
+                break;
+            default:
+                break;
+        }
+        return res;
+    };
+    return rewrite(*this, leaf, combine);
+}
+
+// Add/Sub chains become one SumExpr and Mul/Div chains one ProductExpr, with
+// the operands of every chain flattened as well.
+template<typename Num>
+Expression<Num> Expression<Num>::flatten(bool compensated) const {
+    std::unordered_map<const ExpressionTempl<Num> *, Expression<Num>> done;
+    auto result = [&](const Expression<Num> &expr) -> const Expression<Num> & {
+        return expr._content->arity() == 0 ? expr : done.at(expr._content.get());
+    };
+    auto pending = [&](const Expression<Num> &expr) {
+        return expr._content->arity() != 0 && !done.count(expr._content.get());
+    };
+    std::vector<Expression<Num>> stack = {*this};
+    while (!stack.empty()) {
+        Expression<Num> expr = stack.back();
+        if (!pending(expr)) {
+            stack.pop_back();
+            continue;
+        }
+        NodeKind k = expr.kind();
+        std::size_t waiting = stack.size();
+        if (k == NodeKind::Add || k == NodeKind::Sub || k == NodeKind::Mul || k == NodeKind::Div) {
+            bool sum = k == NodeKind::Add || k == NodeKind::Sub;
+            NodeKind join = sum ? NodeKind::Add : NodeKind::Mul;
+            NodeKind split = sum ? NodeKind::Sub : NodeKind::Div;
+            std::vector<Expression<Num>> items;
+            std::vector<bool> flipped;
+            std::vector<std::pair<Expression<Num>, bool>> walk = {{expr, false}};
+            while (!walk.empty()) {
+                auto [item, flip] = walk.back();
+                walk.pop_back();
+                if (item.kind() == join || item.kind() == split) {
+                    walk.emplace_back(item._content->operand(1), flip != (item.kind() == split));
+                    walk.emplace_back(item._content->operand(0), flip);
+                } else {
+                    items.push_back(item);
+                    flipped.push_back(flip);
+                }
+            }
+            for (const auto &item : items) {
+                if (pending(item)) stack.push_back(item);
+            }
+            if (stack.size() != waiting) continue;
+            std::vector<Expression<Num>> operands;
+            for (const auto &item : items) {
+                operands.push_back(result(item));
+            }
+            done.emplace(expr._content.get(), sum
+                    ? Expression<Num>(make_node<SumExpr<Num>>(std::move(operands), std::move(flipped), compensated))
+                    : Expression<Num>(make_node<ProductExpr<Num>>(std::move(operands), std::move(flipped))));
+            stack.pop_back();
+            continue;
+        }
+        for (std::size_t i = 0; i < expr._content->arity(); i++) {
+            if (pending(expr._content->operand(i))) stack.push_back(expr._content->operand(i));
+        }
+        if (stack.size() != waiting) continue;
+        std::vector<Expression<Num>> operands;
+        bool same = true;
+        for (std::size_t i = 0; i < expr._content->arity(); i++) {
+            operands.push_back(result(expr._content->operand(i)));
+            same = same && operands[i]._content == expr._content->operand(i)._content;
+        }
+        done.emplace(expr._content.get(), same && k != NodeKind::Dif ? expr : expr.rebuild(operands));
+        stack.pop_back();
+    }
+    return result(*this);
 }
 
 template<typename Num>
 std::string Expression<Num>::to_string() const {
-    return _content->to_string();
+    return render<Num>(*_content);
 }
 
+// Subtrees that cannot mention a substituted variable, or come back
+// unchanged, are shared with the original; operators whose operands all
+// became values are folded.
 template<typename Num>
 Expression<Num> Expression<Num>::sub(std::map<std::string, Num> substitution) const {
-    return _content->sub(substitution);
+    std::uint64_t mask = 0;
+    for (const auto &item : substitution) {
+        mask |= variable_bit(item.first);
+    }
+    auto leaf = [&](const Expression<Num> &expr, Expression<Num> &res) {
+        if (!(expr._content->signature() & mask)) {
+            return true;
+        }
+        if (expr.kind() == NodeKind::Variable) {
+            auto it = substitution.find(static_cast<const Variable<Num> &>(expr.node()).name());
+            if (it != substitution.end()) res = Expression<Num>(it->second);
+            return true;
+        }
+        if (expr.kind() == NodeKind::Poly) {
+            res = expr._content->sub(substitution);
+            return true;
+        }
+        return false;
+    };
+    auto combine = [](const Expression<Num> &expr, const std::vector<Expression<Num>> &operands) {
+        if (expr.kind() == NodeKind::Dif) {
+            return operands[0];
+        }
+        bool constant = true;
+        bool same = true;
+        for (std::size_t i = 0; i < operands.size(); i++) {
+            constant = constant && operands[i].kind() == NodeKind::Value;
+            same = same && operands[i]._content == expr._content->operand(i)._content;
+        }
+        if (same) {
+            return expr;
+        }
+        Expression<Num> res = expr.rebuild(operands);
+        return constant ? Expression<Num>(res.eval({})) : res;
+    };
+    return rewrite(*this, leaf, combine);
 }
 
 template<typename Num>
 Expression<Num> Expression<Num>::dif(std::string substitution) const {
+    auto &memo = DerivativeMemo<Num>::instance();
+    NodePtr<Num> found = memo.find(_content.get(), substitution);
+    if (found) {
+        return Expression<Num>(std::move(found));
+    }
+    // Built outside the lock: if another thread recorded one meanwhile, this
+    // node is dropped after insert() returns the other.
+    auto derivative = make_node<DifExpr<Num>>(*this, substitution);
+    return Expression<Num>(memo.insert(_content.get(), substitution, derivative));
+}
+
+template<typename Num>
+Expression<Num> Expression<Num>::expand_dif(const std::string &substitution) const {
     return _content->dif(substitution);
 }
 
+template<typename Num>
+std::pair<Num, Num> Expression<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                              const std::string &var) const {
+    return evaluate<Num>(*_content, substitution, &var);
+}
+
+
+template
+class ExpressionTempl<double>;
+
+template
+class ExpressionTempl<std::complex<double>>;
 
 template
 class Expression<double>;
@@ -593,6 +2023,24 @@ class LnExpr<double>;
 template
 class LnExpr<std::complex<double>>;
 
+template
+class DifExpr<double>;
+
+template
+class DifExpr<std::complex<double>>;
+
+template
+class SumExpr<double>;
+
+template
+class SumExpr<std::complex<double>>;
+
+template
+class ProductExpr<double>;
+
+template
+class ProductExpr<std::complex<double>>;
+
 template
 std::string make_string<double>(double val);
 
@@ -600,6 +2048,6 @@ template
 double parse_number(const std::string var, bool with_i);
 
 template
-std::shared_ptr<ExpressionTempl<double>> parce(std::string var);
+NodePtr<double> parce(std::string var);
 
 
@@ -6,6 +6,13 @@
 #include <map>
 #include <iostream>
 #include <memory>
+#include <utility>
+#include <atomic>
+#include <vector>
+#include <set>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 
 using rational = double;
 using complex = std::complex<double>;
@@ -20,11 +27,93 @@ inline std::string make_string<complex>(complex val);
 template<typename Num>
 class Expression;
 
+template<typename Num>
+class DifExpr;
+
+enum class NodeKind : unsigned char {
+    Value,
+    Variable,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Pow,
+    Ln,
+    Sin,
+    Cos,
+    Exp,
+    Dif,
+    Poly,
+    Sum,
+    Product
+};
+
+enum class RefCounting {
+    Atomic,
+    NonAtomic
+};
+
+// Nodes created while a scope is alive count their references with the
+// scope's mode; NonAtomic is only safe if the nodes never leave the thread.
+class RefCountScope {
+public:
+    explicit RefCountScope(RefCounting mode) : _previous(_current) { _current = mode; }
+
+    ~RefCountScope() { _current = _previous; }
+
+    RefCountScope(const RefCountScope &) = delete;
+
+    RefCountScope &operator=(const RefCountScope &) = delete;
+
+    static RefCounting current() { return _current; }
+
+private:
+    RefCounting _previous;
+    inline static thread_local RefCounting _current = RefCounting::Atomic;
+};
+
+// Bit of a node's variable signature that stands for `name`; bit 63 is kept
+// free to mark a signature as computed.
+inline std::uint64_t variable_bit(const std::string &name) {
+    return std::uint64_t(1) << (std::hash<std::string>()(name) % 63);
+}
+
+// Mixes `value` into `seed` (splitmix64 finalizer), for structural hashes.
+inline std::uint64_t hash_combine(std::uint64_t seed, std::uint64_t value) {
+    std::uint64_t x = seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Numbers hash and compare by bit pattern, so 0 and -0 are different
+// constants and a NaN constant equals itself.
+inline std::uint64_t number_hash(double value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline std::uint64_t number_hash(const std::complex<double> &value) {
+    return hash_combine(number_hash(value.real()), number_hash(value.imag()));
+}
+
+template<typename Num>
+inline bool same_number(const Num &lhs, const Num &rhs) {
+    return std::memcmp(&lhs, &rhs, sizeof(Num)) == 0;
+}
+
 template<typename Num = rational>
 class ExpressionTempl {
 public:
+    using number = Num;
+
     ExpressionTempl() = default;
 
+    ExpressionTempl(const ExpressionTempl<Num> &) = delete;
+
+    ExpressionTempl<Num> &operator=(const ExpressionTempl<Num> &) = delete;
+
     virtual ~ExpressionTempl() = default;
 
     virtual Num eval(std::map<std::string, Num> substitution) const = 0;
@@ -35,8 +124,179 @@ public:
 
     virtual Expression<Num> dif(std::string substitution) const = 0;
 
+    virtual std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                         const std::string &var) const = 0;
+
+    virtual NodeKind kind() const = 0;
+
+    virtual std::size_t arity() const;
+
+    virtual const Expression<Num> &operand(std::size_t index) const;
+
+    virtual void collect_variables(std::set<std::string> &variables) const;
+
+    // Union of variable_bit() over the free variables; a node whose signature
+    // misses every bit of a substitution cannot contain any of its variables.
+    std::uint64_t signature() const;
+
+    // Structural hash, fixed at construction from the node's own data and
+    // the hashes of its stored operands.
+    std::uint64_t hash() const;
+
+    // Whether the node's own data (not its operands) matches `other`, which
+    // has the same kind.
+    virtual bool same_data(const ExpressionTempl<Num> &other) const;
+
+    void retain() const;
+
+    // Takes a reference only while the node is alive, for holders that do
+    // not own it (the derivative memo).
+    bool try_retain() const;
+
+    bool release() const;
+
+protected:
+    virtual std::uint64_t compute_signature() const;
+
+    // Every constructor calls this once the node's operands are in place.
+    void seal(std::uint64_t data = 0);
+
+private:
+    friend class Expression<Num>;
+
+    mutable std::atomic<unsigned> _refs{0};
+    mutable std::atomic<std::uint64_t> _signature{0};
+    std::uint64_t _hash = 0;
+    const bool _atomic = RefCountScope::current() == RefCounting::Atomic;
+};
+
+template<typename Num>
+inline void ExpressionTempl<Num>::retain() const {
+    if (_atomic) {
+        _refs.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        _refs.store(_refs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+template<typename Num>
+inline bool ExpressionTempl<Num>::try_retain() const {
+    unsigned refs = _refs.load(std::memory_order_relaxed);
+    while (refs != 0) {
+        if (_refs.compare_exchange_weak(refs, refs + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename Num>
+inline bool ExpressionTempl<Num>::release() const {
+    if (_atomic) {
+        return _refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+    unsigned refs = _refs.load(std::memory_order_relaxed) - 1;
+    _refs.store(refs, std::memory_order_relaxed);
+    return refs == 0;
+}
+
+// Intrusive handle: the reference count lives in the node itself, so a node
+// and its count share one allocation.
+template<typename Num = rational>
+class NodePtr {
+public:
+    NodePtr() = default;
+
+    NodePtr(std::nullptr_t) {}
+
+    explicit NodePtr(const ExpressionTempl<Num> *node);
+
+    NodePtr(const NodePtr<Num> &other);
+
+    NodePtr(NodePtr<Num> &&other) noexcept;
+
+    ~NodePtr();
+
+    NodePtr<Num> &operator=(const NodePtr<Num> &rhs);
+
+    NodePtr<Num> &operator=(NodePtr<Num> &&rhs) noexcept;
+
+    const ExpressionTempl<Num> *get() const { return _node; }
+
+    const ExpressionTempl<Num> *operator->() const { return _node; }
+
+    const ExpressionTempl<Num> &operator*() const { return *_node; }
+
+    explicit operator bool() const { return _node != nullptr; }
+
+    bool operator==(const NodePtr<Num> &rhs) const { return _node == rhs._node; }
+
+    bool operator!=(const NodePtr<Num> &rhs) const { return _node != rhs._node; }
+
+private:
+    const ExpressionTempl<Num> *_node = nullptr;
 };
 
+template<typename Num>
+inline NodePtr<Num>::NodePtr(const ExpressionTempl<Num> *node) : _node(node) {
+    if (_node) _node->retain();
+}
+
+template<typename Num>
+inline NodePtr<Num>::NodePtr(const NodePtr<Num> &other) : _node(other._node) {
+    if (_node) _node->retain();
+}
+
+template<typename Num>
+inline NodePtr<Num>::NodePtr(NodePtr<Num> &&other) noexcept : _node(other._node) {
+    other._node = nullptr;
+}
+
+// Deleting a node releases its operands, which may delete them in turn.
+// Nodes freed while a deletion is already running are queued and deleted by
+// the outermost call instead, so tearing down a deep chain takes constant
+// stack.
+template<typename Num>
+inline void dispose_node(const ExpressionTempl<Num> *node) {
+    thread_local std::vector<const ExpressionTempl<Num> *> pending;
+    thread_local bool draining = false;
+    pending.push_back(node);
+    if (draining) return;
+    draining = true;
+    while (!pending.empty()) {
+        const ExpressionTempl<Num> *next = pending.back();
+        pending.pop_back();
+        delete next;
+    }
+    draining = false;
+}
+
+template<typename Num>
+inline NodePtr<Num>::~NodePtr() {
+    if (_node && _node->release()) dispose_node(_node);
+}
+
+template<typename Num>
+inline NodePtr<Num> &NodePtr<Num>::operator=(const NodePtr<Num> &rhs) {
+    NodePtr<Num> copy(rhs);
+    return *this = std::move(copy);
+}
+
+template<typename Num>
+inline NodePtr<Num> &NodePtr<Num>::operator=(NodePtr<Num> &&rhs) noexcept {
+    if (this != &rhs) {
+        NodePtr<Num> old(std::move(*this));
+        _node = rhs._node;
+        rhs._node = nullptr;
+    }
+    return *this;
+}
+
+template<typename Node, typename... Args>
+inline NodePtr<typename Node::number> make_node(Args &&... args) {
+    return NodePtr<typename Node::number>(new Node(std::forward<Args>(args)...));
+}
+
 
 template<typename Num = rational>
 class Value : public ExpressionTempl<Num> {
@@ -54,6 +314,15 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    const Num &value() const;
+
+    bool same_data(const ExpressionTempl<Num> &other) const override;
+
 private:
     Num _value;
 };
@@ -74,6 +343,20 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    void collect_variables(std::set<std::string> &variables) const override;
+
+    const std::string &name() const;
+
+    bool same_data(const ExpressionTempl<Num> &other) const override;
+
+protected:
+    std::uint64_t compute_signature() const override;
+
 private:
     std::string _name;
 };
@@ -93,6 +376,15 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
 private:
     Expression<Num> _lhs;
     Expression<Num> _rhs;
@@ -113,6 +405,15 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
 private:
     Expression<Num> _lhs;
     Expression<Num> _rhs;
@@ -133,6 +434,15 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
 private:
     Expression<Num> _lhs;
     Expression<Num> _rhs;
@@ -153,6 +463,15 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
 private:
     Expression<Num> _content;
 };
@@ -172,6 +491,15 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
 private:
     Expression<Num> _base;
     Expression<Num> _exp;
@@ -193,6 +521,15 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
 private:
     Expression<Num> _lhs;
     Expression<Num> _rhs;
@@ -214,6 +551,15 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
 private:
     Expression<Num> _content;
 };
@@ -233,6 +579,15 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
 private:
     Expression<Num> _content;
 };
@@ -253,8 +608,179 @@ public:
 
     Expression<Num> dif(std::string substitution) const override;
 
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
+private:
+    Expression<Num> _content;
+};
+
+// Value built on first use by a const node. Concurrent first uses may both
+// build it; one result is published and the other discarded.
+template<typename T>
+class Lazy {
+public:
+    Lazy() = default;
+
+    Lazy(const Lazy<T> &) = delete;
+
+    Lazy<T> &operator=(const Lazy<T> &) = delete;
+
+    ~Lazy() { delete _value.load(std::memory_order_relaxed); }
+
+    template<typename Make>
+    const T &get(Make make) const {
+        T *value = _value.load(std::memory_order_acquire);
+        if (value) return *value;
+        auto *fresh = new T(make());
+        if (_value.compare_exchange_strong(value, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return *fresh;
+        }
+        delete fresh;
+        return *value;
+    }
+
+private:
+    mutable std::atomic<T *> _value{nullptr};
+};
+
+template<typename Num = rational>
+class DifExpr : public ExpressionTempl<Num> {
+public:
+    DifExpr(Expression<Num> content, std::string var);
+
+    ~DifExpr() override;
+
+    Num eval(std::map<std::string, Num> substitution) const override;
+
+    std::string to_string() const override;
+
+    Expression<Num> sub(std::map<std::string, Num> substitution) const override;
+
+    Expression<Num> dif(std::string substitution) const override;
+
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
+    void collect_variables(std::set<std::string> &variables) const override;
+
+    const Expression<Num> &expand() const;
+
+    // Variables of the content, which forward mode needs values for.
+    const std::set<std::string> &content_variables() const;
+
+    // Fully expanded and simplified, so it names only the variables the
+    // derivative really depends on.
+    const Expression<Num> &simplified() const;
+
+    const Expression<Num> &content() const;
+
+    const std::string &var() const;
+
+    bool same_data(const ExpressionTempl<Num> &other) const override;
+
+protected:
+    std::uint64_t compute_signature() const override;
+
 private:
     Expression<Num> _content;
+    std::string _var;
+    Lazy<Expression<Num>> _expanded;
+    Lazy<std::set<std::string>> _content_variables;
+    Lazy<Expression<Num>> _simplified;
+};
+
+// N-ary sum; a term with `negated` set is subtracted. Evaluates with four
+// independent partial sums, or with Neumaier compensation when
+// `compensated` is set.
+template<typename Num = rational>
+class SumExpr : public ExpressionTempl<Num> {
+public:
+    SumExpr(std::vector<Expression<Num>> terms, std::vector<bool> negated, bool compensated = false);
+
+    ~SumExpr() override = default;
+
+    Num eval(std::map<std::string, Num> substitution) const override;
+
+    std::string to_string() const override;
+
+    Expression<Num> sub(std::map<std::string, Num> substitution) const override;
+
+    Expression<Num> dif(std::string substitution) const override;
+
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
+    bool negated(std::size_t index) const;
+
+    bool compensated() const;
+
+    bool same_data(const ExpressionTempl<Num> &other) const override;
+
+    // The same sum as a balanced tree of binary additions and one subtraction.
+    const Expression<Num> &lowered() const;
+
+private:
+    std::vector<Expression<Num>> _terms;
+    std::vector<bool> _negated;
+    bool _compensated;
+    Lazy<Expression<Num>> _lowered;
+};
+
+// N-ary product; a factor with `inverted` set divides.
+template<typename Num = rational>
+class ProductExpr : public ExpressionTempl<Num> {
+public:
+    ProductExpr(std::vector<Expression<Num>> factors, std::vector<bool> inverted);
+
+    ~ProductExpr() override = default;
+
+    Num eval(std::map<std::string, Num> substitution) const override;
+
+    std::string to_string() const override;
+
+    Expression<Num> sub(std::map<std::string, Num> substitution) const override;
+
+    Expression<Num> dif(std::string substitution) const override;
+
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    std::size_t arity() const override;
+
+    const Expression<Num> &operand(std::size_t index) const override;
+
+    bool inverted(std::size_t index) const;
+
+    bool same_data(const ExpressionTempl<Num> &other) const override;
+
+    // The same product as a balanced tree of binary products and one division.
+    const Expression<Num> &lowered() const;
+
+private:
+    std::vector<Expression<Num>> _factors;
+    std::vector<bool> _inverted;
+    Lazy<Expression<Num>> _lowered;
 };
 
 inline std::string space_deleter(std::string var);
@@ -266,7 +792,7 @@ template<>
 inline complex parse_number<complex>(const std::string var, bool with_i);
 
 template<typename Num = rational>
-std::shared_ptr<ExpressionTempl<Num>> parce(std::string var);
+NodePtr<Num> parce(std::string var);
 
 template<typename Num = rational>
 class Expression {
@@ -277,17 +803,17 @@ public:
 
     Expression(int var);
 
-    Expression(std::shared_ptr<ExpressionTempl<Num>> content);
+    Expression(NodePtr<Num> content);
 
     Expression(const Expression<Num> &expr);
 
-    Expression(Expression<Num> &&expr);
+    Expression(Expression<Num> &&expr) noexcept;
 
     ~Expression() = default;
 
     Expression<Num> &operator=(const Expression<Num> &rhs);
 
-    Expression<Num> &operator=(Expression<Num> &&rhs);
+    Expression<Num> &operator=(Expression<Num> &&rhs) noexcept;
 
     Expression<Num> operator+(const Expression<Num> &rhs) const;
 
@@ -315,12 +841,46 @@ public:
 
     Expression<Num> dif(std::string substitution) const;
 
+    Expression<Num> expand_dif(const std::string &substitution) const;
+
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution, const std::string &var) const;
+
+    NodeKind kind() const;
+
+    const ExpressionTempl<Num> &node() const;
+
+    Expression<Num> rebuild(std::vector<Expression<Num>> operands) const;
+
+    std::set<std::string> variables() const;
+
+    Expression<Num> simplify() const;
+
+    // Absorbs chains of + and - into SumExpr and chains of * and / into
+    // ProductExpr nodes, so long sums no longer evaluate as one serial chain.
+    Expression<Num> flatten(bool compensated = false) const;
+
+    std::uint64_t hash() const;
+
+    // Structural equality: true at once for the same node, false at once
+    // when the hashes differ, otherwise a walk over both trees.
+    bool operator==(const Expression<Num> &rhs) const;
+
+    bool operator!=(const Expression<Num> &rhs) const;
 
 private:
+    friend class DifExpr<Num>;
+
+    NodePtr<Num> _content;
 
+};
 
-    std::shared_ptr<ExpressionTempl<Num>> _content;
+namespace std {
 
+template<typename Num>
+struct hash<Expression<Num>> {
+    std::size_t operator()(const Expression<Num> &expr) const { return expr.hash(); }
 };
 
+}
+
 #endif
@@ -0,0 +1,276 @@
+#include "integrate.hpp"
+#include "compiled.hpp"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+
+namespace {
+
+const double kronrod_nodes[8] = {
+        0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+        0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+        0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+        0.207784955007898467600689403773245, 0.000000000000000000000000000000000};
+
+const double kronrod_weights[8] = {
+        0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+        0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+        0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+        0.204432940075298892414161999234649, 0.209482141084727828012999174891714};
+
+// Weights of the embedded 7-point Gauss rule at kronrod_nodes[1, 3, 5, 7].
+const double gauss_weights[4] = {
+        0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+        0.381830050505118944950369775488975, 0.417959183673469387755102040816327};
+
+const std::size_t kronrod_points = 15;
+
+template<typename Num>
+Program<Num> compile(const Expression<Num> &integrand, const std::vector<std::string> &vars,
+                     const std::map<std::string, Num> &parameters) {
+    for (const auto &var : vars) {
+        if (parameters.count(var)) {
+            throw std::invalid_argument(var + " is both integrated over and a parameter");
+        }
+    }
+    return Program<Num>(parameters.empty() ? integrand : integrand.sub(parameters), vars);
+}
+
+void gauss_legendre(std::size_t n, std::vector<double> &nodes, std::vector<double> &weights) {
+    nodes.assign(n, 0);
+    weights.assign(n, 0);
+    for (std::size_t i = 0; i < (n + 1) / 2; i++) {
+        double x = std::cos(std::acos(-1.0) * (i + 0.75) / (n + 0.5));
+        double derivative = 1;
+        for (int iteration = 0; iteration < 100; iteration++) {
+            double p0 = 1, p1 = x;
+            for (std::size_t k = 2; k <= n; k++) {
+                double p2 = ((2 * k - 1) * x * p1 - (k - 1) * p0) / k;
+                p0 = p1;
+                p1 = p2;
+            }
+            derivative = n * (x * p1 - p0) / (x * x - 1);
+            double dx = p1 / derivative;
+            x -= dx;
+            if (std::abs(dx) < 1e-16) break;
+        }
+        nodes[i] = -x;
+        nodes[n - 1 - i] = x;
+        weights[i] = weights[n - 1 - i] = 2 / ((1 - x * x) * derivative * derivative);
+    }
+}
+
+struct Interval {
+    double lower;
+    double upper;
+};
+
+}
+
+
+template<typename Num>
+IntegrationResult<Num> integrate(const Expression<Num> &integrand, const std::string &var,
+                                 double lower, double upper,
+                                 const std::map<std::string, Num> &parameters,
+                                 IntegrationOptions options) {
+    Program<Num> program = compile(integrand, {var}, parameters);
+    IntegrationResult<Num> res{Num(0), 0, 0, 0, false};
+    std::vector<Interval> pending = {{lower, upper}};
+    std::vector<double> points;
+    std::vector<Num> values;
+    double width = std::abs(upper - lower);
+    bool forced = false;
+
+    while (!pending.empty()) {
+        points.resize(pending.size() * kronrod_points);
+        for (std::size_t i = 0; i < pending.size(); i++) {
+            double center = (pending[i].lower + pending[i].upper) / 2;
+            double half = (pending[i].upper - pending[i].lower) / 2;
+            double *node = points.data() + i * kronrod_points;
+            node[0] = center;
+            for (std::size_t j = 0; j < 7; j++) {
+                node[1 + 2 * j] = center - half * kronrod_nodes[j];
+                node[2 + 2 * j] = center + half * kronrod_nodes[j];
+            }
+        }
+        std::vector<Num> column(points.begin(), points.end());
+        const Num *columns[] = {column.data()};
+        values.resize(points.size());
+        program.eval_batch(columns, points.size(), values.data());
+        res.evaluations += points.size();
+        res.levels++;
+
+        bool last = res.levels >= options.max_levels || res.evaluations >= options.max_evaluations;
+        std::vector<Interval> next;
+        for (std::size_t i = 0; i < pending.size(); i++) {
+            double half = (pending[i].upper - pending[i].lower) / 2;
+            const Num *f = values.data() + i * kronrod_points;
+            Num kronrod = f[0] * kronrod_weights[7];
+            Num gauss = f[0] * gauss_weights[3];
+            for (std::size_t j = 0; j < 7; j++) {
+                Num pair = f[1 + 2 * j] + f[2 + 2 * j];
+                kronrod += pair * kronrod_weights[j];
+                if (j % 2 == 1) gauss += pair * gauss_weights[j / 2];
+            }
+            kronrod *= half;
+            gauss *= half;
+            double error = std::abs(kronrod - gauss);
+            double share = width > 0 ? 2 * std::abs(half) / width : 1;
+            if (last || error <= options.tolerance * share || !std::isfinite(error)) {
+                forced = forced || error > options.tolerance * share || !std::isfinite(error);
+                res.value += kronrod;
+                res.error += error;
+            } else {
+                double middle = (pending[i].lower + pending[i].upper) / 2;
+                next.push_back({pending[i].lower, middle});
+                next.push_back({middle, pending[i].upper});
+            }
+        }
+        pending = std::move(next);
+    }
+    res.converged = !forced;
+    return res;
+}
+
+template<typename Num>
+IntegrationResult<Num> integrate_tensor(const Expression<Num> &integrand, const std::vector<std::string> &vars,
+                                        const std::vector<double> &lower, const std::vector<double> &upper,
+                                        const std::map<std::string, Num> &parameters,
+                                        IntegrationOptions options) {
+    if (vars.size() != lower.size() || vars.size() != upper.size()) {
+        throw std::invalid_argument("integration box does not match the variables");
+    }
+    Program<Num> program = compile(integrand, vars, parameters);
+    std::size_t dims = vars.size();
+    IntegrationResult<Num> res{Num(0), 0, 0, 0, false};
+    Num previous = Num(0);
+    std::vector<double> nodes, weights;
+    for (std::size_t order = 2; res.levels < options.max_levels; order *= 2) {
+        std::size_t total = 1;
+        for (std::size_t d = 0; d < dims; d++) total *= order;
+        if (res.evaluations + total > options.max_evaluations) break;
+        gauss_legendre(order, nodes, weights);
+
+        std::vector<std::vector<Num>> coordinates(dims, std::vector<Num>(total));
+        std::vector<double> weight(total, 1);
+        for (std::size_t p = 0; p < total; p++) {
+            std::size_t index = p;
+            for (std::size_t d = 0; d < dims; d++) {
+                std::size_t k = index % order;
+                index /= order;
+                double half = (upper[d] - lower[d]) / 2;
+                coordinates[d][p] = lower[d] + half * (nodes[k] + 1);
+                weight[p] *= weights[k] * half;
+            }
+        }
+        std::vector<const Num *> columns(dims);
+        for (std::size_t d = 0; d < dims; d++) columns[d] = coordinates[d].data();
+        std::vector<Num> values(total);
+        program.eval_batch(columns.data(), total, values.data());
+        res.evaluations += total;
+        res.levels++;
+
+        Num sum = Num(0);
+        for (std::size_t p = 0; p < total; p++) sum += values[p] * weight[p];
+        res.value = sum;
+        if (res.levels > 1) {
+            res.error = std::abs(sum - previous);
+            if (res.error <= options.tolerance * std::max(1.0, std::abs(sum))) {
+                res.converged = true;
+                break;
+            }
+        }
+        previous = sum;
+    }
+    return res;
+}
+
+template<typename Num>
+IntegrationResult<Num> integrate_monte_carlo(const Expression<Num> &integrand, const std::vector<std::string> &vars,
+                                             const std::vector<double> &lower, const std::vector<double> &upper,
+                                             const std::map<std::string, Num> &parameters,
+                                             IntegrationOptions options) {
+    if (vars.size() != lower.size() || vars.size() != upper.size()) {
+        throw std::invalid_argument("integration box does not match the variables");
+    }
+    Program<Num> program = compile(integrand, vars, parameters);
+    std::size_t dims = vars.size();
+    double volume = 1;
+    for (std::size_t d = 0; d < dims; d++) volume *= upper[d] - lower[d];
+
+    std::mt19937_64 generator(options.seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    IntegrationResult<Num> res{Num(0), 0, 0, 0, false};
+    Num sum = Num(0);
+    double squares = 0;
+    for (std::size_t samples = 4096; res.levels < options.max_levels; samples *= 2) {
+        if (res.evaluations + samples > options.max_evaluations) break;
+        std::vector<std::vector<Num>> coordinates(dims, std::vector<Num>(samples));
+        for (std::size_t p = 0; p < samples; p++) {
+            for (std::size_t d = 0; d < dims; d++) {
+                coordinates[d][p] = lower[d] + (upper[d] - lower[d]) * uniform(generator);
+            }
+        }
+        std::vector<const Num *> columns(dims);
+        for (std::size_t d = 0; d < dims; d++) columns[d] = coordinates[d].data();
+        std::vector<Num> values(samples);
+        program.eval_batch(columns.data(), samples, values.data());
+        for (const Num &value : values) {
+            sum += value;
+            squares += std::norm(value);
+        }
+        res.evaluations += samples;
+        res.levels++;
+
+        double n = res.evaluations;
+        Num mean = sum / Num(n);
+        double variance = std::max(0.0, squares / n - std::norm(mean));
+        res.value = mean * Num(volume);
+        res.error = std::abs(volume) * std::sqrt(variance / n);
+        if (res.error <= options.tolerance * std::max(1.0, std::abs(res.value))) {
+            res.converged = true;
+            break;
+        }
+    }
+    return res;
+}
+
+
+template
+IntegrationResult<double> integrate(const Expression<double> &integrand, const std::string &var,
+                                    double lower, double upper, const std::map<std::string, double> &parameters,
+                                    IntegrationOptions options);
+
+template
+IntegrationResult<complex> integrate(const Expression<complex> &integrand, const std::string &var,
+                                     double lower, double upper, const std::map<std::string, complex> &parameters,
+                                     IntegrationOptions options);
+
+template
+IntegrationResult<double> integrate_tensor(const Expression<double> &integrand, const std::vector<std::string> &vars,
+                                           const std::vector<double> &lower, const std::vector<double> &upper,
+                                           const std::map<std::string, double> &parameters,
+                                           IntegrationOptions options);
+
+template
+IntegrationResult<complex> integrate_tensor(const Expression<complex> &integrand,
+                                            const std::vector<std::string> &vars,
+                                            const std::vector<double> &lower, const std::vector<double> &upper,
+                                            const std::map<std::string, complex> &parameters,
+                                            IntegrationOptions options);
+
+template
+IntegrationResult<double> integrate_monte_carlo(const Expression<double> &integrand,
+                                                const std::vector<std::string> &vars,
+                                                const std::vector<double> &lower, const std::vector<double> &upper,
+                                                const std::map<std::string, double> &parameters,
+                                                IntegrationOptions options);
+
+template
+IntegrationResult<complex> integrate_monte_carlo(const Expression<complex> &integrand,
+                                                 const std::vector<std::string> &vars,
+                                                 const std::vector<double> &lower, const std::vector<double> &upper,
+                                                 const std::map<std::string, complex> &parameters,
+                                                 IntegrationOptions options);
@@ -0,0 +1,51 @@
+#ifndef INTEGRATE_HPP
+#define INTEGRATE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include "expression.hpp"
+
+
+struct IntegrationOptions {
+    double tolerance = 1e-10;
+    int max_levels = 30;
+    std::size_t max_evaluations = 10000000;
+    unsigned long seed = 5489;
+};
+
+template<typename Num = rational>
+struct IntegrationResult {
+    Num value;
+    double error;
+    std::size_t evaluations;
+    int levels;
+    bool converged;
+};
+
+// All integrators compile the integrand once (after substituting the fixed
+// parameters) and evaluate every node of a refinement level in a single
+// batched call. A variable of integration may not also be a parameter.
+
+// Adaptive 15-point Gauss-Kronrod over [lower, upper].
+template<typename Num = rational>
+IntegrationResult<Num> integrate(const Expression<Num> &integrand, const std::string &var,
+                                 double lower, double upper,
+                                 const std::map<std::string, Num> &parameters = {},
+                                 IntegrationOptions options = {});
+
+// Tensor-product Gauss-Legendre over a box, doubling the rule per level.
+template<typename Num = rational>
+IntegrationResult<Num> integrate_tensor(const Expression<Num> &integrand, const std::vector<std::string> &vars,
+                                        const std::vector<double> &lower, const std::vector<double> &upper,
+                                        const std::map<std::string, Num> &parameters = {},
+                                        IntegrationOptions options = {});
+
+// Monte Carlo over a box, doubling the sample count per level.
+template<typename Num = rational>
+IntegrationResult<Num> integrate_monte_carlo(const Expression<Num> &integrand, const std::vector<std::string> &vars,
+                                             const std::vector<double> &lower, const std::vector<double> &upper,
+                                             const std::map<std::string, Num> &parameters = {},
+                                             IntegrationOptions options = {});
+
+#endif
@@ -0,0 +1,377 @@
+#include "jacobian.hpp"
+#include "polynomial.hpp"
+#include <algorithm>
+#include <array>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+
+
+namespace {
+
+// Fills in the default variables, then returns them followed by parameters.
+template<typename Num>
+std::vector<std::string> inputs_for(const std::vector<Expression<Num>> &functions,
+                                    std::vector<std::string> &variables, std::vector<std::string> parameters) {
+    std::set<std::string> free;
+    for (const auto &function : functions) {
+        auto more = function.variables();
+        free.insert(more.begin(), more.end());
+    }
+    if (variables.empty()) {
+        for (const auto &name : free) {
+            if (std::find(parameters.begin(), parameters.end(), name) == parameters.end()) {
+                variables.push_back(name);
+            }
+        }
+    }
+    if (parameters.empty()) {
+        for (const auto &name : free) {
+            if (std::find(variables.begin(), variables.end(), name) == variables.end()) {
+                parameters.push_back(name);
+            }
+        }
+    }
+    std::vector<std::string> res = variables;
+    res.insert(res.end(), parameters.begin(), parameters.end());
+    return res;
+}
+
+// Every distinct node of the functions in post-order. Dif nodes stand for
+// their expansion and n-ary nodes for their binary form; polynomials stay
+// leaves that are differentiated as a whole.
+template<typename Num>
+struct Tape {
+    std::vector<Expression<Num>> steps;
+    std::vector<std::array<std::uint32_t, 2>> operands;
+    // Whether a step depends on any of the differentiation variables.
+    std::vector<bool> varying;
+    std::vector<std::uint32_t> outputs;
+};
+
+template<typename Num>
+Tape<Num> record(const std::vector<Expression<Num>> &functions, const std::map<std::string, std::size_t> &cols) {
+    Tape<Num> tape;
+    std::unordered_map<const ExpressionTempl<Num> *, std::uint32_t> index;
+    for (const auto &function : functions) {
+        std::vector<std::pair<Expression<Num>, bool>> stack = {{function, false}};
+        while (!stack.empty()) {
+            auto [expr, visited] = stack.back();
+            stack.pop_back();
+            const ExpressionTempl<Num> *node = &expr.node();
+            if (index.count(node)) continue;
+            NodeKind kind = expr.kind();
+            if (kind == NodeKind::Dif || kind == NodeKind::Sum || kind == NodeKind::Product) {
+                const Expression<Num> &alias = kind == NodeKind::Dif ? node->operand(0)
+                                             : kind == NodeKind::Sum ? static_cast<const SumExpr<Num> *>(node)->lowered()
+                                             : static_cast<const ProductExpr<Num> *>(node)->lowered();
+                if (!visited) {
+                    stack.emplace_back(expr, true);
+                    stack.emplace_back(alias, false);
+                } else {
+                    index.emplace(node, index.at(&alias.node()));
+                }
+                continue;
+            }
+            std::size_t arity = kind == NodeKind::Poly ? 0 : node->arity();
+            if (!visited && arity > 0) {
+                stack.emplace_back(expr, true);
+                for (std::size_t i = arity; i-- > 0;) {
+                    stack.emplace_back(node->operand(i), false);
+                }
+                continue;
+            }
+            std::array<std::uint32_t, 2> operands = {0, 0};
+            bool varying = false;
+            if (kind == NodeKind::Variable || kind == NodeKind::Poly) {
+                std::set<std::string> names;
+                node->collect_variables(names);
+                for (const auto &name : names) {
+                    varying = varying || cols.count(name);
+                }
+            }
+            for (std::size_t i = 0; i < arity; i++) {
+                operands[i] = index.at(&node->operand(i).node());
+                varying = varying || tape.varying[operands[i]];
+            }
+            index.emplace(node, tape.steps.size());
+            tape.steps.push_back(expr);
+            tape.operands.push_back(operands);
+            tape.varying.push_back(varying);
+        }
+        tape.outputs.push_back(index.at(&function.node()));
+    }
+    return tape;
+}
+
+template<typename Num>
+bool is_value(const Expression<Num> &expr, Num value) {
+    return expr.kind() == NodeKind::Value && static_cast<const Value<Num> &>(expr.node()).value() == value;
+}
+
+// Partial derivative of a step with respect to its operand `which`, up to the
+// sign returned in `negative`.
+template<typename Num>
+Expression<Num> partial(const Tape<Num> &tape, std::uint32_t step, int which, bool &negative) {
+    const Expression<Num> &value = tape.steps[step];
+    const Expression<Num> &a = tape.steps[tape.operands[step][0]];
+    const Expression<Num> &b = tape.steps[tape.operands[step][1]];
+    negative = false;
+    switch (value.kind()) {
+        case NodeKind::Add:
+            return Expression<Num>(1);
+        case NodeKind::Sub:
+            negative = which == 1;
+            return Expression<Num>(1);
+        case NodeKind::Mul:
+            return which == 0 ? b : a;
+        case NodeKind::Div:
+            negative = which == 1;
+            return which == 0 ? Expression<Num>(1) / b : value / b;
+        case NodeKind::Pow:
+            if (which == 1) {
+                return value * a.ln();
+            }
+            if (b.kind() == NodeKind::Value) {
+                Num exponent = static_cast<const Value<Num> &>(b.node()).value();
+                return exponent == Num(2) ? b * a : b * (a ^ Expression<Num>(exponent - Num(1)));
+            }
+            return b * (a ^ (b - Expression<Num>(1)));
+        case NodeKind::Ln:
+            return Expression<Num>(1) / a;
+        case NodeKind::Sin:
+            return a.cos();
+        case NodeKind::Cos:
+            negative = true;
+            return a.sin();
+        case NodeKind::Exp:
+            return value;
+        default:
+            throw std::logic_error("unexpected node on jacobian tape");
+    }
+}
+
+// acc (+ or -) factor * term, where `live` says whether acc is nonzero yet.
+template<typename Num>
+void accumulate(Expression<Num> &acc, char &live, const Expression<Num> &factor, const Expression<Num> &term,
+                bool negative) {
+    Expression<Num> product = is_value(factor, Num(1)) ? term : is_value(term, Num(1)) ? factor : factor * term;
+    if (live) {
+        acc = negative ? acc - product : acc + product;
+    } else {
+        acc = negative ? Expression<Num>(0) - product : product;
+        live = true;
+    }
+}
+
+}
+
+
+template<typename Num>
+Jacobian<Num>::Jacobian(const std::vector<Expression<Num>> &functions, std::vector<std::string> variables,
+                        std::vector<std::string> parameters, JacobianMode mode)
+        : _inputs(inputs_for(functions, variables, std::move(parameters))),
+          _cols(variables.size()),
+          _mode(mode != JacobianMode::Automatic ? mode
+                : _cols <= functions.size() ? JacobianMode::Forward : JacobianMode::Reverse),
+          _entries(derive(functions)),
+          _program(_entries, _inputs) {}
+
+template<typename Num>
+std::size_t Jacobian<Num>::find(std::size_t row, std::size_t col) const {
+    auto begin = _columns.begin() + _row_start[row];
+    auto end = _columns.begin() + _row_start[row + 1];
+    auto it = std::lower_bound(begin, end, col);
+    return it != end && *it == col ? it - _columns.begin() : _columns.size();
+}
+
+template<typename Num>
+std::vector<Expression<Num>> Jacobian<Num>::derive(const std::vector<Expression<Num>> &functions) {
+    std::map<std::string, std::size_t> cols;
+    for (std::size_t j = 0; j < _cols; j++) {
+        cols.emplace(_inputs[j], j);
+    }
+    _row_start.push_back(0);
+    for (const auto &function : functions) {
+        std::vector<std::size_t> row;
+        for (const auto &name : function.variables()) {
+            auto it = cols.find(name);
+            if (it != cols.end()) row.push_back(it->second);
+        }
+        std::sort(row.begin(), row.end());
+        _columns.insert(_columns.end(), row.begin(), row.end());
+        _row_start.push_back(_columns.size());
+    }
+    std::vector<Expression<Num>> entries(_columns.size(), Expression<Num>(0));
+
+    Tape<Num> tape = record(functions, cols);
+    std::size_t n = tape.steps.size();
+    if (_mode == JacobianMode::Forward) {
+        // One sweep per variable carries d(step)/d(variable) forward.
+        for (std::size_t j = 0; j < _cols; j++) {
+            const std::string &var = _inputs[j];
+            std::vector<Expression<Num>> tangent(n, Expression<Num>(0));
+            std::vector<char> live(n);
+            for (std::uint32_t i = 0; i < n; i++) {
+                if (!tape.varying[i]) continue;
+                const Expression<Num> &step = tape.steps[i];
+                if (step.kind() == NodeKind::Variable) {
+                    if (static_cast<const Variable<Num> &>(step.node()).name() == var) {
+                        tangent[i] = Expression<Num>(1);
+                        live[i] = true;
+                    }
+                    continue;
+                }
+                if (step.kind() == NodeKind::Poly) {
+                    std::set<std::string> names;
+                    step.node().collect_variables(names);
+                    if (names.count(var)) {
+                        tangent[i] = step.expand_dif(var);
+                        live[i] = true;
+                    }
+                    continue;
+                }
+                for (int k = 0; k < (int) step.node().arity(); k++) {
+                    std::uint32_t operand = tape.operands[i][k];
+                    if (!live[operand]) continue;
+                    bool negative;
+                    Expression<Num> factor = partial(tape, i, k, negative);
+                    accumulate(tangent[i], live[i], factor, tangent[operand], negative);
+                }
+            }
+            for (std::size_t row = 0; row < functions.size(); row++) {
+                std::size_t k = find(row, j);
+                if (k < entries.size() && live[tape.outputs[row]]) {
+                    entries[k] = tangent[tape.outputs[row]];
+                }
+            }
+        }
+    } else {
+        // One sweep per function pulls d(function)/d(step) back to the inputs.
+        std::vector<char> filled(entries.size());
+        for (std::size_t row = 0; row < functions.size(); row++) {
+            std::vector<Expression<Num>> adjoint(n, Expression<Num>(0));
+            std::vector<char> live(n);
+            std::uint32_t output = tape.outputs[row];
+            adjoint[output] = Expression<Num>(1);
+            live[output] = tape.varying[output];
+            for (std::uint32_t i = output + 1; i-- > 0;) {
+                if (!live[i]) continue;
+                const Expression<Num> &step = tape.steps[i];
+                if (step.kind() == NodeKind::Variable) {
+                    std::size_t k = find(row, cols.at(static_cast<const Variable<Num> &>(step.node()).name()));
+                    accumulate(entries[k], filled[k], adjoint[i], Expression<Num>(1), false);
+                    continue;
+                }
+                if (step.kind() == NodeKind::Poly) {
+                    std::set<std::string> names;
+                    step.node().collect_variables(names);
+                    for (const auto &name : names) {
+                        auto col = cols.find(name);
+                        if (col == cols.end()) continue;
+                        std::size_t k = find(row, col->second);
+                        accumulate(entries[k], filled[k], adjoint[i], step.expand_dif(name), false);
+                    }
+                    continue;
+                }
+                for (int k = 0; k < (int) step.node().arity(); k++) {
+                    std::uint32_t operand = tape.operands[i][k];
+                    if (!tape.varying[operand]) continue;
+                    bool negative;
+                    Expression<Num> factor = partial(tape, i, k, negative);
+                    accumulate(adjoint[operand], live[operand], adjoint[i], factor, negative);
+                }
+            }
+        }
+    }
+    return entries;
+}
+
+template<typename Num>
+std::size_t Jacobian<Num>::rows() const {
+    return _row_start.size() - 1;
+}
+
+template<typename Num>
+std::size_t Jacobian<Num>::cols() const {
+    return _cols;
+}
+
+template<typename Num>
+std::size_t Jacobian<Num>::nonzeros() const {
+    return _columns.size();
+}
+
+template<typename Num>
+const std::vector<std::string> &Jacobian<Num>::inputs() const {
+    return _inputs;
+}
+
+template<typename Num>
+JacobianMode Jacobian<Num>::mode() const {
+    return _mode;
+}
+
+template<typename Num>
+const std::vector<std::size_t> &Jacobian<Num>::row_start() const {
+    return _row_start;
+}
+
+template<typename Num>
+const std::vector<std::size_t> &Jacobian<Num>::columns() const {
+    return _columns;
+}
+
+template<typename Num>
+const Expression<Num> &Jacobian<Num>::entry(std::size_t index) const {
+    return _entries.at(index);
+}
+
+template<typename Num>
+const Program<Num> &Jacobian<Num>::program() const {
+    return _program;
+}
+
+template<typename Num>
+void Jacobian<Num>::eval(const Num *point, Num *values) const {
+    _program.eval(point, values);
+}
+
+template<typename Num>
+std::vector<Num> Jacobian<Num>::eval(const std::map<std::string, Num> &substitution) const {
+    std::vector<Num> point(_inputs.size());
+    for (std::size_t i = 0; i < _inputs.size(); i++) {
+        auto it = substitution.find(_inputs[i]);
+        if (it == substitution.end()) {
+            throw std::out_of_range("no value for variable " + _inputs[i]);
+        }
+        point[i] = it->second;
+    }
+    std::vector<Num> values(nonzeros());
+    eval(point.data(), values.data());
+    return values;
+}
+
+template<typename Num>
+void Jacobian<Num>::eval_dense(const Num *point, Num *out) const {
+    std::vector<Num> values(nonzeros());
+    eval(point, values.data());
+    std::fill_n(out, rows() * _cols, Num(0));
+    for (std::size_t row = 0; row < rows(); row++) {
+        for (std::size_t k = _row_start[row]; k < _row_start[row + 1]; k++) {
+            out[row * _cols + _columns[k]] = values[k];
+        }
+    }
+}
+
+template<typename Num>
+void Jacobian<Num>::eval_batch(const Num *const *columns, std::size_t rows, Num *const *out) const {
+    _program.eval_batch(columns, rows, out);
+}
+
+
+template
+class Jacobian<double>;
+
+template
+class Jacobian<std::complex<double>>;
@@ -0,0 +1,75 @@
+#ifndef JACOBIAN_HPP
+#define JACOBIAN_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include "expression.hpp"
+#include "compiled.hpp"
+
+
+enum class JacobianMode {
+    Automatic,
+    Forward,
+    Reverse
+};
+
+// Sparse Jacobian of a vector function, stored by rows: row i holds entries
+// row_start()[i] .. row_start()[i + 1] - 1, entry k sitting in column
+// columns()[k]. The pattern comes from the variables each function mentions.
+// All entries are derived on one shared tape, with one sweep per variable
+// (forward) or per function (reverse), and compiled into a single program.
+// Inputs are the variables followed by parameters.
+template<typename Num = rational>
+class Jacobian {
+public:
+    // Variables default to every free variable that is not a parameter;
+    // Automatic picks forward mode unless there are more variables than
+    // functions.
+    Jacobian(const std::vector<Expression<Num>> &functions, std::vector<std::string> variables = {},
+             std::vector<std::string> parameters = {}, JacobianMode mode = JacobianMode::Automatic);
+
+    std::size_t rows() const;
+
+    std::size_t cols() const;
+
+    std::size_t nonzeros() const;
+
+    const std::vector<std::string> &inputs() const;
+
+    JacobianMode mode() const;
+
+    const std::vector<std::size_t> &row_start() const;
+
+    const std::vector<std::size_t> &columns() const;
+
+    const Expression<Num> &entry(std::size_t index) const;
+
+    const Program<Num> &program() const;
+
+    // Writes the nonzero entries in storage order.
+    void eval(const Num *point, Num *values) const;
+
+    std::vector<Num> eval(const std::map<std::string, Num> &substitution) const;
+
+    // Row-major rows() x cols() matrix with the zeros filled in.
+    void eval_dense(const Num *point, Num *out) const;
+
+    // Writes entry k of row r to out[k][r]; null outputs are skipped.
+    void eval_batch(const Num *const *columns, std::size_t rows, Num *const *out) const;
+
+private:
+    std::vector<Expression<Num>> derive(const std::vector<Expression<Num>> &functions);
+
+    std::size_t find(std::size_t row, std::size_t col) const;
+
+    std::vector<std::string> _inputs;
+    std::size_t _cols;
+    JacobianMode _mode;
+    std::vector<std::size_t> _row_start;
+    std::vector<std::size_t> _columns;
+    std::vector<Expression<Num>> _entries;
+    Program<Num> _program;
+};
+
+#endif
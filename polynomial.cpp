@@ -0,0 +1,713 @@
+#include "polynomial.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+
+
+namespace {
+
+const std::size_t max_terms = 4096;
+const unsigned max_exponent = 64;
+
+template<typename Num>
+Num power(Num base, unsigned exponent) {
+    Num result = Num(1);
+    while (exponent) {
+        if (exponent & 1u) result *= base;
+        base *= base;
+        exponent >>= 1u;
+    }
+    return result;
+}
+
+inline bool integer_exponent(rational value, int &out) {
+    if (std::floor(value) != value || std::abs(value) > max_exponent) return false;
+    out = (int) value;
+    return true;
+}
+
+inline bool integer_exponent(complex value, int &out) {
+    return value.imag() == 0 && integer_exponent(value.real(), out);
+}
+
+std::vector<std::string> merged(const std::vector<std::string> &lhs, const std::vector<std::string> &rhs) {
+    std::vector<std::string> vars;
+    std::set_union(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), std::back_inserter(vars));
+    return vars;
+}
+
+}
+
+
+template<typename Num>
+Polynomial<Num>::Polynomial(Num constant) {
+    if (constant != Num(0)) {
+        _coefficients.push_back(constant);
+    }
+}
+
+template<typename Num>
+Polynomial<Num> Polynomial<Num>::variable(const std::string &name) {
+    Polynomial<Num> res;
+    res._vars = {name};
+    res._exponents = {1};
+    res._coefficients = {Num(1)};
+    res.normalize();
+    return res;
+}
+
+template<typename Num>
+const std::vector<std::string> &Polynomial<Num>::variables() const {
+    return _vars;
+}
+
+template<typename Num>
+std::size_t Polynomial<Num>::terms() const {
+    return _coefficients.size();
+}
+
+template<typename Num>
+unsigned Polynomial<Num>::degree() const {
+    unsigned res = 0;
+    for (std::size_t t = 0; t < terms(); t++) {
+        unsigned total = 0;
+        for (std::size_t v = 0; v < _vars.size(); v++) {
+            total += exponent(t, v);
+        }
+        res = std::max(res, total);
+    }
+    return res;
+}
+
+template<typename Num>
+bool Polynomial<Num>::is_constant() const {
+    return _vars.empty();
+}
+
+template<typename Num>
+Num Polynomial<Num>::constant() const {
+    return _coefficients.empty() ? Num(0) : _coefficients.back();
+}
+
+template<typename Num>
+unsigned Polynomial<Num>::exponent(std::size_t term, std::size_t var) const {
+    return _exponents[term * _vars.size() + var];
+}
+
+template<typename Num>
+Polynomial<Num> Polynomial<Num>::aligned(const std::vector<std::string> &vars) const {
+    if (vars == _vars) return *this;
+    std::vector<std::size_t> position(_vars.size());
+    for (std::size_t v = 0; v < _vars.size(); v++) {
+        position[v] = std::lower_bound(vars.begin(), vars.end(), _vars[v]) - vars.begin();
+    }
+    Polynomial<Num> res;
+    res._vars = vars;
+    res._coefficients = _coefficients;
+    res._exponents.assign(terms() * vars.size(), 0);
+    for (std::size_t t = 0; t < terms(); t++) {
+        for (std::size_t v = 0; v < _vars.size(); v++) {
+            res._exponents[t * vars.size() + position[v]] = exponent(t, v);
+        }
+    }
+    return res;
+}
+
+template<typename Num>
+void Polynomial<Num>::normalize() {
+    std::size_t width = _vars.size();
+    std::vector<std::size_t> order(terms());
+    std::iota(order.begin(), order.end(), 0);
+    auto row = [&](std::size_t t) { return _exponents.begin() + t * width; };
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return std::lexicographical_compare(row(b), row(b) + width, row(a), row(a) + width);
+    });
+
+    std::vector<unsigned> exponents;
+    std::vector<Num> coefficients;
+    for (std::size_t i = 0; i < order.size(); i++) {
+        std::size_t t = order[i];
+        if (!coefficients.empty() && std::equal(row(t), row(t) + width, exponents.end() - width)) {
+            coefficients.back() += _coefficients[t];
+        } else {
+            if (!coefficients.empty() && coefficients.back() == Num(0)) {
+                coefficients.pop_back();
+                exponents.resize(exponents.size() - width);
+            }
+            coefficients.push_back(_coefficients[t]);
+            exponents.insert(exponents.end(), row(t), row(t) + width);
+        }
+    }
+    if (!coefficients.empty() && coefficients.back() == Num(0)) {
+        coefficients.pop_back();
+        exponents.resize(exponents.size() - width);
+    }
+
+    std::vector<std::size_t> used;
+    for (std::size_t v = 0; v < width; v++) {
+        for (std::size_t t = 0; t < coefficients.size(); t++) {
+            if (exponents[t * width + v]) {
+                used.push_back(v);
+                break;
+            }
+        }
+    }
+    if (used.size() != width) {
+        std::vector<std::string> vars;
+        std::vector<unsigned> compact;
+        for (auto v : used) vars.push_back(_vars[v]);
+        for (std::size_t t = 0; t < coefficients.size(); t++) {
+            for (auto v : used) compact.push_back(exponents[t * width + v]);
+        }
+        _vars = std::move(vars);
+        exponents = std::move(compact);
+    }
+    _exponents = std::move(exponents);
+    _coefficients = std::move(coefficients);
+
+    _dense.clear();
+    if (_vars.size() == 1 && (degree() + 1) <= 2 * terms()) {
+        _dense.assign(degree() + 1, Num(0));
+        for (std::size_t t = 0; t < terms(); t++) {
+            _dense[exponent(t, 0)] = _coefficients[t];
+        }
+    }
+}
+
+template<typename Num>
+Polynomial<Num> Polynomial<Num>::operator+(const Polynomial<Num> &rhs) const {
+    auto vars = merged(_vars, rhs._vars);
+    Polynomial<Num> res = aligned(vars);
+    Polynomial<Num> other = rhs.aligned(vars);
+    res._exponents.insert(res._exponents.end(), other._exponents.begin(), other._exponents.end());
+    res._coefficients.insert(res._coefficients.end(), other._coefficients.begin(), other._coefficients.end());
+    res.normalize();
+    return res;
+}
+
+template<typename Num>
+Polynomial<Num> Polynomial<Num>::operator-(const Polynomial<Num> &rhs) const {
+    return *this + rhs * Polynomial<Num>(Num(-1));
+}
+
+template<typename Num>
+Polynomial<Num> Polynomial<Num>::operator*(const Polynomial<Num> &rhs) const {
+    auto vars = merged(_vars, rhs._vars);
+    Polynomial<Num> lhs = aligned(vars);
+    Polynomial<Num> other = rhs.aligned(vars);
+    Polynomial<Num> res;
+    res._vars = vars;
+    res._coefficients.reserve(lhs.terms() * other.terms());
+    res._exponents.reserve(lhs.terms() * other.terms() * vars.size());
+    for (std::size_t a = 0; a < lhs.terms(); a++) {
+        for (std::size_t b = 0; b < other.terms(); b++) {
+            res._coefficients.push_back(lhs._coefficients[a] * other._coefficients[b]);
+            for (std::size_t v = 0; v < vars.size(); v++) {
+                res._exponents.push_back(lhs.exponent(a, v) + other.exponent(b, v));
+            }
+        }
+    }
+    res.normalize();
+    return res;
+}
+
+template<typename Num>
+Polynomial<Num> Polynomial<Num>::pow(unsigned exponent) const {
+    Polynomial<Num> result;
+    pow(exponent, std::numeric_limits<std::size_t>::max(), result);
+    return result;
+}
+
+template<typename Num>
+bool Polynomial<Num>::pow(unsigned exponent, std::size_t limit, Polynomial<Num> &result) const {
+    result = Polynomial<Num>(Num(1));
+    Polynomial<Num> base = *this;
+    while (exponent) {
+        if (exponent & 1u) {
+            result = result * base;
+            if (result.terms() > limit) return false;
+        }
+        exponent >>= 1u;
+        if (exponent) {
+            base = base * base;
+            if (base.terms() > limit) return false;
+        }
+    }
+    return true;
+}
+
+template<typename Num>
+Polynomial<Num> Polynomial<Num>::derivative(const std::string &var) const {
+    auto it = std::lower_bound(_vars.begin(), _vars.end(), var);
+    if (it == _vars.end() || *it != var) return Polynomial<Num>();
+    std::size_t index = it - _vars.begin();
+    Polynomial<Num> res;
+    res._vars = _vars;
+    for (std::size_t t = 0; t < terms(); t++) {
+        unsigned e = exponent(t, index);
+        if (!e) continue;
+        res._coefficients.push_back(_coefficients[t] * Num(e));
+        res._exponents.insert(res._exponents.end(), _exponents.begin() + t * _vars.size(),
+                              _exponents.begin() + (t + 1) * _vars.size());
+        res._exponents[res._exponents.size() - _vars.size() + index] -= 1;
+    }
+    res.normalize();
+    return res;
+}
+
+// Recursive Horner scheme: terms sharing an exponent of `var` form a
+// polynomial in the remaining variables.
+template<typename Num>
+Num Polynomial<Num>::horner(std::size_t begin, std::size_t end, std::size_t var, const Num *point) const {
+    if (var == _vars.size()) return _coefficients[begin];
+    Num acc = Num(0);
+    unsigned previous = exponent(begin, var);
+    std::size_t i = begin;
+    while (i < end) {
+        unsigned e = exponent(i, var);
+        std::size_t j = i;
+        while (j < end && exponent(j, var) == e) j++;
+        acc = acc * power(point[var], previous - e) + horner(i, j, var + 1, point);
+        previous = e;
+        i = j;
+    }
+    return acc * power(point[var], previous);
+}
+
+template<typename Num>
+Num Polynomial<Num>::estrin(Num x) const {
+    std::array<Num, 64> buffer;
+    std::size_t size = _dense.size();
+    std::copy(_dense.begin(), _dense.end(), buffer.begin());
+    while (size > 1) {
+        std::size_t half = (size + 1) / 2;
+        for (std::size_t i = 0; i < size / 2; i++) {
+            buffer[i] = buffer[2 * i] + buffer[2 * i + 1] * x;
+        }
+        if (size % 2) buffer[half - 1] = buffer[size - 1];
+        size = half;
+        x *= x;
+    }
+    return buffer[0];
+}
+
+template<typename Num>
+Num Polynomial<Num>::eval(const Num *point) const {
+    if (_coefficients.empty()) return Num(0);
+    if (_vars.empty()) return _coefficients[0];
+    if (!_dense.empty()) {
+        if (_dense.size() > 8 && _dense.size() <= 64) return estrin(point[0]);
+        Num acc = _dense.back();
+        for (std::size_t i = _dense.size() - 1; i-- > 0;) {
+            acc = acc * point[0] + _dense[i];
+        }
+        return acc;
+    }
+    return horner(0, terms(), 0, point);
+}
+
+template<typename Num>
+Num Polynomial<Num>::eval(const std::map<std::string, Num> &substitution) const {
+    std::vector<Num> point(_vars.size());
+    for (std::size_t v = 0; v < _vars.size(); v++) {
+        auto it = substitution.find(_vars[v]);
+        if (it == substitution.end()) {
+            throw std::out_of_range("no value for variable " + _vars[v]);
+        }
+        point[v] = it->second;
+    }
+    return eval(point.data());
+}
+
+template<typename Num>
+Expression<Num> Polynomial<Num>::to_expression() const {
+    if (_coefficients.empty()) return Expression<Num>(0);
+    std::vector<Expression<Num>> summands;
+    for (std::size_t t = 0; t < terms(); t++) {
+        std::vector<Expression<Num>> factors;
+        if (_coefficients[t] != Num(1)) factors.emplace_back(_coefficients[t]);
+        for (std::size_t v = 0; v < _vars.size(); v++) {
+            unsigned e = exponent(t, v);
+            if (!e) continue;
+            Expression<Num> var(make_node<Variable<Num>>(_vars[v]));
+            factors.push_back(e == 1 ? var : var ^ Expression<Num>(Num(e)));
+        }
+        if (factors.empty()) factors.emplace_back(_coefficients[t]);
+        Expression<Num> term = factors[0];
+        for (std::size_t i = 1; i < factors.size(); i++) term = term * factors[i];
+        summands.push_back(term);
+    }
+    Expression<Num> res = summands[0];
+    for (std::size_t i = 1; i < summands.size(); i++) res = res + summands[i];
+    return res;
+}
+
+
+template<typename Num>
+std::uint64_t Polynomial<Num>::hash() const {
+    std::uint64_t res = _vars.size();
+    for (const auto &var : _vars) {
+        res = hash_combine(res, std::hash<std::string>()(var));
+    }
+    for (unsigned exponent : _exponents) {
+        res = hash_combine(res, exponent);
+    }
+    for (const Num &coefficient : _coefficients) {
+        res = hash_combine(res, number_hash(coefficient));
+    }
+    return res;
+}
+
+template<typename Num>
+bool Polynomial<Num>::operator==(const Polynomial<Num> &rhs) const {
+    if (_vars != rhs._vars || _exponents != rhs._exponents || _coefficients.size() != rhs._coefficients.size()) {
+        return false;
+    }
+    for (std::size_t t = 0; t < _coefficients.size(); t++) {
+        if (!same_number(_coefficients[t], rhs._coefficients[t])) return false;
+    }
+    return true;
+}
+
+
+template<typename Num>
+PolyExpr<Num>::PolyExpr(Polynomial<Num> numerator, Polynomial<Num> denominator)
+        : _numerator(std::move(numerator)), _denominator(std::move(denominator)) {
+    this->seal(hash_combine(_numerator.hash(), _denominator.hash()));
+}
+
+template<typename Num>
+Num PolyExpr<Num>::eval(std::map<std::string, Num> substitution) const {
+    if (_denominator.is_constant()) {
+        return _numerator.eval(substitution) / _denominator.constant();
+    }
+    return _numerator.eval(substitution) / _denominator.eval(substitution);
+}
+
+template<typename Num>
+std::string PolyExpr<Num>::to_string() const {
+    return lowered().to_string();
+}
+
+template<typename Num>
+Expression<Num> PolyExpr<Num>::sub(std::map<std::string, Num> substitution) const {
+    return polynomial_form(lowered().sub(substitution));
+}
+
+template<typename Num>
+std::uint64_t PolyExpr<Num>::compute_signature() const {
+    std::set<std::string> variables;
+    collect_variables(variables);
+    std::uint64_t res = 0;
+    for (const auto &var : variables) {
+        res |= variable_bit(var);
+    }
+    return res;
+}
+
+template<typename Num>
+Expression<Num> PolyExpr<Num>::dif(std::string substitution) const {
+    Polynomial<Num> slope = _numerator.derivative(substitution);
+    if (_denominator.is_constant()) {
+        return Expression<Num>(make_node<PolyExpr<Num>>(slope, _denominator));
+    }
+    return Expression<Num>(make_node<PolyExpr<Num>>(
+            slope * _denominator - _numerator * _denominator.derivative(substitution),
+            _denominator * _denominator));
+}
+
+template<typename Num>
+std::pair<Num, Num> PolyExpr<Num>::eval_dif(const std::map<std::string, Num> &substitution,
+                                            const std::string &var) const {
+    Expression<Num> slope = [&] {
+        std::lock_guard<std::mutex> lock(_slopes_mutex);
+        auto it = _slopes.find(var);
+        if (it == _slopes.end()) {
+            it = _slopes.emplace(var, dif(var)).first;
+        }
+        return it->second;
+    }();
+    return {eval(substitution), slope.eval(substitution)};
+}
+
+template<typename Num>
+NodeKind PolyExpr<Num>::kind() const {
+    return NodeKind::Poly;
+}
+
+template<typename Num>
+void PolyExpr<Num>::collect_variables(std::set<std::string> &variables) const {
+    variables.insert(_numerator.variables().begin(), _numerator.variables().end());
+    variables.insert(_denominator.variables().begin(), _denominator.variables().end());
+}
+
+template<typename Num>
+const Polynomial<Num> &PolyExpr<Num>::numerator() const {
+    return _numerator;
+}
+
+template<typename Num>
+const Polynomial<Num> &PolyExpr<Num>::denominator() const {
+    return _denominator;
+}
+
+template<typename Num>
+bool PolyExpr<Num>::same_data(const ExpressionTempl<Num> &other) const {
+    const auto &poly = static_cast<const PolyExpr<Num> &>(other);
+    return _numerator == poly._numerator && _denominator == poly._denominator;
+}
+
+template<typename Num>
+Expression<Num> PolyExpr<Num>::lowered() const {
+    if (_denominator.is_constant() && _denominator.constant() == Num(1)) {
+        return _numerator.to_expression();
+    }
+    return _numerator.to_expression() / _denominator.to_expression();
+}
+
+
+namespace {
+
+template<typename Num>
+void reduce(Polynomial<Num> &numerator, Polynomial<Num> &denominator) {
+    if (denominator.is_constant() && denominator.constant() != Num(1)) {
+        numerator = numerator * Polynomial<Num>(Num(1) / denominator.constant());
+        denominator = Polynomial<Num>(Num(1));
+    }
+}
+
+template<typename Num>
+Expression<Num> wrap(const Expression<Num> &original, Polynomial<Num> numerator, Polynomial<Num> denominator) {
+    NodeKind kind = original.kind();
+    if (kind == NodeKind::Value || kind == NodeKind::Variable || kind == NodeKind::Poly) {
+        return original;
+    }
+    return Expression<Num>(make_node<PolyExpr<Num>>(std::move(numerator), std::move(denominator)));
+}
+
+template<typename Num>
+struct Conversion {
+    bool ok;
+    Polynomial<Num> numerator;
+    Polynomial<Num> denominator;
+    // With ok unset: the expression with every maximal rational subtree
+    // replaced by a PolyExpr.
+    Expression<Num> rebuilt;
+};
+
+// Operands a conversion looks at; a derivative stands for its expansion.
+template<typename Num>
+std::size_t parts_of(const Expression<Num> &expr) {
+    switch (expr.kind()) {
+        case NodeKind::Value:
+        case NodeKind::Variable:
+        case NodeKind::Poly:
+            return 0;
+        case NodeKind::Dif:
+            return 1;
+        default:
+            return expr.node().arity();
+    }
+}
+
+// One node, given the conversions of its operands.
+template<typename Num>
+Conversion<Num> convert_node(const Expression<Num> &expr, std::vector<Conversion<Num>> &parts) {
+    const ExpressionTempl<Num> &node = expr.node();
+    Polynomial<Num> numerator, denominator;
+    switch (expr.kind()) {
+        case NodeKind::Value:
+            return {true, Polynomial<Num>(static_cast<const Value<Num> &>(node).value()), Polynomial<Num>(Num(1)),
+                    expr};
+        case NodeKind::Variable:
+            return {true, Polynomial<Num>::variable(static_cast<const Variable<Num> &>(node).name()),
+                    Polynomial<Num>(Num(1)), expr};
+        case NodeKind::Poly:
+            return {true, static_cast<const PolyExpr<Num> &>(node).numerator(),
+                    static_cast<const PolyExpr<Num> &>(node).denominator(), expr};
+        case NodeKind::Dif:
+            return std::move(parts[0]);
+        default:
+            break;
+    }
+
+    std::size_t arity = parts.size();
+    bool all = std::all_of(parts.begin(), parts.end(), [](const Conversion<Num> &part) { return part.ok; });
+    bool n_ary = expr.kind() == NodeKind::Sum || expr.kind() == NodeKind::Product;
+    bool ok = all && (arity == 2 || n_ary);
+    if (ok && n_ary) {
+        bool sum = expr.kind() == NodeKind::Sum;
+        numerator = Polynomial<Num>(Num(sum ? 0 : 1));
+        denominator = Polynomial<Num>(Num(1));
+        for (std::size_t i = 0; ok && i < arity; i++) {
+            const Polynomial<Num> &bn = parts[i].numerator, &bd = parts[i].denominator;
+            if (sum) {
+                bool negated = static_cast<const SumExpr<Num> &>(node).negated(i);
+                numerator = negated ? numerator * bd - bn * denominator : numerator * bd + bn * denominator;
+                denominator = denominator * bd;
+            } else if (static_cast<const ProductExpr<Num> &>(node).inverted(i)) {
+                ok = bn.terms() != 0;
+                numerator = numerator * bd;
+                denominator = denominator * bn;
+            } else {
+                numerator = numerator * bn;
+                denominator = denominator * bd;
+            }
+            if (ok) {
+                reduce(numerator, denominator);
+                ok = numerator.terms() + denominator.terms() <= max_terms;
+            }
+        }
+    } else if (ok) {
+        const Polynomial<Num> &an = parts[0].numerator, &ad = parts[0].denominator;
+        const Polynomial<Num> &bn = parts[1].numerator, &bd = parts[1].denominator;
+        int k = 0;
+        switch (expr.kind()) {
+            case NodeKind::Add:
+                numerator = an * bd + bn * ad;
+                denominator = ad * bd;
+                break;
+            case NodeKind::Sub:
+                numerator = an * bd - bn * ad;
+                denominator = ad * bd;
+                break;
+            case NodeKind::Mul:
+                numerator = an * bn;
+                denominator = ad * bd;
+                break;
+            case NodeKind::Div:
+                ok = bn.terms() != 0;
+                numerator = an * bd;
+                denominator = ad * bn;
+                break;
+            case NodeKind::Pow:
+                ok = bn.is_constant() && integer_exponent(bn.constant(), k) && (k >= 0 || an.terms() != 0);
+                if (ok) {
+                    unsigned e = k >= 0 ? k : -k;
+                    ok = (k >= 0 ? an : ad).pow(e, max_terms, numerator) &&
+                         (k >= 0 ? ad : an).pow(e, max_terms, denominator);
+                }
+                break;
+            default:
+                ok = false;
+        }
+        if (ok) {
+            reduce(numerator, denominator);
+            ok = numerator.terms() + denominator.terms() <= max_terms;
+        }
+    }
+    if (ok) return {true, std::move(numerator), std::move(denominator), expr};
+
+    std::vector<Expression<Num>> operands;
+    for (std::size_t i = 0; i < arity; i++) {
+        operands.push_back(parts[i].ok ? wrap(node.operand(i), std::move(parts[i].numerator),
+                                              std::move(parts[i].denominator))
+                                       : std::move(parts[i].rebuilt));
+    }
+    return {false, {}, {}, expr.rebuild(operands)};
+}
+
+// Converts bottom-up over an explicit stack, so chains of any depth fit, and
+// once per distinct node. A node's conversion is dropped as soon as its last
+// parent has used it. On failure `rebuilt` holds the expression with every
+// maximal rational subtree replaced by a PolyExpr.
+template<typename Num>
+bool convert(const Expression<Num> &root, Polynomial<Num> &numerator, Polynomial<Num> &denominator,
+             Expression<Num> &rebuilt) {
+    std::unordered_map<const ExpressionTempl<Num> *, std::size_t> uses = {{&root.node(), 1}};
+    std::vector<Expression<Num>> pending = {root};
+    while (!pending.empty()) {
+        Expression<Num> expr = pending.back();
+        pending.pop_back();
+        for (std::size_t i = 0; i < parts_of(expr); i++) {
+            const Expression<Num> &operand = expr.node().operand(i);
+            if (uses[&operand.node()]++ == 0) pending.push_back(operand);
+        }
+    }
+
+    std::unordered_map<const ExpressionTempl<Num> *, Conversion<Num>> done;
+    std::vector<std::pair<Expression<Num>, bool>> stack = {{root, false}};
+    while (!stack.empty()) {
+        auto [expr, visited] = stack.back();
+        stack.pop_back();
+        const ExpressionTempl<Num> *node = &expr.node();
+        if (done.count(node)) continue;
+        std::size_t count = parts_of(expr);
+        if (!visited && count) {
+            stack.emplace_back(expr, true);
+            for (std::size_t i = 0; i < count; i++) {
+                stack.emplace_back(node->operand(i), false);
+            }
+            continue;
+        }
+        std::vector<Conversion<Num>> parts;
+        for (std::size_t i = 0; i < count; i++) {
+            const ExpressionTempl<Num> *operand = &node->operand(i).node();
+            auto it = done.find(operand);
+            if (--uses[operand] == 0) {
+                parts.push_back(std::move(it->second));
+                done.erase(it);
+            } else {
+                parts.push_back(it->second);
+            }
+        }
+        done.emplace(node, convert_node(expr, parts));
+    }
+    Conversion<Num> &res = done.at(&root.node());
+    if (!res.ok) {
+        rebuilt = std::move(res.rebuilt);
+        return false;
+    }
+    numerator = std::move(res.numerator);
+    denominator = std::move(res.denominator);
+    return true;
+}
+
+}
+
+
+template<typename Num>
+bool to_polynomial(const Expression<Num> &expr, Polynomial<Num> &numerator, Polynomial<Num> &denominator) {
+    Expression<Num> rebuilt = expr;
+    return convert(expr, numerator, denominator, rebuilt);
+}
+
+template<typename Num>
+Expression<Num> polynomial_form(const Expression<Num> &expr) {
+    Polynomial<Num> numerator, denominator;
+    Expression<Num> rebuilt = expr;
+    if (convert(expr, numerator, denominator, rebuilt)) {
+        return wrap(expr, std::move(numerator), std::move(denominator));
+    }
+    return rebuilt;
+}
+
+
+template
+class Polynomial<double>;
+
+template
+class Polynomial<std::complex<double>>;
+
+template
+class PolyExpr<double>;
+
+template
+class PolyExpr<std::complex<double>>;
+
+template
+bool to_polynomial(const Expression<double> &expr, Polynomial<double> &numerator, Polynomial<double> &denominator);
+
+template
+bool to_polynomial(const Expression<complex> &expr, Polynomial<complex> &numerator,
+                   Polynomial<complex> &denominator);
+
+template
+Expression<double> polynomial_form(const Expression<double> &expr);
+
+template
+Expression<complex> polynomial_form(const Expression<complex> &expr);
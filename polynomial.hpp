@@ -0,0 +1,122 @@
+#ifndef POLYNOMIAL_HPP
+#define POLYNOMIAL_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include "expression.hpp"
+
+
+// Sparse polynomial: one coefficient per monomial, exponents stored row-major
+// (variables().size() per term), terms sorted in descending lexicographic order.
+template<typename Num = rational>
+class Polynomial {
+public:
+    Polynomial() = default;
+
+    Polynomial(Num constant);
+
+    static Polynomial<Num> variable(const std::string &name);
+
+    const std::vector<std::string> &variables() const;
+
+    std::size_t terms() const;
+
+    unsigned degree() const;
+
+    bool is_constant() const;
+
+    Num constant() const;
+
+    Polynomial<Num> operator+(const Polynomial<Num> &rhs) const;
+
+    Polynomial<Num> operator-(const Polynomial<Num> &rhs) const;
+
+    Polynomial<Num> operator*(const Polynomial<Num> &rhs) const;
+
+    Polynomial<Num> pow(unsigned exponent) const;
+
+    // Stops and returns false as soon as a partial product has more than
+    // `limit` terms, before the expansion grows any further.
+    bool pow(unsigned exponent, std::size_t limit, Polynomial<Num> &result) const;
+
+    Polynomial<Num> derivative(const std::string &var) const;
+
+    Num eval(const Num *point) const;
+
+    Num eval(const std::map<std::string, Num> &substitution) const;
+
+    Expression<Num> to_expression() const;
+
+    // Over the stored form: same variables, exponents and coefficient bits.
+    std::uint64_t hash() const;
+
+    bool operator==(const Polynomial<Num> &rhs) const;
+
+private:
+    Polynomial<Num> aligned(const std::vector<std::string> &vars) const;
+
+    void normalize();
+
+    Num horner(std::size_t begin, std::size_t end, std::size_t var, const Num *point) const;
+
+    Num estrin(Num x) const;
+
+    unsigned exponent(std::size_t term, std::size_t var) const;
+
+    std::vector<std::string> _vars;
+    std::vector<unsigned> _exponents;
+    std::vector<Num> _coefficients;
+    std::vector<Num> _dense;
+};
+
+
+// Rational function numerator / denominator kept in coefficient form.
+template<typename Num = rational>
+class PolyExpr : public ExpressionTempl<Num> {
+public:
+    PolyExpr(Polynomial<Num> numerator, Polynomial<Num> denominator = Polynomial<Num>(Num(1)));
+
+    ~PolyExpr() override = default;
+
+    Num eval(std::map<std::string, Num> substitution) const override;
+
+    std::string to_string() const override;
+
+    Expression<Num> sub(std::map<std::string, Num> substitution) const override;
+
+    Expression<Num> dif(std::string substitution) const override;
+
+    std::pair<Num, Num> eval_dif(const std::map<std::string, Num> &substitution,
+                                 const std::string &var) const override;
+
+    NodeKind kind() const override;
+
+    void collect_variables(std::set<std::string> &variables) const override;
+
+    const Polynomial<Num> &numerator() const;
+
+    const Polynomial<Num> &denominator() const;
+
+    Expression<Num> lowered() const;
+
+    bool same_data(const ExpressionTempl<Num> &other) const override;
+
+protected:
+    std::uint64_t compute_signature() const override;
+
+private:
+    Polynomial<Num> _numerator;
+    Polynomial<Num> _denominator;
+    mutable std::mutex _slopes_mutex;
+    mutable std::map<std::string, Expression<Num>> _slopes;
+};
+
+template<typename Num = rational>
+bool to_polynomial(const Expression<Num> &expr, Polynomial<Num> &numerator, Polynomial<Num> &denominator);
+
+template<typename Num = rational>
+Expression<Num> polynomial_form(const Expression<Num> &expr);
+
+#endif
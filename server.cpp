@@ -0,0 +1,314 @@
+#include "server.hpp"
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+namespace {
+
+std::string trim(const std::string &str) {
+    std::size_t begin = str.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) return "";
+    std::size_t end = str.find_last_not_of(" \t\r\n");
+    return str.substr(begin, end - begin + 1);
+}
+
+template<typename Num>
+std::string format(Num value) {
+    std::ostringstream out;
+    out << std::setprecision(17) << value;
+    return out.str();
+}
+
+void write_all(int fd, const std::string &data) {
+    std::size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n <= 0) return;
+        written += n;
+    }
+}
+
+}
+
+
+// A cache of no entries would evict every value as it is inserted.
+template<typename Value>
+LruCache<Value>::LruCache(std::size_t capacity) : _capacity(capacity) {
+    if (_capacity == 0) {
+        throw std::invalid_argument("cache capacity must be positive");
+    }
+}
+
+template<typename Value>
+Value *LruCache<Value>::find(const std::string &key) {
+    auto it = _index.find(key);
+    if (it == _index.end()) {
+        _misses++;
+        return nullptr;
+    }
+    _hits++;
+    _entries.splice(_entries.begin(), _entries, it->second);
+    return &it->second->second;
+}
+
+template<typename Value>
+Value &LruCache<Value>::insert(const std::string &key, Value value) {
+    auto it = _index.find(key);
+    if (it != _index.end()) {
+        _entries.erase(it->second);
+        _index.erase(it);
+    }
+    _entries.emplace_front(key, std::move(value));
+    _index[key] = _entries.begin();
+    while (_entries.size() > _capacity) {
+        _index.erase(_entries.back().first);
+        _entries.pop_back();
+    }
+    return _entries.front().second;
+}
+
+template<typename Value>
+std::size_t LruCache<Value>::size() const {
+    return _entries.size();
+}
+
+template<typename Value>
+std::size_t LruCache<Value>::hits() const {
+    return _hits;
+}
+
+template<typename Value>
+std::size_t LruCache<Value>::misses() const {
+    return _misses;
+}
+
+
+Server::Server(std::size_t capacity) : _real(capacity), _complex(capacity),
+                                       _started(std::chrono::steady_clock::now()) {}
+
+// Parses outside the lock; two threads missing on the same key both parse
+// it, and the later insert wins.
+template<typename Num>
+std::shared_ptr<const CompiledEntry<Num>> Server::lookup(LruCache<std::shared_ptr<const CompiledEntry<Num>>> &cache,
+                                                         const std::string &expr, const std::string &var) {
+    std::string key = (var.empty() ? "e " : "d " + var + " ") + expr;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (auto *entry = cache.find(key)) {
+            return *entry;
+        }
+    }
+    if (expr.find_first_not_of(' ') == std::string::npos) {
+        throw std::invalid_argument("empty expression");
+    }
+    Expression<Num> expression(expr);
+    if (!var.empty()) {
+        expression = expression.dif(var);
+    }
+    std::string text = var.empty() ? "" : expression.to_string();
+    auto entry = std::make_shared<const CompiledEntry<Num>>(expression, std::move(text));
+    std::lock_guard<std::mutex> lock(_mutex);
+    return cache.insert(key, std::move(entry));
+}
+
+std::string Server::eval(const std::string &expr, const std::string &args) {
+    std::map<std::string, complex> c_vars;
+    std::map<std::string, rational> r_vars;
+    bool is_complex = false;
+    std::istringstream tokens(args);
+    std::string token;
+    while (tokens >> token) {
+        if (token.back() == ',') token.pop_back();
+        if (token.empty()) continue;
+        std::size_t eq = token.find('=');
+        if (eq == std::string::npos) {
+            throw std::invalid_argument("expected var=value, got " + token);
+        }
+        std::string var = token.substr(0, eq);
+        std::string value = token.substr(eq + 1);
+        if (!value.empty() && value[0] == '(') {
+            std::size_t com = value.find(',');
+            if (com == std::string::npos) {
+                throw std::invalid_argument("wrong complex value, should be (x,y)");
+            }
+            c_vars[var] = complex(std::stod(value.substr(1, com - 1)), std::stod(value.substr(com + 1)));
+            is_complex = true;
+        } else {
+            r_vars[var] = std::stod(value);
+            c_vars[var] = complex(r_vars[var], 0);
+        }
+    }
+    if (is_complex) {
+        return "ok " + format(lookup(_complex, expr, "")->program().eval(c_vars));
+    }
+    return "ok " + format(lookup(_real, expr, "")->program().eval(r_vars));
+}
+
+std::string Server::diff(const std::string &expr, const std::string &var) {
+    if (var.empty()) {
+        throw std::invalid_argument("diff needs a variable after |");
+    }
+    return "ok " + lookup(_complex, expr, var)->text;
+}
+
+std::string Server::handle(const std::string &line) {
+    auto start = std::chrono::steady_clock::now();
+    std::string request = trim(line);
+    std::size_t space = request.find(' ');
+    std::string cmd = request.substr(0, space);
+    std::string rest = space == std::string::npos ? "" : request.substr(space + 1);
+    std::size_t bar = rest.find('|');
+    std::string expr = trim(rest.substr(0, bar));
+    std::string args = bar == std::string::npos ? "" : trim(rest.substr(bar + 1));
+
+    std::string response;
+    bool failed = false;
+    try {
+        if (cmd == "eval") {
+            response = eval(expr, args);
+        } else if (cmd == "diff") {
+            response = diff(expr, args);
+        } else if (cmd == "stats") {
+            ServerStats s = stats();
+            std::ostringstream out;
+            out << "ok requests=" << s.requests << " errors=" << s.errors << " hits=" << s.hits
+                << " misses=" << s.misses << " entries=" << s.entries << " mean_latency_us=" << s.mean_latency_us
+                << " max_latency_us=" << s.max_latency_us << " throughput=" << s.throughput;
+            response = out.str();
+        } else {
+            throw std::invalid_argument("unknown command " + cmd);
+        }
+    } catch (const std::exception &e) {
+        failed = true;
+        response = std::string("error ") + e.what();
+    }
+
+    double latency = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _errors += failed;
+    _requests++;
+    _total_latency_us += latency;
+    _max_latency_us = std::max(_max_latency_us, latency);
+    return response;
+}
+
+// Responses are flushed only once the input has no more buffered requests,
+// so a client that pipelines many lines gets them back in one write.
+void Server::serve(std::istream &in, std::ostream &out) {
+    std::string line;
+    while (std::getline(in, line)) {
+        std::string request = trim(line);
+        if (request == "quit") break;
+        if (request.empty()) continue;
+        out << handle(request) << '\n';
+        if (in.rdbuf()->in_avail() <= 0) out.flush();
+    }
+    out.flush();
+}
+
+// Every connection is served on its own thread. "quit" closes the current
+// connection; "shutdown" stops accepting, closes the others and returns once
+// they are done.
+void Server::serve_socket(const std::string &path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error(std::strerror(errno));
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        close(fd);
+        throw std::invalid_argument("socket path too long");
+    }
+    std::strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        std::string error = std::strerror(errno);
+        close(fd);
+        throw std::runtime_error(error);
+    }
+
+    for (;;) {
+        int client = accept(fd, nullptr, nullptr);
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (client < 0) {
+            if (errno == EINTR && !_stopping) continue;
+            break;
+        }
+        if (_stopping) {
+            close(client);
+            break;
+        }
+        _clients.insert(client);
+        std::thread(&Server::serve_client, this, client, fd).detach();
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stopping = true;
+    for (int client : _clients) {
+        ::shutdown(client, SHUT_RDWR);
+    }
+    _idle.wait(lock, [this] { return _clients.empty(); });
+    _stopping = false;
+    lock.unlock();
+    close(fd);
+    unlink(path.c_str());
+}
+
+// Shutting the listener down wakes the accept() in serve_socket.
+void Server::serve_client(int client, int listener) {
+    std::string pending;
+    std::vector<char> buffer(1 << 16);
+    bool open = true;
+    while (open) {
+        ssize_t n = read(client, buffer.data(), buffer.size());
+        if (n <= 0) break;
+        pending.append(buffer.data(), n);
+        std::string responses;
+        std::size_t newline;
+        while ((newline = pending.find('\n')) != std::string::npos) {
+            std::string request = trim(pending.substr(0, newline));
+            pending.erase(0, newline + 1);
+            if (request == "quit" || request == "shutdown") {
+                if (request == "shutdown") {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _stopping = true;
+                    ::shutdown(listener, SHUT_RDWR);
+                }
+                open = false;
+                break;
+            }
+            if (!request.empty()) responses += handle(request) + '\n';
+        }
+        write_all(client, responses);
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    close(client);
+    _clients.erase(client);
+    if (_clients.empty()) _idle.notify_all();
+}
+
+ServerStats Server::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    ServerStats s;
+    s.requests = _requests;
+    s.errors = _errors;
+    s.hits = _real.hits() + _complex.hits();
+    s.misses = _real.misses() + _complex.misses();
+    s.entries = _real.size() + _complex.size();
+    s.mean_latency_us = _requests ? _total_latency_us / _requests : 0;
+    s.max_latency_us = _max_latency_us;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _started).count();
+    s.throughput = elapsed > 0 ? _requests / elapsed : 0;
+    return s;
+}
+
+
+template
+class LruCache<std::shared_ptr<const CompiledEntry<double>>>;
+
+template
+class LruCache<std::shared_ptr<const CompiledEntry<std::complex<double>>>>;
@@ -0,0 +1,118 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include "expression.hpp"
+#include "compiled.hpp"
+
+
+template<typename Value>
+class LruCache {
+public:
+    explicit LruCache(std::size_t capacity);
+
+    Value *find(const std::string &key);
+
+    Value &insert(const std::string &key, Value value);
+
+    std::size_t size() const;
+
+    std::size_t hits() const;
+
+    std::size_t misses() const;
+
+private:
+    using Entry = std::pair<std::string, Value>;
+
+    std::size_t _capacity;
+    std::list<Entry> _entries;
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> _index;
+    std::size_t _hits = 0;
+    std::size_t _misses = 0;
+};
+
+// The program is compiled on its first use; diff entries only need the text.
+template<typename Num = rational>
+struct CompiledEntry {
+    CompiledEntry(Expression<Num> expression, std::string text)
+            : expression(std::move(expression)), text(std::move(text)) {}
+
+    const Program<Num> &program() const {
+        return _program.get([this] { return Program<Num>(expression); });
+    }
+
+    Expression<Num> expression;
+    std::string text;
+
+private:
+    Lazy<Program<Num>> _program;
+};
+
+struct ServerStats {
+    std::size_t requests = 0;
+    std::size_t errors = 0;
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t entries = 0;
+    double mean_latency_us = 0;
+    double max_latency_us = 0;
+    double throughput = 0;
+};
+
+
+// Line protocol, one response line per request:
+//   eval <expression> [| x=a, y=(re,im), ...]   ->  ok <value>
+//   diff <expression> | <var>                   ->  ok <derivative>
+//   stats                                       ->  ok requests=... hits=... ...
+//   quit                                        (closes the connection)
+//   shutdown                                    (stops a socket server)
+// Failures answer "error <message>". Parsed, derived and compiled
+// expressions stay in an LRU shared by every request and connection.
+// handle() may be called from several threads at once.
+class Server {
+public:
+    explicit Server(std::size_t capacity = 1024);
+
+    std::string handle(const std::string &line);
+
+    void serve(std::istream &in, std::ostream &out);
+
+    void serve_socket(const std::string &path);
+
+    ServerStats stats() const;
+
+private:
+    std::string eval(const std::string &expr, const std::string &args);
+
+    std::string diff(const std::string &expr, const std::string &var);
+
+    void serve_client(int client, int listener);
+
+    template<typename Num>
+    std::shared_ptr<const CompiledEntry<Num>> lookup(LruCache<std::shared_ptr<const CompiledEntry<Num>>> &cache,
+                                                     const std::string &expr, const std::string &var);
+
+    // Guards the caches, the counters and the open connections. Entries are
+    // shared so that an eviction cannot free one another thread is using.
+    mutable std::mutex _mutex;
+    std::condition_variable _idle;
+    std::set<int> _clients;
+    bool _stopping = false;
+    LruCache<std::shared_ptr<const CompiledEntry<rational>>> _real;
+    LruCache<std::shared_ptr<const CompiledEntry<complex>>> _complex;
+    std::size_t _requests = 0;
+    std::size_t _errors = 0;
+    double _total_latency_us = 0;
+    double _max_latency_us = 0;
+    std::chrono::steady_clock::time_point _started;
+};
+
+#endif
@@ -0,0 +1,257 @@
+#include "solver.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+
+
+namespace {
+
+template<typename Num>
+std::vector<std::string> inputs_for(const Expression<Num> &function, const std::string &var,
+                                    std::vector<std::string> parameters) {
+    if (parameters.empty()) {
+        for (const auto &name : function.variables()) {
+            if (name != var) parameters.push_back(name);
+        }
+    }
+    parameters.insert(parameters.begin(), var);
+    return parameters;
+}
+
+template<typename Num>
+bool close(Num step, Num x, double tolerance) {
+    return std::abs(step) <= tolerance * (1 + std::abs(x));
+}
+
+}
+
+
+template<typename Num>
+Solver<Num>::Solver(const Expression<Num> &function, const std::string &var, std::vector<std::string> parameters)
+        : _inputs(inputs_for(function, var, std::move(parameters))),
+          _f(function, _inputs),
+          _df(function.dif(var), _inputs),
+          _ddf(function.dif(var).dif(var), _inputs) {}
+
+template<typename Num>
+const std::vector<std::string> &Solver<Num>::inputs() const {
+    return _inputs;
+}
+
+template<typename Num>
+void Solver<Num>::check_parameters(std::size_t count) const {
+    if (count != _inputs.size() - 1) {
+        throw std::invalid_argument("expected " + std::to_string(_inputs.size() - 1) + " parameters, got " +
+                                    std::to_string(count));
+    }
+}
+
+template<typename Num>
+Num Solver<Num>::step(SolverMethod method, Num f, Num df, Num ddf) const {
+    if (method == SolverMethod::Halley) {
+        Num denominator = Num(2) * df * df - f * ddf;
+        if (denominator != Num(0)) return Num(2) * f * df / denominator;
+    }
+    return f / df;
+}
+
+template<typename Num>
+SolverResult<Num> Solver<Num>::solve(Num start, const std::vector<Num> &parameters, SolverMethod method,
+                                     SolverOptions options) const {
+    check_parameters(parameters.size());
+    std::vector<Num> point(_inputs.size());
+    std::copy(parameters.begin(), parameters.end(), point.begin() + 1);
+    point[0] = start;
+    Num fx = _f.eval(point.data());
+    SolverResult<Num> res{start, fx, 0, fx == Num(0)};
+    while (!res.converged && res.iterations < options.max_iterations) {
+        Num x = point[0];
+        Num df = _df.eval(point.data());
+        if (df == Num(0)) break;
+        Num ddf = method == SolverMethod::Halley ? _ddf.eval(point.data()) : Num(0);
+        Num dx = step(method, fx, df, ddf);
+        point[0] = x - dx;
+        Num fn = _f.eval(point.data());
+        for (int halving = 0; halving < options.max_halvings && std::abs(fn) >= std::abs(fx); halving++) {
+            dx /= Num(2);
+            point[0] = x - dx;
+            fn = _f.eval(point.data());
+        }
+        fx = fn;
+        res.iterations++;
+        res.converged = close(dx, point[0], options.tolerance) || fx == Num(0);
+    }
+    res.root = point[0];
+    res.value = fx;
+    return res;
+}
+
+template<typename Num>
+SolverResult<Num> Solver<Num>::bracket(rational lower, rational upper, const std::vector<Num> &parameters,
+                                       SolverOptions options) const {
+    if constexpr (!std::is_same_v<Num, rational>) {
+        throw std::logic_error("bracketing needs a real-valued function");
+    } else {
+        check_parameters(parameters.size());
+        std::vector<Num> point(_inputs.size());
+        std::copy(parameters.begin(), parameters.end(), point.begin() + 1);
+        auto f = [&](rational x) {
+            point[0] = x;
+            return _f.eval(point.data());
+        };
+        rational fl = f(lower), fu = f(upper);
+        if (fl == 0) return {lower, fl, 0, true};
+        if (fu == 0) return {upper, fu, 0, true};
+        if ((fl > 0) == (fu > 0)) {
+            throw std::invalid_argument("bracket does not change sign");
+        }
+        if (fl > 0) std::swap(lower, upper);
+
+        rational x = (lower + upper) / 2;
+        rational dx_old = std::abs(upper - lower);
+        rational dx = dx_old;
+        rational fx = f(x);
+        rational df = _df.eval(point.data());
+        SolverResult<Num> res{x, fx, 0, false};
+        while (res.iterations < options.max_iterations) {
+            res.iterations++;
+            bool outside = ((x - upper) * df - fx) * ((x - lower) * df - fx) > 0;
+            if (outside || std::abs(2 * fx) > std::abs(dx_old * df)) {
+                dx_old = dx;
+                dx = (upper - lower) / 2;
+                x = lower + dx;
+            } else {
+                dx_old = dx;
+                dx = fx / df;
+                x -= dx;
+            }
+            fx = f(x);
+            df = _df.eval(point.data());
+            if (fx < 0) lower = x;
+            else upper = x;
+            if (close(dx, x, options.tolerance) || fx == 0) {
+                res.converged = true;
+                break;
+            }
+        }
+        res.root = x;
+        res.value = fx;
+        return res;
+    }
+}
+
+template<typename Num>
+SolverResult<Num> Solver<Num>::minimize(Num start, const std::vector<Num> &parameters, SolverOptions options) const {
+    check_parameters(parameters.size());
+    std::vector<Num> point(_inputs.size());
+    std::copy(parameters.begin(), parameters.end(), point.begin() + 1);
+    point[0] = start;
+    Num fx = _f.eval(point.data());
+    SolverResult<Num> res{start, fx, 0, false};
+    while (!res.converged && res.iterations < options.max_iterations) {
+        Num x = point[0];
+        Num g = _df.eval(point.data());
+        Num h = _ddf.eval(point.data());
+        if (g == Num(0)) {
+            res.converged = true;
+            break;
+        }
+        Num dx;
+        if constexpr (std::is_same_v<Num, rational>) {
+            dx = h > 0 ? g / h : g;
+            point[0] = x - dx;
+            Num fn = _f.eval(point.data());
+            for (int halving = 0; halving < options.max_halvings && fn >= fx; halving++) {
+                dx /= 2;
+                point[0] = x - dx;
+                fn = _f.eval(point.data());
+            }
+            fx = fn;
+        } else {
+            if (h == Num(0)) break;
+            dx = g / h;
+            point[0] = x - dx;
+            fx = _f.eval(point.data());
+        }
+        res.iterations++;
+        res.converged = close(dx, point[0], options.tolerance);
+    }
+    res.root = point[0];
+    res.value = fx;
+    return res;
+}
+
+// All rows advance in lockstep so each iteration is a handful of batched
+// program runs; finished rows get a zero step and stop counting iterations.
+template<typename Num>
+std::vector<SolverResult<Num>> Solver<Num>::solve_batch(const std::vector<Num> &starts,
+                                                        const std::vector<std::vector<Num>> &parameters,
+                                                        SolverMethod method, SolverOptions options) const {
+    std::size_t rows = starts.size();
+    check_parameters(parameters.size());
+    for (const auto &column : parameters) {
+        if (column.size() != rows) {
+            throw std::invalid_argument("parameter column length differs from the number of starts");
+        }
+    }
+    std::vector<Num> x = starts, trial(rows), fx(rows), fn(rows), df(rows), ddf(rows), dx(rows);
+    std::vector<const Num *> columns(_inputs.size());
+    for (std::size_t p = 0; p < parameters.size(); p++) {
+        columns[p + 1] = parameters[p].data();
+    }
+    std::vector<SolverResult<Num>> res(rows, SolverResult<Num>{Num(0), Num(0), 0, false});
+
+    columns[0] = x.data();
+    _f.eval_batch(columns.data(), rows, fx.data());
+    std::size_t active = 0;
+    for (std::size_t r = 0; r < rows; r++) {
+        res[r].converged = fx[r] == Num(0);
+        active += !res[r].converged;
+    }
+    for (int iteration = 0; iteration < options.max_iterations && active; iteration++) {
+        columns[0] = x.data();
+        _df.eval_batch(columns.data(), rows, df.data());
+        if (method == SolverMethod::Halley) _ddf.eval_batch(columns.data(), rows, ddf.data());
+        for (std::size_t r = 0; r < rows; r++) {
+            bool live = !res[r].converged && df[r] != Num(0);
+            dx[r] = live ? step(method, fx[r], df[r], ddf[r]) : Num(0);
+            trial[r] = x[r] - dx[r];
+        }
+        columns[0] = trial.data();
+        _f.eval_batch(columns.data(), rows, fn.data());
+        for (int halving = 0; halving < options.max_halvings; halving++) {
+            bool retry = false;
+            for (std::size_t r = 0; r < rows; r++) {
+                if (dx[r] != Num(0) && std::abs(fn[r]) >= std::abs(fx[r])) {
+                    dx[r] /= Num(2);
+                    trial[r] = x[r] - dx[r];
+                    retry = true;
+                }
+            }
+            if (!retry) break;
+            _f.eval_batch(columns.data(), rows, fn.data());
+        }
+        active = 0;
+        for (std::size_t r = 0; r < rows; r++) {
+            if (res[r].converged || df[r] == Num(0)) continue;
+            x[r] = trial[r];
+            fx[r] = fn[r];
+            res[r].iterations++;
+            res[r].converged = close(dx[r], x[r], options.tolerance) || fx[r] == Num(0);
+            active += !res[r].converged;
+        }
+    }
+    for (std::size_t r = 0; r < rows; r++) {
+        res[r].root = x[r];
+        res[r].value = fx[r];
+    }
+    return res;
+}
+
+
+template
+class Solver<double>;
+
+template
+class Solver<std::complex<double>>;
@@ -0,0 +1,69 @@
+#ifndef SOLVER_HPP
+#define SOLVER_HPP
+
+#include <string>
+#include <vector>
+#include "expression.hpp"
+#include "compiled.hpp"
+
+
+enum class SolverMethod {
+    Newton,
+    Halley
+};
+
+struct SolverOptions {
+    double tolerance = 1e-12;
+    int max_iterations = 100;
+    // Times a step that does not improve is halved; the last try is kept.
+    int max_halvings = 30;
+};
+
+template<typename Num = rational>
+struct SolverResult {
+    Num root;
+    Num value;
+    int iterations;
+    bool converged;
+};
+
+
+// f, f' and f'' are derived and compiled once; every solve afterwards only
+// runs the compiled programs. Inputs are the unknown followed by parameters.
+template<typename Num = rational>
+class Solver {
+public:
+    Solver(const Expression<Num> &function, const std::string &var, std::vector<std::string> parameters = {});
+
+    const std::vector<std::string> &inputs() const;
+
+    SolverResult<Num> solve(Num start, const std::vector<Num> &parameters = {},
+                            SolverMethod method = SolverMethod::Newton, SolverOptions options = {}) const;
+
+    // Safeguarded Newton inside a sign-changing bracket; real functions only.
+    SolverResult<Num> bracket(rational lower, rational upper, const std::vector<Num> &parameters = {},
+                              SolverOptions options = {}) const;
+
+    // Newton on f' = 0; for real functions it falls back to a descent step
+    // with backtracking wherever f'' is not positive.
+    SolverResult<Num> minimize(Num start, const std::vector<Num> &parameters = {}, SolverOptions options = {}) const;
+
+    // One independent problem per row: starts[r] and parameters[p][r].
+    std::vector<SolverResult<Num>> solve_batch(const std::vector<Num> &starts,
+                                               const std::vector<std::vector<Num>> &parameters = {},
+                                               SolverMethod method = SolverMethod::Newton,
+                                               SolverOptions options = {}) const;
+
+private:
+    Num step(SolverMethod method, Num f, Num df, Num ddf) const;
+
+    // Throws std::invalid_argument unless `count` values fill the parameters.
+    void check_parameters(std::size_t count) const;
+
+    std::vector<std::string> _inputs;
+    Program<Num> _f;
+    Program<Num> _df;
+    Program<Num> _ddf;
+};
+
+#endif
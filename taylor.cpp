@@ -0,0 +1,340 @@
+#include "taylor.hpp"
+#include "polynomial.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
+
+
+namespace {
+
+template<typename Num>
+using Series = std::vector<Num>;
+
+template<typename Num>
+Series<Num> constant(Num value, std::size_t n) {
+    Series<Num> res(n, Num(0));
+    res[0] = value;
+    return res;
+}
+
+template<typename Num>
+Series<Num> multiply(const Series<Num> &a, const Series<Num> &b) {
+    Series<Num> res(a.size());
+    for (std::size_t k = 0; k < a.size(); k++) {
+        Num sum = Num(0);
+        for (std::size_t i = 0; i <= k; i++) {
+            sum += a[i] * b[k - i];
+        }
+        res[k] = sum;
+    }
+    return res;
+}
+
+template<typename Num>
+Series<Num> divide(const Series<Num> &a, const Series<Num> &b) {
+    if (b[0] == Num(0)) {
+        throw std::domain_error("division by zero at the expansion point");
+    }
+    Series<Num> res(a.size());
+    for (std::size_t k = 0; k < a.size(); k++) {
+        Num sum = a[k];
+        for (std::size_t i = 1; i <= k; i++) {
+            sum -= b[i] * res[k - i];
+        }
+        res[k] = sum / b[0];
+    }
+    return res;
+}
+
+// From e' = a' e: k e_k = sum j a_j e_{k-j}.
+template<typename Num>
+Series<Num> exp_series(const Series<Num> &a) {
+    Series<Num> res(a.size());
+    res[0] = std::exp(a[0]);
+    for (std::size_t k = 1; k < a.size(); k++) {
+        Num sum = Num(0);
+        for (std::size_t j = 1; j <= k; j++) {
+            sum += Num(j) * a[j] * res[k - j];
+        }
+        res[k] = sum / Num(k);
+    }
+    return res;
+}
+
+// From a l' = a': k a_0 l_k = k a_k - sum_{j<k} j l_j a_{k-j}.
+template<typename Num>
+Series<Num> log_series(const Series<Num> &a) {
+    if (a[0] == Num(0)) {
+        throw std::domain_error("logarithm of zero at the expansion point");
+    }
+    Series<Num> res(a.size());
+    res[0] = std::log(a[0]);
+    for (std::size_t k = 1; k < a.size(); k++) {
+        Num sum = Num(k) * a[k];
+        for (std::size_t j = 1; j < k; j++) {
+            sum -= Num(j) * res[j] * a[k - j];
+        }
+        res[k] = sum / (Num(k) * a[0]);
+    }
+    return res;
+}
+
+// s' = a' c and c' = -a' s, advanced together.
+template<typename Num>
+void sin_cos_series(const Series<Num> &a, Series<Num> &s, Series<Num> &c) {
+    s.assign(a.size(), Num(0));
+    c.assign(a.size(), Num(0));
+    s[0] = std::sin(a[0]);
+    c[0] = std::cos(a[0]);
+    for (std::size_t k = 1; k < a.size(); k++) {
+        Num sum_s = Num(0), sum_c = Num(0);
+        for (std::size_t j = 1; j <= k; j++) {
+            sum_s += Num(j) * a[j] * c[k - j];
+            sum_c += Num(j) * a[j] * s[k - j];
+        }
+        s[k] = sum_s / Num(k);
+        c[k] = -sum_c / Num(k);
+    }
+}
+
+template<typename Num>
+bool natural(Num value, unsigned long &res) {
+    double real = std::real(value);
+    if (std::imag(value) != 0 || real < 0 || real != std::floor(real) || real > 1e9) {
+        return false;
+    }
+    res = static_cast<unsigned long>(real);
+    return true;
+}
+
+// a^beta for a constant exponent, from a p' = beta a' p:
+// k a_0 p_k = sum ((beta + 1) j - k) a_j p_{k-j}. A series vanishing at the
+// point only has a power series for natural exponents, handled by factoring
+// out its leading zeros.
+template<typename Num>
+Series<Num> power_series(const Series<Num> &a, Num beta) {
+    std::size_t n = a.size();
+    unsigned long exponent = 0;
+    bool is_natural = natural(beta, exponent);
+    if (is_natural && exponent == 0) {
+        return constant(Num(1), n);
+    }
+    std::size_t lead = 0;
+    while (lead < n && a[lead] == Num(0)) {
+        lead++;
+    }
+    if (lead > 0 && !is_natural) {
+        throw std::domain_error("power of zero has no Taylor series at the expansion point");
+    }
+    Series<Num> res(n, Num(0));
+    if (lead == n || lead * exponent >= n) {
+        return res;
+    }
+    std::size_t shift = lead * exponent;
+    std::size_t m = n - shift;
+    res[shift] = std::pow(a[lead], beta);
+    for (std::size_t k = 1; k < m; k++) {
+        Num sum = Num(0);
+        for (std::size_t j = 1; j <= k; j++) {
+            sum += ((beta + Num(1)) * Num(j) - Num(k)) * a[lead + j] * res[shift + k - j];
+        }
+        res[shift + k] = sum / (Num(k) * a[lead]);
+    }
+    return res;
+}
+
+// Post-order over the distinct nodes. Polynomial nodes are expanded through
+// their lowered form, derivatives through their expansion.
+template<typename Num>
+Series<Num> expand(const Expression<Num> &root, const std::string &var, Num point, std::size_t n,
+                   const std::map<std::string, Num> &parameters) {
+    std::unordered_map<const ExpressionTempl<Num> *, Series<Num>> done;
+    std::unordered_map<const ExpressionTempl<Num> *, Expression<Num>> lowered;
+    std::vector<std::pair<const ExpressionTempl<Num> *, bool>> stack = {{&root.node(), false}};
+    while (!stack.empty()) {
+        const ExpressionTempl<Num> *node = stack.back().first;
+        bool visited = stack.back().second;
+        if (done.count(node)) {
+            stack.pop_back();
+            continue;
+        }
+        NodeKind kind = node->kind();
+        if (!visited) {
+            stack.back().second = true;
+            if (kind == NodeKind::Value) {
+                done.emplace(node, constant(static_cast<const Value<Num> *>(node)->value(), n));
+                stack.pop_back();
+            } else if (kind == NodeKind::Variable) {
+                const std::string &name = static_cast<const Variable<Num> *>(node)->name();
+                if (name == var) {
+                    Series<Num> res = constant(point, n);
+                    if (n > 1) res[1] = Num(1);
+                    done.emplace(node, std::move(res));
+                } else {
+                    auto it = parameters.find(name);
+                    if (it == parameters.end()) {
+                        throw std::out_of_range("no value for variable " + name);
+                    }
+                    done.emplace(node, constant(it->second, n));
+                }
+                stack.pop_back();
+            } else if (kind == NodeKind::Poly) {
+                auto it = lowered.emplace(node, static_cast<const PolyExpr<Num> *>(node)->lowered()).first;
+                stack.emplace_back(&it->second.node(), false);
+            } else {
+                for (std::size_t i = 0; i < node->arity(); i++) {
+                    stack.emplace_back(&node->operand(i).node(), false);
+                }
+            }
+            continue;
+        }
+        stack.pop_back();
+        auto at = [&](std::size_t i) -> const Series<Num> & { return done.at(&node->operand(i).node()); };
+        Series<Num> res;
+        switch (kind) {
+            case NodeKind::Poly:
+                res = done.at(&lowered.at(node).node());
+                break;
+            case NodeKind::Dif:
+                res = at(0);
+                break;
+            case NodeKind::Add:
+            case NodeKind::Sub:
+            case NodeKind::Sum: {
+                res.assign(n, Num(0));
+                const auto *sum = kind == NodeKind::Sum ? static_cast<const SumExpr<Num> *>(node) : nullptr;
+                for (std::size_t i = 0; i < node->arity(); i++) {
+                    bool negated = sum ? sum->negated(i) : kind == NodeKind::Sub && i == 1;
+                    const Series<Num> &term = at(i);
+                    for (std::size_t k = 0; k < n; k++) {
+                        res[k] = negated ? res[k] - term[k] : res[k] + term[k];
+                    }
+                }
+                break;
+            }
+            case NodeKind::Mul:
+                res = multiply(at(0), at(1));
+                break;
+            case NodeKind::Div:
+                res = divide(at(0), at(1));
+                break;
+            case NodeKind::Product: {
+                const auto *product = static_cast<const ProductExpr<Num> *>(node);
+                res = constant(Num(1), n);
+                for (std::size_t i = 0; i < node->arity(); i++) {
+                    res = product->inverted(i) ? divide(res, at(i)) : multiply(res, at(i));
+                }
+                break;
+            }
+            case NodeKind::Pow: {
+                const Series<Num> &exponent = at(1);
+                bool fixed = true;
+                for (std::size_t k = 1; k < n; k++) {
+                    fixed = fixed && exponent[k] == Num(0);
+                }
+                res = fixed ? power_series(at(0), exponent[0])
+                            : exp_series(multiply(exponent, log_series(at(0))));
+                break;
+            }
+            case NodeKind::Ln:
+                res = log_series(at(0));
+                break;
+            case NodeKind::Sin:
+            case NodeKind::Cos: {
+                Series<Num> s, c;
+                sin_cos_series(at(0), s, c);
+                res = kind == NodeKind::Sin ? std::move(s) : std::move(c);
+                break;
+            }
+            case NodeKind::Exp:
+                res = exp_series(at(0));
+                break;
+            default:
+                throw std::logic_error("unexpected node in Taylor expansion");
+        }
+        done.emplace(node, std::move(res));
+    }
+    return done.at(&root.node());
+}
+
+}
+
+
+template<typename Num>
+TaylorSeries<Num>::TaylorSeries(const Expression<Num> &expr, const std::string &var, Num point, unsigned order,
+                                const std::map<std::string, Num> &parameters)
+        : _var(var), _point(point), _coefficients(expand(expr, var, point, order + std::size_t(1), parameters)) {}
+
+template<typename Num>
+const std::string &TaylorSeries<Num>::var() const {
+    return _var;
+}
+
+template<typename Num>
+Num TaylorSeries<Num>::point() const {
+    return _point;
+}
+
+template<typename Num>
+unsigned TaylorSeries<Num>::order() const {
+    return _coefficients.size() - 1;
+}
+
+template<typename Num>
+const std::vector<Num> &TaylorSeries<Num>::coefficients() const {
+    return _coefficients;
+}
+
+template<typename Num>
+Num TaylorSeries<Num>::derivative(unsigned k) const {
+    if (k >= _coefficients.size()) {
+        throw std::out_of_range("derivative order exceeds the expansion order");
+    }
+    Num res = _coefficients[k];
+    for (unsigned i = 2; i <= k; i++) {
+        res *= Num(i);
+    }
+    return res;
+}
+
+template<typename Num>
+Num TaylorSeries<Num>::eval(Num x) const {
+    Num h = x - _point;
+    Num res = _coefficients.back();
+    for (std::size_t k = _coefficients.size() - 1; k-- > 0;) {
+        res = res * h + _coefficients[k];
+    }
+    return res;
+}
+
+template<typename Num>
+Expression<Num> TaylorSeries<Num>::to_expression() const {
+    Polynomial<Num> shift = Polynomial<Num>::variable(_var) - Polynomial<Num>(_point);
+    Polynomial<Num> res(_coefficients.back());
+    for (std::size_t k = _coefficients.size() - 1; k-- > 0;) {
+        res = res * shift + Polynomial<Num>(_coefficients[k]);
+    }
+    return Expression<Num>(make_node<PolyExpr<Num>>(std::move(res)));
+}
+
+template<typename Num>
+TaylorSeries<Num> taylor(const Expression<Num> &expr, const std::string &var, Num point, unsigned order,
+                         const std::map<std::string, Num> &parameters) {
+    return TaylorSeries<Num>(expr, var, point, order, parameters);
+}
+
+
+template
+class TaylorSeries<double>;
+
+template
+class TaylorSeries<std::complex<double>>;
+
+template
+TaylorSeries<double> taylor(const Expression<double> &expr, const std::string &var, double point, unsigned order,
+                            const std::map<std::string, double> &parameters);
+
+template
+TaylorSeries<std::complex<double>> taylor(const Expression<std::complex<double>> &expr, const std::string &var,
+                                          std::complex<double> point, unsigned order,
+                                          const std::map<std::string, std::complex<double>> &parameters);
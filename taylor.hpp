@@ -0,0 +1,50 @@
+#ifndef TAYLOR_HPP
+#define TAYLOR_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include "expression.hpp"
+
+
+// Truncated Taylor expansion of an expression in one variable, the other
+// variables being fixed by `parameters`. Every distinct node is evaluated
+// once as a power series in (var - point) through the usual recurrences for
+// products, quotients, powers, exp, ln, sin and cos, so an expansion costs
+// O(order^2) per node instead of repeated symbolic differentiation.
+template<typename Num = rational>
+class TaylorSeries {
+public:
+    // Throws std::domain_error when the expression has no Taylor series at
+    // the point (a pole, a branch point of ln or of a fractional power).
+    TaylorSeries(const Expression<Num> &expr, const std::string &var, Num point, unsigned order,
+                 const std::map<std::string, Num> &parameters = {});
+
+    const std::string &var() const;
+
+    Num point() const;
+
+    unsigned order() const;
+
+    // Coefficient k multiplies (var - point)^k.
+    const std::vector<Num> &coefficients() const;
+
+    // k-th derivative by var at the point.
+    Num derivative(unsigned k) const;
+
+    Num eval(Num x) const;
+
+    // The truncated series as a polynomial node in var.
+    Expression<Num> to_expression() const;
+
+private:
+    std::string _var;
+    Num _point;
+    std::vector<Num> _coefficients;
+};
+
+template<typename Num = rational>
+TaylorSeries<Num> taylor(const Expression<Num> &expr, const std::string &var, Num point, unsigned order,
+                         const std::map<std::string, Num> &parameters = {});
+
+#endif
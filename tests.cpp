@@ -1,4 +1,28 @@
 #include "expression.hpp"
+#include "polynomial.hpp"
+#include "solver.hpp"
+#include "integrate.hpp"
+#include "server.hpp"
+#include "bulk.hpp"
+#include "compact.hpp"
+#include "columns.hpp"
+#include "jacobian.hpp"
+#include "codegen.hpp"
+#include "approximation.hpp"
+#include "taylor.hpp"
+#include "autotune.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 template<typename Num>
 void print_standart(Expression<Num> expr, std::map<std::string, Num> args, Num answer, int test_number = -1) {
@@ -13,6 +37,17 @@ void print_standart(Expression<Num> expr, std::map<std::string, Num> args, Num a
     return;
 }
 
+template<typename Num>
+void print_close(Num solution, Num answer, int test_number = -1, double eps = 1e-9) {
+    std::cout << "=======================================================\n";
+    std::cout << "test:: " << test_number << '\n';
+    std::cout << "solution:: " << solution << '\n';
+    std::cout << "answer:: " << answer << '\n';
+    std::cout << "verdict:: " << (std::abs(answer - solution) <= eps * (1 + std::abs(answer)) ? "OK" : "FALE") << '\n';
+    std::cout << "=======================================================\n";
+    return;
+}
+
 void test_values() {
     std::cout << "=======================================================\n";
     std::cout << "testing values\n";
@@ -134,6 +169,15 @@ void test_vars_sub() {
     print_standart<complex>(Expression<complex>("x * (y + x ^ sin(y))").sub(c_arg1), c_arg3,
                             complex(2, 5) *
                             (complex(10, 2) + std::pow(complex(2, 5), std::sin(complex(10, 2)))), 6);
+
+    Expression<rational> untouched("sin(y) * exp(y)");
+    Expression<rational> expr = untouched + Expression<rational>("x ^ 2 + ln(x)");
+    Expression<rational> partial = expr.sub(arg1);
+    std::cout << "verdict:: " << (&partial.node().operand(0).node() == &untouched.node() ? "OK" : "FALE") << '\n';
+    std::cout << "verdict:: " << (partial.node().operand(1).kind() == NodeKind::Value ? "OK" : "FALE") << '\n';
+    std::cout << "verdict:: " << (&expr.sub({{"z", 1}}).node() == &expr.node() ? "OK" : "FALE") << '\n';
+    print_standart<rational>(partial, {{"y", 2}}, expr.eval(arg2), 10);
+    print_close<rational>(expr.dif("x").sub(arg1).eval({{"y", 2}}), 2 * 3 + 1.0 / 3, 11);
     std::cout << "///////////////////////////////////////////////////////\n";
     return;
 }
@@ -160,6 +204,867 @@ void test_dif() {
     return;
 }
 
+void test_lazy_dif() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing lazy differentiation\n";
+    std::map<std::string, rational> arg1 = {{"x", 3}};
+    std::map<std::string, rational> arg2 = {{"x", 3},
+                                            {"y", 2}};
+    Expression<rational> deep("exp(sin(x * y) / (x + y)) * ln(x ^ y)");
+    print_standart<rational>(Expression<rational>("cos(x)").dif("x"), arg1, -std::sin(3), 1);
+    print_standart<rational>(Expression<rational>("x / y").dif("y"), arg2, (double) -3 / 4, 2);
+    print_standart<rational>(Expression<rational>("x * x * x").dif("x").dif("x"), arg1, 18, 3);
+    print_standart<rational>(deep.dif("x"), arg2, deep.dif("x").sub(arg2).eval({}), 4);
+
+    std::map<std::string, complex> c_arg1 = {{"x", complex(2, 5)}};
+    Expression<complex> c_expr("sin(x) * x");
+    print_standart<complex>(c_expr.dif("x"), c_arg1,
+                            std::cos(complex(2, 5)) * complex(2, 5) + std::sin(complex(2, 5)), 5);
+    std::cout << "memoized:: " << (&c_expr.dif("x").node() == &c_expr.dif("x").node() ? "OK" : "FALE") << '\n';
+
+    // Concurrent dif() and evaluation of shared nodes agree with a serial run.
+    Expression<rational> shared("sin(x * y) / (x + y) + x ^ 3");
+    rational serial = shared.dif("x").dif("y").eval(arg2);
+    std::vector<rational> results(4);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; t++) {
+        workers.emplace_back([&, t] {
+            for (int k = 0; k < 200; k++) {
+                results[t] = shared.dif("x").dif("y").eval(arg2);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    std::cout << "verdict:: " << (std::all_of(results.begin(), results.end(), [&](rational r) {
+        return r == serial;
+    }) ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_refcounting() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing non-atomic reference counting\n";
+    std::map<std::string, rational> arg1 = {{"x", 3}};
+    Expression<rational> outlived(0);
+    {
+        RefCountScope scope(RefCounting::NonAtomic);
+        Expression<rational> expr("x * x + sin(x)");
+        Expression<rational> copy = expr;
+        outlived = std::move(copy);
+        print_standart<rational>(expr.dif("x"), arg1, 2 * 3 + std::cos(3), 1);
+    }
+    print_standart<rational>(outlived, arg1, 3 * 3 + std::sin(3), 2);
+    // Containers only move elements whose moves cannot throw.
+    bool nothrow = std::is_nothrow_move_constructible_v<Expression<rational>> &&
+                   std::is_nothrow_move_assignable_v<Expression<complex>>;
+    std::cout << "verdict:: " << (nothrow ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_polynomial() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing polynomial form\n";
+    std::map<std::string, rational> arg1 = {{"x", 3}};
+    std::map<std::string, rational> arg2 = {{"x", 3},
+                                            {"y", 2}};
+    Expression<rational> poly = polynomial_form(Expression<rational>("3 * x ^ 2 + 2 * x * y - 5 * (y - x)"));
+    print_standart<rational>(poly, arg2, 3 * 9 + 2 * 3 * 2 - 5 * (2 - 3), 1);
+    print_standart<rational>(poly.dif("x"), arg2, 6 * 3 + 2 * 2 + 5, 2);
+    print_standart<rational>(polynomial_form(Expression<rational>("(x + 1) ^ 12")), arg1, std::pow(4.0, 12), 3);
+    print_standart<rational>(polynomial_form(Expression<rational>("(x ^ 2 + 1) / (x - 2)")).dif("x"), arg1,
+                             (2.0 * 3 * 1 - 10 * 1) / 1, 4);
+    Expression<rational> mixed = polynomial_form(Expression<rational>("sin(x * x + 1) * x"));
+    print_standart<rational>(mixed, arg1, std::sin(10) * 3, 5);
+    // 135751 terms when expanded: left as a power, without expanding first.
+    auto start = std::chrono::steady_clock::now();
+    Expression<rational> wide = polynomial_form(Expression<rational>("(a + b + c + d + e) ^ 40"));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "verdict:: " << (wide.kind() == NodeKind::Pow && seconds < 5 ? "OK" : "FALE") << '\n';
+
+    std::map<std::string, complex> c_arg1 = {{"x", complex(2, 5)}};
+    print_standart<complex>(polynomial_form(Expression<complex>("x * x - 2i * x + 1")), c_arg1,
+                            complex(2, 5) * complex(2, 5) - complex(0, 2) * complex(2, 5) + complex(1, 0), 6);
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_solver() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing solver\n";
+    Solver<rational> square(Expression<rational>("x ^ 2 - a"), "x");
+    print_close<rational>(square.solve(1, {2}).root, std::sqrt(2.0), 1);
+    print_close<rational>(square.solve(1, {2}, SolverMethod::Halley).root, std::sqrt(2.0), 2);
+
+    Solver<rational> fixed(Expression<rational>("cos(x) - x"), "x");
+    print_close<rational>(fixed.bracket(0, 1).root, 0.7390851332151607, 3);
+
+    Solver<rational> parabola(Expression<rational>("(x - 3) ^ 2 + 1"), "x");
+    print_close<rational>(parabola.minimize(-10).root, 3, 4);
+
+    auto batch = square.solve_batch({1, 1, 1, 1}, {{1, 4, 9, 16}});
+    for (int r = 0; r < 4; r++) {
+        print_close<rational>(batch[r].root, r + 1, 5 + r);
+    }
+
+    Solver<rational> arc(Expression<rational>("x / exp(ln(1 + x * x) / 2)"), "x");
+    SolverOptions few;
+    few.max_halvings = 2;
+    few.max_iterations = 3;
+    auto single = arc.solve(3, {}, SolverMethod::Newton, few);
+    auto lockstep = arc.solve_batch({3}, {}, SolverMethod::Newton, few);
+    std::cout << "verdict:: " << (single.root == lockstep[0].root && single.iterations == lockstep[0].iterations ? "OK" : "FALE")
+              << '\n';
+
+    Solver<complex> roots(Expression<complex>("x ^ 3 - 1"), "x");
+    print_close<complex>(roots.solve(complex(-1, 1)).root, complex(-0.5, std::sqrt(3.0) / 2), 9);
+    auto c_batch = roots.solve_batch({complex(-1, 1), complex(-1, -1), complex(2, 0)}, {}, SolverMethod::Halley);
+    print_close<complex>(c_batch[1].root, complex(-0.5, -std::sqrt(3.0) / 2), 10);
+    print_close<complex>(c_batch[2].root, complex(1, 0), 11);
+
+    Program<rational> pooled(Expression<rational>("x * 2 + ln(a)").sub({{"a", -1}}));
+    std::cout << "verdict:: " << (std::isnan(pooled.eval({{"x", 3}})) ? "OK" : "FALE") << '\n';
+    int rejected = 0;
+    for (auto attempt : std::vector<std::function<void()>>{[&] { square.solve(1); },
+                                                            [&] { square.minimize(1, {1, 2}); },
+                                                            [&] { square.bracket(0, 3); },
+                                                            [&] { square.solve_batch({1, 1}, {}); },
+                                                            [&] { square.solve_batch({1, 1}, {{4}}); }}) {
+        try {
+            attempt();
+        } catch (const std::invalid_argument &) {
+            rejected++;
+        }
+    }
+    std::cout << "verdict:: " << (rejected == 5 ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_integrate() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing integration\n";
+    auto sine = integrate(Expression<rational>("sin(x)"), "x", 0, std::acos(-1.0));
+    print_close<rational>(sine.value, 2, 1);
+    auto gauss = integrate(Expression<rational>("exp(x * x * a)"), "x", -6, 6, {{"a", -1}});
+    print_close<rational>(gauss.value, std::sqrt(std::acos(-1.0)), 2);
+    std::cout << "evaluations:: " << gauss.evaluations << " error:: " << gauss.error << '\n';
+    auto peak = integrate(Expression<rational>("1 / (x * x + a)"), "x", -1, 1, {{"a", 0.0001}});
+    print_close<rational>(peak.value, 2 * std::atan(100.0) / 0.01, 3);
+
+    auto box = integrate_tensor(Expression<rational>("x * y + exp(y)"), {"x", "y"}, {0, 0}, {1, 1});
+    print_close<rational>(box.value, 0.25 + std::exp(1.0) - 1, 4);
+    IntegrationOptions loose;
+    loose.tolerance = 1e-3;
+    auto sampled = integrate_monte_carlo(Expression<rational>("x * y"), {"x", "y"}, {0, 0}, {1, 1}, {}, loose);
+    print_close<rational>(sampled.value, 0.25, 5, 1e-2);
+
+    auto wave = integrate(Expression<complex>("exp(1i * x)"), "x", 0, 1);
+    print_close<complex>(wave.value, (std::exp(complex(0, 1)) - complex(1, 0)) / complex(0, 1), 6);
+    bool failed = false;
+    try {
+        integrate_tensor(Expression<rational>("x * y"), {"x", "y"}, {0, 0}, {1, 1}, {{"y", 2}});
+    } catch (const std::invalid_argument &) {
+        failed = true;
+    }
+    std::cout << "verdict:: " << (failed ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_server() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing server requests\n";
+    Server server(2);
+    std::string answers[][2] = {
+            {"eval x * y + 1 | x=2, y=3", "ok 7"},
+            {"eval x * y + 1 | x=5 y=3", "ok 16"},
+            {"eval x * y | x=(1,2) y=(0,1)", "ok (-2,1)"},
+            {"diff x * x | x", "ok ((x * (1.000000 + 0.000000i)) + ((1.000000 + 0.000000i) * x))"},
+            {"eval z | x=1", "error no value for variable z"},
+            {"eval x * y + 1 | x=1 y=1", "ok 2"},
+    };
+    int test_number = 1;
+    for (auto &answer : answers) {
+        std::string response = server.handle(answer[0]);
+        std::cout << "test:: " << test_number++ << " request:: " << answer[0] << '\n';
+        std::cout << "verdict:: " << (response == answer[1] ? "OK" : "FALE") << '\n';
+    }
+    ServerStats stats = server.stats();
+    std::cout << "verdict:: " << (stats.requests == 6 && stats.hits == 2 && stats.entries == 4 ? "OK" : "FALE")
+              << '\n';
+    bool failed = false;
+    try {
+        Server empty(0);
+    } catch (const std::invalid_argument &) {
+        failed = true;
+    }
+    std::cout << "verdict:: " << (failed ? "OK" : "FALE") << '\n';
+
+    // A second client is answered while the first holds its connection open.
+    std::string path = "server_test.sock";
+    std::thread listener([&] { server.serve_socket(path); });
+    auto connect_client = [&] {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, path.c_str());
+        for (;;) {
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (connect(fd, (sockaddr *) &addr, sizeof(addr)) == 0) return fd;
+            close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    };
+    auto request = [](int fd, const std::string &line) {
+        std::string response;
+        char c;
+        if (write(fd, line.data(), line.size()) < 0) return response;
+        while (read(fd, &c, 1) == 1 && c != '\n') {
+            response += c;
+        }
+        return response;
+    };
+    int first = connect_client();
+    int second = connect_client();
+    std::cout << "verdict:: " << (request(first, "eval x + 1 | x=1\n") == "ok 2" &&
+                                  request(second, "eval x + 2 | x=1\n") == "ok 3" ? "OK" : "FALE") << '\n';
+    if (write(second, "shutdown\n", 9) < 0) std::cout << "verdict:: FALE\n";
+    listener.join();
+    close(first);
+    close(second);
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_bulk() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing bulk loading\n";
+    std::string path = "bulk_catalog.txt";
+    {
+        std::ofstream catalog(path);
+        catalog << "x * y + 1\n";
+        catalog << "sin(x) * y\n";
+        catalog << "\n";
+        catalog << "sin(\n";
+        catalog << "x * y + 1\n";
+        for (int i = 0; i < 500; i++) {
+            catalog << "x ^ " << i % 50 << " + y * " << i << '\n';
+        }
+    }
+    ExpressionStore<rational> store;
+    BulkOptions options;
+    options.threads = 4;
+    options.simplify = true;
+    auto items = load_catalog_file<rational>(path, {"x", "y"}, store, options);
+    std::remove(path.c_str());
+
+    std::map<std::string, rational> arg = {{"x", 3},
+                                           {"y", 2}};
+    std::cout << "verdict:: " << (items.size() == 504 ? "OK" : "FALE") << '\n';
+    std::cout << "verdict:: " << (items[2].line == 4 && !items[2].ok && !items[2].error.empty() ? "OK" : "FALE")
+              << '\n';
+    std::cout << "verdict:: " << (items[0].ok && items[0].expression == items[3].expression ? "OK" : "FALE")
+              << '\n';
+    print_standart<rational>(store[items[1].derivatives[0]], arg, std::cos(3) * 2, 4);
+    print_standart<rational>(store[items[104].derivatives[1]], arg, 100, 5);
+    std::cout << "verdict:: " << (store.size() < 3 * 503 ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_compact() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing compact store\n";
+    Expression<rational> x("x"), y("y");
+    Expression<rational> shared = (x * y).sin() + Expression<rational>(2);
+    Expression<rational> expr = shared * shared + (x ^ Expression<rational>(3)) / y.exp();
+    std::map<std::string, rational> arg = {{"x", 1.5},
+                                           {"y", -0.5}};
+    CompactStore<rational> store;
+    auto root = store.add(expr);
+    print_close<rational>(store.eval(root, arg), expr.eval(arg), 1);
+    print_standart<rational>(store.to_expression(root), arg, expr.eval(arg), 2);
+    std::cout << "verdict:: " << (store.add(Expression<rational>("(sin(x * y) + 2) * (sin(x * y) + 2) + x ^ 3 / exp(y)")) == root ? "OK" : "FALE") << '\n';
+    auto derivative = store.add(expr.dif("x"));
+    print_close<rational>(store.eval(derivative, arg), expr.dif("x").eval(arg), 4);
+
+    Expression<rational> sum(0);
+    for (int i = 0; i < 200; i++) {
+        sum = sum + x * Expression<rational>(i) + (y ^ Expression<rational>(i % 7));
+    }
+    CompactStore<rational> big;
+    auto big_root = big.add(sum);
+    big.shrink_to_fit();
+    print_close<rational>(big.eval(big_root, arg), sum.eval(arg), 5);
+    std::cout << "verdict:: " << (big.memory_usage().total() < memory_usage(sum).total() ? "OK" : "FALE") << '\n';
+    // A lazy derivative is one node on top of what it differentiates.
+    Expression<rational> base("sin(x) * x + 1");
+    std::cout << "verdict:: " << (memory_usage(base.dif("x")).nodes == memory_usage(base).nodes + 1 ? "OK" : "FALE")
+              << '\n';
+
+    Expression<complex> z("z");
+    Expression<complex> wave = (z * Expression<complex>(complex(0, 1))).exp() - z.cos();
+    CompactStore<complex> complex_store;
+    auto wave_root = complex_store.add(wave);
+    print_close<complex>(complex_store.eval(wave_root, {{"z", complex(0.3, -0.2)}}),
+                         wave.eval({{"z", complex(0.3, -0.2)}}), 7);
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_parameters() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing parameter binding\n";
+    Expression<rational> model("exp(a * b) * x + sin(a) / (y + b)");
+    Program<rational> program(model);
+    std::map<std::string, rational> params = {{"a", 0.5},
+                                              {"b", 1.5}};
+    Program<rational> bound = program.bind(params);
+    std::cout << "verdict:: " << (bound.inputs() == std::vector<std::string>{"x", "y"} ? "OK" : "FALE") << '\n';
+    std::cout << "verdict:: " << (bound.size() < program.size() ? "OK" : "FALE") << '\n';
+    print_close<rational>(bound.eval({{"x", 2},
+                                      {"y", 3}}), model.eval({{"a", 0.5},
+                                                              {"b", 1.5},
+                                                              {"x", 2},
+                                                              {"y", 3}}), 3);
+
+    std::vector<rational> xs = {1, 2, 3}, ys = {0.5, -1, 4}, out(3);
+    const rational *columns[] = {xs.data(), ys.data()};
+    bound.eval_batch(columns, 3, out.data());
+    print_close<rational>(out[2], model.eval({{"a", 0.5},
+                                              {"b", 1.5},
+                                              {"x", 3},
+                                              {"y", 4}}), 4);
+
+    Program<rational> polynomial(polynomial_form(Expression<rational>("x ^ 2 * a + a ^ 3")));
+    print_close<rational>(polynomial.bind({{"a", 2}}).eval({{"x", 3}}), 26, 5);
+    params["x"] = 2;
+    params["y"] = 3;
+    print_close<rational>(program.bind(params).eval({}), model.eval(params), 6);
+
+    Program<rational> logarithm(Expression<rational>("ln(a) + x * 2"));
+    Program<rational> nan_bound = logarithm.bind({{"a", -1}}), inf_bound = logarithm.bind({{"a", 0}});
+    std::vector<rational> three = {3}, value(1);
+    const rational *three_column[] = {three.data()};
+    rational *value_column[] = {value.data()};
+    std::uint8_t status = 0;
+    nan_bound.eval_batch(three_column, 1, value_column, &status);
+    std::cout << "verdict:: " << (std::isnan(value[0]) && (status & EvalStatus::NaN) ? "OK" : "FALE") << '\n';
+    rational infinite = inf_bound.eval({{"x", 3}});
+    std::cout << "verdict:: " << (std::isinf(infinite) && infinite < 0 ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_expression_set() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing expression sets\n";
+    Expression<rational> model("exp(a * x) * sin(a * x) + y");
+    std::vector<Expression<rational>> exprs = {model, model.dif("x"), model.dif("a"), Expression<rational>("sin(a * x)")};
+    ExpressionSet<rational> set(exprs);
+    std::map<std::string, rational> arg = {{"a", 0.3},
+                                           {"x", 2},
+                                           {"y", -1}};
+    auto values = set.eval(arg);
+    print_close<rational>(values[0], model.eval(arg), 1);
+    print_close<rational>(values[1], model.dif("x").eval(arg), 2);
+    print_close<rational>(values[2], model.dif("a").eval(arg), 3);
+    std::size_t separate = 0;
+    for (const auto &expr : exprs) {
+        separate += Program<rational>(expr).size();
+    }
+    std::cout << "verdict:: " << (set.program().size() < separate ? "OK" : "FALE") << '\n';
+
+    std::vector<rational> as = {0.3, 0.1}, xs = {2, -1}, ys = {-1, 5};
+    std::vector<std::vector<rational>> out(4, std::vector<rational>(2));
+    const rational *columns[] = {as.data(), xs.data(), ys.data()};
+    rational *outs[] = {out[0].data(), out[1].data(), out[2].data(), out[3].data()};
+    set.eval_batch(columns, 2, outs);
+    print_close<rational>(out[0][0], values[0], 5);
+    print_close<rational>(out[2][1], model.dif("a").eval({{"a", 0.1},
+                                                          {"x", -1},
+                                                          {"y", 5}}), 6);
+    print_close<rational>(out[3][1], std::sin(-0.1), 7);
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_columns() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing column files\n";
+    std::size_t rows = 1000;
+    {
+        std::ofstream x("column_x.bin", std::ios::binary), y("column_y.bin", std::ios::binary);
+        for (std::size_t r = 0; r < rows; r++) {
+            rational xv = r * 0.01, yv = 1 + r % 7;
+            x.write(reinterpret_cast<const char *>(&xv), sizeof(xv));
+            y.write(reinterpret_cast<const char *>(&yv), sizeof(yv));
+        }
+    }
+    Expression<rational> expr("sin(x) * y + x / y");
+    ColumnOptions options;
+    options.chunk_rows = 300;
+    std::size_t count = eval_columns(Program<rational>(std::vector<Expression<rational>>{expr, expr.dif("x")}),
+                                     {{"x", "column_x.bin"},
+                                      {"y", "column_y.bin"}}, {"column_f.bin", "column_df.bin"}, options);
+    std::cout << "verdict:: " << (count == rows ? "OK" : "FALE") << '\n';
+    {
+        MappedFile f("column_f.bin"), df("column_df.bin");
+        const rational *values = static_cast<const rational *>(f.data());
+        const rational *slopes = static_cast<const rational *>(df.data());
+        std::cout << "verdict:: " << (f.size() == rows * sizeof(rational) ? "OK" : "FALE") << '\n';
+        print_close<rational>(values[777], expr.eval({{"x", 7.77},
+                                                      {"y", 1 + 777 % 7}}), 3);
+        print_close<rational>(slopes[999], expr.dif("x").eval({{"x", 9.99},
+                                                               {"y", 1 + 999 % 7}}), 4);
+    }
+    bool failed = false;
+    try {
+        eval_columns(Program<rational>(Expression<rational>("x * z")), {{"x", "column_x.bin"}}, {"column_f.bin"});
+    } catch (const std::invalid_argument &) {
+        failed = true;
+    }
+    std::cout << "verdict:: " << (failed ? "OK" : "FALE") << '\n';
+    failed = false;
+    try {
+        eval_columns(Program<rational>(Expression<rational>("x * 2")), {{"x", "column_x.bin"}}, {"./column_x.bin"});
+    } catch (const std::invalid_argument &) {
+        failed = true;
+    }
+    std::cout << "verdict:: " << (failed && MappedFile("column_x.bin").size() == rows * sizeof(rational) ? "OK" : "FALE")
+              << '\n';
+    failed = false;
+    try {
+        eval_columns(Program<rational>(std::vector<Expression<rational>>{expr, expr}),
+                     {{"x", "column_x.bin"}, {"y", "column_y.bin"}}, {"column_g.bin", "./column_g.bin"});
+    } catch (const std::invalid_argument &) {
+        failed = true;
+    }
+    std::cout << "verdict:: " << (failed && !std::ifstream("column_g.bin") ? "OK" : "FALE") << '\n';
+    for (const char *path : {"column_x.bin", "column_y.bin", "column_f.bin", "column_df.bin"}) {
+        std::remove(path);
+    }
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_flatten() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing flattened sums and products\n";
+    std::map<std::string, rational> arg = {{"x", 0.7},
+                                           {"y", -1.3}};
+    Expression<rational> chain("x - y + 3 * x - (y - x) + sin(x + y + x)");
+    Expression<rational> flat = chain.flatten();
+    std::cout << "verdict:: " << (flat.kind() == NodeKind::Sum && flat.node().arity() == 6 ? "OK" : "FALE") << '\n';
+    print_close<rational>(flat.eval(arg), chain.eval(arg), 2);
+    print_close<rational>(flat.dif("y").eval(arg), chain.dif("y").eval(arg), 3);
+    print_close<rational>(flat.eval_dif(arg, "x").second, chain.dif("x").eval(arg), 4);
+
+    Expression<rational> ratio("x * y / (x + 2) * (y / x) / y * 5");
+    Expression<rational> product = ratio.flatten();
+    std::cout << "verdict:: " << (product.kind() == NodeKind::Product && product.node().arity() == 7 ? "OK" : "FALE")
+              << '\n';
+    print_close<rational>(product.eval(arg), ratio.eval(arg), 6);
+    print_close<rational>(product.dif("x").eval(arg), ratio.dif("x").eval(arg), 7);
+    print_close<rational>(product.eval_dif(arg, "y").second, ratio.dif("y").eval(arg), 8);
+    print_close<rational>(Program<rational>(product).eval(arg), ratio.eval(arg), 9);
+    print_close<rational>(product.sub({{"x", 0.7}}).eval({{"y", -1.3}}), ratio.eval(arg), 10);
+    print_close<rational>(product.simplify().eval(arg), ratio.eval(arg), 11);
+    CompactStore<rational> store;
+    print_close<rational>(store.eval(store.add(product), arg), ratio.eval(arg), 12);
+
+    Expression<rational> cancel(1e16);
+    for (int i = 0; i < 100; i++) {
+        cancel = cancel + Expression<rational>("x");
+    }
+    cancel = cancel - Expression<rational>(1e16);
+    print_close<rational>(cancel.flatten(true).eval({{"x", 1}}), 100, 13, 0);
+    std::cout << "verdict:: " << (cancel.flatten().eval({{"x", 1}}) != 100 ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_jacobian() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing jacobians\n";
+    std::vector<Expression<rational>> functions = {Expression<rational>("x * y + sin(x) * a"),
+                                                   Expression<rational>("exp(y / x) - y ^ 3"),
+                                                   Expression<rational>("ln(z) * a"),
+                                                   polynomial_form(Expression<rational>("x * x * z + 2 * z"))};
+    std::map<std::string, rational> arg = {{"x", 0.7},
+                                           {"y", -1.3},
+                                           {"z", 2.5},
+                                           {"a", 0.4}};
+    int test = 1;
+    for (JacobianMode mode : {JacobianMode::Forward, JacobianMode::Reverse}) {
+        Jacobian<rational> jacobian(functions, {"x", "y", "z"}, {"a"}, mode);
+        std::cout << "verdict:: " << (jacobian.nonzeros() == 7 && jacobian.columns()[4] == 2 ? "OK" : "FALE") << '\n';
+        std::vector<rational> values = jacobian.eval(arg);
+        for (std::size_t row = 0; row < jacobian.rows(); row++) {
+            for (std::size_t k = jacobian.row_start()[row]; k < jacobian.row_start()[row + 1]; k++) {
+                const std::string &var = jacobian.inputs()[jacobian.columns()[k]];
+                print_close<rational>(values[k], functions[row].dif(var).eval(arg), test++);
+            }
+        }
+    }
+    Jacobian<rational> wide({Expression<rational>("x * y * z")});
+    Jacobian<rational> tall(functions, {"x"}, {"y", "z", "a"});
+    std::cout << "verdict:: " << (wide.mode() == JacobianMode::Reverse && tall.mode() == JacobianMode::Forward
+                                  && wide.cols() == 3 ? "OK" : "FALE") << '\n';
+
+    Jacobian<rational> jacobian(functions, {"x", "y", "z"}, {"a"});
+    std::vector<rational> xs = {0.7, 1.1}, ys = {-1.3, 0.2}, zs = {2.5, 3}, as = {0.4, -2};
+    const rational *columns[] = {xs.data(), ys.data(), zs.data(), as.data()};
+    std::vector<std::vector<rational>> out(jacobian.nonzeros(), std::vector<rational>(2));
+    std::vector<rational *> outs;
+    for (auto &column : out) {
+        outs.push_back(column.data());
+    }
+    jacobian.eval_batch(columns, 2, outs.data());
+    print_close<rational>(out[1][1], functions[0].dif("y").eval({{"x", 1.1},
+                                                                 {"y", 0.2},
+                                                                 {"z", 3},
+                                                                 {"a", -2}}), test++);
+    rational point[] = {0.7, -1.3, 2.5, 0.4};
+    std::vector<rational> dense(jacobian.rows() * jacobian.cols());
+    jacobian.eval_dense(point, dense.data());
+    print_close<rational>(dense[1 * 3 + 1], functions[1].dif("y").eval(arg), test++);
+    std::cout << "verdict:: " << (dense[0 * 3 + 2] == 0 && dense[2 * 3 + 0] == 0 ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_codegen() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing c++ code generation\n";
+    CodegenOptions options;
+    options.name = "model";
+    std::string code = emit_cpp(Expression<rational>("sin(x * y) + x * y ^ 2 + a"), {"x", "y"}, options);
+    for (const char *signature : {"inline T model(const T &v_a, const T &v_x, const T &v_y)",
+                                  "inline T model_d_x(const T &v_a, const T &v_x, const T &v_y)",
+                                  "inline void model_all(const T &v_a, const T &v_x, const T &v_y, T *out)",
+                                  "inline void model_batch(const T *v_a, const T *v_x, const T *v_y, std::size_t n, "
+                                  "T *value, T *d_x, T *d_y)"}) {
+        std::cout << "verdict:: " << (code.find(signature) != std::string::npos ? "OK" : "FALE") << '\n';
+    }
+    std::string all = code.substr(code.find("model_all"), code.find("model_batch") - code.find("model_all"));
+    std::size_t products = 0;
+    for (std::size_t at = all.find("v_x * v_y"); at != std::string::npos; at = all.find("v_x * v_y", at + 1)) {
+        products++;
+    }
+    std::cout << "verdict:: " << (products == 1 && all.find("T(0)") == std::string::npos ? "OK" : "FALE") << '\n';
+    bool failed = false;
+    try {
+        options.name = "not a name";
+        emit_cpp(Expression<rational>("x"), {}, options);
+    } catch (const std::invalid_argument &) {
+        failed = true;
+    }
+    std::cout << "verdict:: " << (failed ? "OK" : "FALE") << '\n';
+    failed = false;
+    try {
+        options.name = "model";
+        emit_cpp(Expression<rational>("x + int"), {"int"}, options);
+    } catch (const std::invalid_argument &) {
+        failed = true;
+    }
+    std::cout << "verdict:: " << (failed ? "OK" : "FALE") << '\n';
+    failed = false;
+    try {
+        emit_cpp(Expression<rational>("x * y"), {"x", "y", "x"}, options);
+    } catch (const std::invalid_argument &) {
+        failed = true;
+    }
+    std::cout << "verdict:: " << (failed ? "OK" : "FALE") << '\n';
+
+    // Variables named like generated locals, and constants folded to NaN and
+    // -inf, must still give a header that compiles.
+    Expression<rational> clash = Expression<rational>("t2 * sin(x) + n + out * ln(a) + value * ln(b)").sub({{"a", -1},
+                                                                                                      {"b", 0}});
+    {
+        std::ofstream("codegen_check.hpp") << emit_cpp(clash, {"x", "n", "value"}, options);
+        std::ofstream check("codegen_check.cpp");
+        check << "#include \"codegen_check.hpp\"\n"
+              << "int main() {\n"
+              << "    double n = 1, out = 2, t2 = 3, value = 4, x = 5, f[1], d_x[1], d_n[1], d_value[1], all[4];\n"
+              << "    model_all(n, out, t2, value, x, all);\n"
+              << "    model_batch(&n, &out, &t2, &value, &x, 1, f, d_x, d_n, d_value);\n"
+              << "    return std::isnan(model(n, out, t2, value, x)) && std::isnan(f[0]) && std::isnan(all[1]) ? 0 : 1;\n"
+              << "}\n";
+    }
+    int status = std::system("g++ -std=c++17 -o codegen_check codegen_check.cpp && ./codegen_check");
+    std::cout << "verdict:: " << (status == 0 ? "OK" : "FALE") << '\n';
+    for (const char *path : {"codegen_check.hpp", "codegen_check.cpp", "codegen_check"}) {
+        std::remove(path);
+    }
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_approximation() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing piecewise chebyshev approximation\n";
+    Expression<rational> expr("exp(ln(x + a) ^ (3 / 2)) * sin(3 * x)");
+    ApproximationOptions options;
+    options.tolerance = 1e-10;
+    PiecewiseChebyshev approx(expr, "x", 0, 3, {{"a", 2}}, options);
+    std::cout << "verdict:: " << (approx.converged() && approx.pieces() > 1 && approx.max_error() <= 1e-10 ? "OK" : "FALE")
+              << '\n';
+    double worst = 0;
+    std::vector<double> xs, out(1000);
+    for (int i = 0; i < 1000; i++) {
+        xs.push_back(3.0 * i / 999);
+        worst = std::max(worst, std::abs(approx.eval(xs[i]) - expr.eval({{"x", xs[i]},
+                                                                          {"a", 2}})));
+    }
+    std::cout << "verdict:: " << (worst <= 1e-9 ? "OK" : "FALE") << '\n';
+    approx.eval_batch(xs.data(), xs.size(), out.data());
+    print_standart<rational>(Expression<rational>(out[777]), {}, approx.eval(xs[777]), 3);
+
+    Expression<rational> surface("exp(x * y) * sin(x + 2 * y)");
+    options.tolerance = 1e-8;
+    options.degree = 8;
+    PiecewiseChebyshev2D approx2(surface, "x", "y", -1, 1, 0, 2, {}, options);
+    worst = 0;
+    for (int i = 0; i < 40; i++) {
+        for (int j = 0; j < 40; j++) {
+            double x = -1 + 2.0 * i / 39, y = 2.0 * j / 39;
+            worst = std::max(worst, std::abs(approx2.eval(x, y) - surface.eval({{"x", x},
+                                                                                 {"y", y}})));
+        }
+    }
+    std::cout << "verdict:: " << (approx2.converged() && worst <= 1e-7 ? "OK" : "FALE") << '\n';
+    double px[] = {0.3, -0.9}, py[] = {1.7, 0.1}, pout[2];
+    approx2.eval_batch(px, py, 2, pout);
+    print_close<rational>(pout[1], surface.eval({{"x", -0.9},
+                                                 {"y", 0.1}}), 5, 1e-7);
+
+    options.max_depth = 5;
+    PiecewiseChebyshev root(Expression<rational>("x ^ (1 / 2)"), "x", 0, 1, {}, options);
+    std::cout << "verdict:: " << (!root.converged() && root.max_error() > 1e-8 ? "OK" : "FALE") << '\n';
+
+    // Degree 1 fits constants and lines exactly in one piece.
+    options = ApproximationOptions();
+    options.degree = 1;
+    options.tolerance = 1e-6;
+    bool exact = true;
+    for (const char *text : {"5", "x", "2 * x - 3"}) {
+        PiecewiseChebyshev line(Expression<rational>(text), "x", 0, 1, {}, options);
+        exact = exact && line.converged() && line.pieces() == 1 && line.max_error() <= 1e-12;
+    }
+    PiecewiseChebyshev2D plane(Expression<rational>("x + 2 * y"), "x", "y", 0, 1, 0, 1, {}, options);
+    exact = exact && plane.converged() && plane.pieces() == 1;
+    std::cout << "verdict:: " << (exact ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_structural_hash() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing structural hashing and equality\n";
+    Expression<rational> a("x * y + sin(x) / 2"), b("x * y + sin(x) / 2"), c("y * x + sin(x) / 2");
+    std::cout << "verdict:: " << (a == b && a.hash() == b.hash() && a != c ? "OK" : "FALE") << '\n';
+    std::cout << "verdict:: " << (a.dif("x") == b.dif("x") && a.dif("x") != b.dif("y") ? "OK" : "FALE") << '\n';
+    Expression<rational> sum(0.1 + 0.2), third(0.3);
+    std::cout << "verdict:: " << (sum.to_string() == third.to_string() && sum != third ? "OK" : "FALE") << '\n';
+    Expression<rational> cubic = polynomial_form(Expression<rational>("(x + y) ^ 3 - 3 * x * y * (x + y)"));
+    std::cout << "verdict:: " << (cubic.kind() == NodeKind::Poly &&
+                                  cubic == polynomial_form(Expression<rational>("x ^ 3 + y ^ 3")) ? "OK" : "FALE")
+              << '\n';
+    std::cout << "verdict:: " << (a.flatten() == b.flatten() && a.flatten() != a.flatten(true) ? "OK" : "FALE") << '\n';
+
+    std::unordered_set<Expression<rational>> catalog = {a, b, c, a.dif("x"), b.dif("x")};
+    std::cout << "verdict:: " << (catalog.size() == 3 ? "OK" : "FALE") << '\n';
+    ExpressionStore<rational> store;
+    std::size_t first = store.intern(sum), second = store.intern(third), again = store.intern(Expression<rational>(0.3));
+    std::cout << "verdict:: " << (first != second && second == again && store.size() == 2 ? "OK" : "FALE") << '\n';
+
+    Expression<rational> x("x"), lhs(1), rhs(1);
+    for (int i = 0; i < 100000; i++) {
+        lhs = (lhs * x + Expression<rational>(1)).sin();
+        rhs = (rhs * x + Expression<rational>(1)).sin();
+    }
+    std::cout << "verdict:: " << (lhs == rhs && lhs != (rhs + x) ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_deep() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing million-node chains\n";
+    const int terms = 1000000;
+    std::map<std::string, rational> arg = {{"x", 0.5}};
+    {
+        std::string text = "x";
+        for (int i = 1; i < terms; i++) {
+            text += " + x";
+        }
+        Expression<rational> chain(text);
+        print_close<rational>(chain.eval(arg), terms * 0.5, 1);
+        print_close<rational>(chain.dif("x").eval(arg), terms, 2);
+        std::cout << "verdict:: " << (chain.to_string().size() == text.size() + 2 * (terms - 1) ? "OK" : "FALE")
+                  << '\n';
+        // Deep enough to overflow the stack of a recursive conversion.
+        Expression<rational> shorter(text.substr(0, 1 + 4 * (terms / 10 - 1)));
+        print_close<rational>(polynomial_form(shorter).eval(arg), terms / 10 * 0.5, 3);
+    }
+    Expression<rational> x("x");
+    for (int length : {terms, terms / 10}) {
+        Expression<rational> nested(1);
+        for (int i = 0; i < length; i++) {
+            nested = (nested * x + Expression<rational>(1)).sin();
+        }
+        rational value = 1, slope = 0;
+        for (int i = 0; i < length; i++) {
+            slope = std::cos(value * 0.5 + 1) * (slope * 0.5 + value);
+            value = std::sin(value * 0.5 + 1);
+        }
+        print_close<rational>(nested.eval(arg), value, 4);
+        print_close<rational>(nested.dif("x").eval(arg), slope, 5);
+        if (length < terms) {
+            print_standart<rational>(nested.sub(arg), {}, value, 6);
+            print_close<rational>(nested.simplify().eval(arg), value, 7);
+            print_close<rational>(Program<rational>(nested).eval(arg), value, 8);
+        }
+    }
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_taylor() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing taylor expansion\n";
+    Expression<rational> expr("exp(sin(x)) * ln(x + a) / (2 + cos(x * x))");
+    std::map<std::string, rational> point = {{"x", 0.5},
+                                             {"a", 1}};
+    TaylorSeries<rational> series = taylor(expr, "x", 0.5, 8, {{"a", 1}});
+    print_close<rational>(series.derivative(0), expr.eval(point), 1, 1e-12);
+    print_close<rational>(series.derivative(1), expr.dif("x").eval(point), 2, 1e-10);
+    print_close<rational>(series.derivative(3), expr.dif("x").dif("x").dif("x").eval(point), 3, 1e-8);
+    print_close<rational>(series.eval(0.6), expr.eval({{"x", 0.6},
+                                                       {"a", 1}}), 4, 1e-8);
+
+    Expression<rational> root("(x + 3) ^ (3 / 2) * x ^ 2");
+    TaylorSeries<rational> around_zero = taylor(root, "x", 0.0, 5);
+    print_close<rational>(around_zero.coefficients()[2], std::pow(3.0, 1.5), 5, 1e-12);
+    std::cout << "verdict:: " << (around_zero.coefficients()[0] == 0 && around_zero.coefficients()[1] == 0 ? "OK" : "FALE")
+              << '\n';
+
+    TaylorSeries<rational> wave = taylor(Expression<rational>("sin(x) * exp(x)"), "x", 0.0, 30);
+    print_close<rational>(wave.eval(1.5), std::sin(1.5) * std::exp(1.5), 7, 1e-12);
+    Expression<rational> poly = wave.to_expression();
+    std::cout << "verdict:: " << (poly.kind() == NodeKind::Poly ? "OK" : "FALE") << '\n';
+    print_close<rational>(taylor(expr, "x", 0.5, 4, {{"a", 1}}).to_expression().eval(point), expr.eval(point), 9,
+                          1e-12);
+
+    bool thrown = false;
+    try {
+        taylor(Expression<rational>("ln(x)"), "x", 0.0, 3);
+    } catch (const std::domain_error &) {
+        thrown = true;
+    }
+    std::cout << "verdict:: " << (thrown ? "OK" : "FALE") << '\n';
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_eval_status() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing batch error reporting\n";
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    Program<rational> program(Expression<rational>("ln(x) + y / z + 1 / (1 / x)"));
+    std::vector<double> x = {1, -1, 0, nan, 2, 1}, y = {1, 1, 1, 1, 1, 0}, z = {1, 1, 1, 1, 0, 0}, out(6);
+    const double *columns[] = {x.data(), y.data(), z.data()};
+    double *outs[] = {out.data()};
+    std::uint8_t status[6];
+    program.eval_batch(columns, 6, outs, status);
+    std::uint8_t expected[] = {0, EvalStatus::Domain | EvalStatus::NaN, EvalStatus::Domain,
+                               EvalStatus::Missing | EvalStatus::NaN, EvalStatus::Domain,
+                               EvalStatus::Domain | EvalStatus::NaN};
+    std::cout << "verdict:: " << (std::equal(status, status + 6, expected) ? "OK" : "FALE") << '\n';
+    print_standart<rational>(Expression<rational>(out[0]), {}, 2, 2);
+
+    Program<rational> growth(Expression<rational>("exp(x) * 2"));
+    std::vector<double> big = {1000, 1};
+    const double *growth_columns[] = {big.data()};
+    growth.eval_batch(growth_columns, 2, outs, status);
+    std::cout << "verdict:: " << (status[0] == EvalStatus::Overflow && status[1] == 0 ? "OK" : "FALE") << '\n';
+
+    const double *partial[] = {x.data(), nullptr, z.data()};
+    program.eval_batch(partial, 6, outs, status);
+    std::cout << "verdict:: " << (std::all_of(status, status + 6, [](std::uint8_t s) {
+        return (s & EvalStatus::Missing) && (s & EvalStatus::NaN);
+    }) ? "OK" : "FALE") << '\n';
+
+    Expression<rational> model("a * x + b");
+    std::vector<std::string> unbound = unbound_variables<rational>({model}, {"x"});
+    std::string message;
+    try {
+        Program<rational>(model, {"x"});
+    } catch (const std::invalid_argument &error) {
+        message = error.what();
+    }
+    std::cout << "verdict:: " << (unbound == std::vector<std::string>{"a", "b"} &&
+                                  message == "variables a, b are not program inputs" ? "OK" : "FALE") << '\n';
+
+    bool thrown = false;
+    try {
+        Expression<rational>("x").node().eval({});
+    } catch (const std::out_of_range &) {
+        thrown = true;
+    }
+    std::cout << "verdict:: " << (thrown ? "OK" : "FALE") << '\n';
+    print_standart<rational>(Expression<rational>("pi * 2"), {{"pi", 3}}, 6, 7);
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
+void test_autotune() {
+    std::cout << "=======================================================\n";
+    std::cout << "testing autotuned evaluation\n";
+    std::string path = "autotune_test.cache";
+    std::remove(path.c_str());
+    Expression<rational> expr("sin(x) * y + ln(x + 2) ^ 2 - x / y");
+    TuneOptions options;
+    options.cache_path = path;
+    options.sample_rows = 1 << 13;
+    options.max_threads = 2;
+    options.repeats = 1;
+    TunedEvaluator<rational> tuned(expr, 5000, options);
+    TunedEvaluator<rational> again(expr, 4100, options);
+    std::cout << "verdict:: " << (!tuned.from_cache() && again.from_cache() &&
+                                  again.choice().strategy == tuned.choice().strategy &&
+                                  again.choice().chunk_rows == tuned.choice().chunk_rows ? "OK" : "FALE") << '\n';
+
+    std::vector<double> x(5000), y(5000), expected(5000), out(5000);
+    for (int i = 0; i < 5000; i++) {
+        x[i] = 0.25 + i * 0.001;
+        y[i] = 1 + i % 7;
+        expected[i] = expr.eval({{"x", x[i]},
+                                 {"y", y[i]}});
+    }
+    const double *columns[] = {x.data(), y.data()};
+    tuned.eval_batch(columns, 5000, out.data());
+    bool same = true;
+    for (Strategy strategy : {Strategy::TreeWalk, Strategy::Interpreted, Strategy::Vectorized, Strategy::Threaded}) {
+        std::fill(out.begin(), out.end(), 0);
+        tuned.run({strategy, 700, 2}, columns, 5000, out.data());
+        for (int i = 0; i < 5000; i++) {
+            same = same && std::abs(out[i] - expected[i]) <= 1e-12;
+        }
+    }
+    std::cout << "verdict:: " << (same ? "OK" : "FALE") << '\n';
+
+    TunedEvaluator<rational> other(Expression<rational>("x * y"), 5000, options);
+    std::cout << "verdict:: " << (!other.from_cache() ? "OK" : "FALE") << '\n';
+    std::remove(path.c_str());
+    std::cout << "///////////////////////////////////////////////////////\n";
+    return;
+}
+
 int main() {
     test_values();
     test_additing_subtracting();
@@ -169,5 +1074,25 @@ int main() {
     test_parcing();
     test_vars_sub();
     test_dif();
+    test_lazy_dif();
+    test_refcounting();
+    test_polynomial();
+    test_solver();
+    test_integrate();
+    test_server();
+    test_bulk();
+    test_compact();
+    test_parameters();
+    test_expression_set();
+    test_columns();
+    test_deep();
+    test_flatten();
+    test_jacobian();
+    test_codegen();
+    test_approximation();
+    test_structural_hash();
+    test_taylor();
+    test_eval_status();
+    test_autotune();
     return 0;
 }